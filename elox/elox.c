@@ -26,6 +26,20 @@ static void repl(EloxRunCtxHandle *runHandle) {
 int main(int argc, char **argv) {
 	EloxConfig config;
 	eloxInitConfig(&config);
+	config.moduleCacheDir = getenv("ELOX_MODULE_CACHE");
+	config.gc.incremental = (getenv("ELOX_GC_INCREMENTAL") != NULL);
+	EloxModuleLoader loaders[] = {
+		config.moduleCacheDir != NULL ?
+			(EloxModuleLoader){ .loader = eloxCachingModuleLoader } :
+			(EloxModuleLoader){
+				.loader = eloxFileModuleLoader,
+				.options = (getenv("ELOX_WRITE_IMAGES") != NULL) ? ELOX_FML_WRITE_IMAGES : 0
+			},
+		{ .loader = eloxNativeModuleLoader },
+		{ .loader = eloxBuiltinModuleLoader, .options = ELOX_BML_ENABLE_ALL },
+		{ .loader = NULL }
+	};
+	config.moduleLoaders = loaders;
 	EloxVMCtx *vmCtx = eloxNewVMCtx(&config);
 	if (vmCtx == NULL)
 		exit(60);
@@ -170,16 +170,47 @@ typedef enum {
 EloxValue eloxBuiltinModuleLoader(EloxRunCtx *runCtx, const EloxString *moduleName, uint64_t options,
 								  EloxError *error);
 
+typedef enum {
+	// after compiling a module, write a precompiled image next to its source
+	ELOX_FML_WRITE_IMAGES = 1 << 0
+} EloxFileModuleLoaderOptions;
+
+// Loads modules from source files, preferring an up to date precompiled
+// image (the source path with an .eloxc extension) when one exists
 EloxValue eloxFileModuleLoader(EloxRunCtx *runCtx, const EloxString *moduleName, uint64_t options,
 							   EloxError *error);
 
+typedef enum {
+	// only use images already in the cache, never write new ones
+	ELOX_CML_READ_ONLY = 1 << 0
+} EloxCachingModuleLoaderOptions;
+
+// Loads modules from source files like eloxFileModuleLoader, but keeps
+// compiled images in EloxConfig.moduleCacheDir, named after the module and a
+// hash of its source. Modules are simply compiled if no directory is set
+EloxValue eloxCachingModuleLoader(EloxRunCtx *runCtx, const EloxString *moduleName, uint64_t options,
+								  EloxError *error);
+
 EloxValue eloxNativeModuleLoader(EloxRunCtx *runCtx, const EloxString *moduleName, uint64_t options,
 								 EloxError *error);
 
+typedef struct {
+	// mark full collections incrementally, interleaved with the running program
+	bool incremental;
+	// maximum number of objects traced by one incremental step, at least 1
+	// (0 is raised to 1)
+	uint32_t markBudget;
+	// target maximum duration of one incremental step, in microseconds (0 = no limit)
+	uint32_t maxPauseUs;
+} EloxGCConfig;
+
 typedef struct EloxConfig {
 	EloxAllocator allocator;
 	EloxIOWrite writeCallback;
 	EloxModuleLoader *moduleLoaders;
+	// existing directory for eloxCachingModuleLoader images, NULL to disable
+	const char *moduleCacheDir;
+	EloxGCConfig gc;
 } EloxConfig;
 
 void eloxInitConfig(EloxConfig *config);
@@ -1,9 +1,12 @@
 #ifndef ELOX_VALUE_TABLE_H
 #define ELOX_VALUE_TABLE_H
 
-// Based on the deterministic hash table described by Jason Orendorff
+// Entries are kept in insertion order, as in the deterministic hash table
+// described by Jason Orendorff
 // (see https://wiki.mozilla.org/User:Jorend/Deterministic_hash_tables).
-// Originally attributed to Tyler Close
+// They are indexed by an open addressing table in the style of Abseil's
+// Swiss tables: one control byte per slot, holding 7 bits of the hash or
+// an empty/deleted marker, probed a group of 16 slots at a time
 
 #include <elox/value.h>
 
@@ -12,20 +15,19 @@ typedef struct ExecContext ExecContext;
 typedef struct {
 	Value key;
 	Value value;
-	int32_t next;
-	union {
-		uint32_t hash;
-	};
+	uint32_t hash;
 } TableEntry;
 
 typedef struct {
-	int32_t *chains;
+	// indexSize / 16 groups of 16 control bytes and 16 entry indexes
+	uint8_t *groups;
 	TableEntry *entries;
 	int32_t indexSize;
 	int32_t dataSize;
-	uint32_t indexShift;
+	uint32_t groupMask;
 	int32_t fullCount; // includes deleted entries
 	int32_t liveCount;
+	int32_t deletedSlots; // index slots marked deleted
 	uint32_t modCount;
 } ValueTable;
 
@@ -36,6 +38,10 @@ bool valueTableContains(RunCtx *runCtx, ValueTable *table, Value key, EloxError
 int32_t valueTableGetNext(ValueTable *table, int32_t start, TableEntry **valueEntry);
 bool valueTableSet(RunCtx *runCtx, ValueTable *table, Value key, Value value, EloxError *error);
 bool valueTableDelete(RunCtx *runCtx, ValueTable *table, Value key, EloxError *error);
+// Removes the entry at entryIndex. Entries may move when the table is
+// compacted; if not NULL, cursor is an iteration position that gets
+// adjusted to keep pointing to the same entry
+bool valueTableRemoveEntry(ValueTable *table, int32_t entryIndex, int32_t *cursor);
 void markValueTable(RunCtx *runCtx, ValueTable *table);
 
 #endif // ELOX_VALUE_TABLE_H
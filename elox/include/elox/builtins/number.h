@@ -0,0 +1,24 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ELOX_BUILTINS_NUMBER_H
+#define ELOX_BUILTINS_NUMBER_H
+
+#include <math.h>
+#include <stdbool.h>
+
+// Sign, 17 digits, decimal point, "e-308" and some slack
+#define ELOX_NUMBER_BUFFER_SIZE 32
+
+// Integral values that fit an int64_t are printed as integers
+static inline bool isIntegralNumber(double n) {
+	return (trunc(n) == n) && (fabs(n) < 9223372036854775808.0);
+}
+
+// Writes the shortest string that reads back as the same double, or the
+// integer for integral values. Uses exponent notation below 1e-4 and at
+// 1e17 and above. Not NUL-terminated, returns the length
+int numberToChars(double value, char *buffer);
+
+#endif // ELOX_BUILTINS_NUMBER_H
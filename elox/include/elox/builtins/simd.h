@@ -0,0 +1,26 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ELOX_BUILTINS_SIMD_H
+#define ELOX_BUILTINS_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte string kernels. With ELOX_ENABLE_SIMD on x86-64 they use SSE2, or
+// AVX2 when the CPU reports it at runtime; elsewhere they are scalar.
+// Case mapping and whitespace follow upperLookup/lowerLookup and
+// isWhitespace, bytes >= 0x80 are left alone
+
+// An empty needle matches at the start of the haystack
+const uint8_t *memFind(const uint8_t *haystack, size_t haystackLen,
+					   const uint8_t *needle, size_t needleLen);
+void asciiUpper(uint8_t *dst, const uint8_t *src, size_t len);
+void asciiLower(uint8_t *dst, const uint8_t *src, size_t len);
+// Number of leading whitespace bytes
+size_t skipLeadingWhitespace(const uint8_t *str, size_t len);
+// Length of str without its trailing whitespace
+size_t trimTrailingWhitespace(const uint8_t *str, size_t len);
+
+#endif // ELOX_BUILTINS_SIMD_H
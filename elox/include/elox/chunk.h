@@ -22,10 +22,43 @@ typedef struct {
 	int line;
 } LineStart;
 
+// Destination operand of register instructions that pushes the result instead
+#define REG_STACK 0xff
+
+#define ELOX_IC_WAYS 4
+
+typedef enum {
+	IC_EMPTY,
+	IC_FIELD,
+	IC_METHOD
+} ICKind;
+
+typedef struct {
+	// field entries are matched on the shape, the class keeps it alive
+	struct ObjClass *clazz;
+	struct Shape *shape;
+	union {
+		int fieldIndex;
+		Obj *callable;
+	};
+	ICKind kind;
+} ICEntry;
+
+// Per call site cache for property lookups and method invocations, keyed on the
+// receiver class, or on its shape for fields; up to ELOX_IC_WAYS entries,
+// replaced round-robin afterwards
+typedef struct {
+	ICEntry entries[ELOX_IC_WAYS];
+	uint32_t next;
+} InlineCache;
+
 typedef struct {
 	int count;
 	int capacity;
 	uint8_t *code;
+	int icCount;
+	int icCapacity;
+	InlineCache *inlineCaches;
 	ValueArray constants;
 	ObjString *fileName;
 	int lineCount;
@@ -36,7 +69,14 @@ typedef struct {
 void initChunk(Chunk *chunk, ObjString *fileName);
 void freeChunk(RunCtx *runCtx, Chunk *chunk);
 void writeChunk(CCtx *cCtx, Chunk *chunk, uint8_t *data, uint8_t len, int line);
+void truncateChunk(Chunk *chunk, int count);
 int addConstant(RunCtx *runCtx, Chunk *chunk, Value value);
+int addInlineCache(RunCtx *runCtx, Chunk *chunk);
 int getLine(Chunk *chunk, int instruction);
+// Quickened instructions keep the operand layout of the generic sequence they
+// were written over, map them back to the generic leading instruction
+uint8_t genericOpcode(uint8_t op);
+// Length of the instruction at offset, -1 if unknown
+int instructionLength(Chunk *chunk, int offset);
 
 #endif // ELOX_CHUNK_H
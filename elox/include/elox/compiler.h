@@ -80,6 +80,16 @@ typedef struct Compiler {
 	int catchStackDepth;
 	int catchDepth;
 	int finallyDepth;
+
+	// Code offsets used to fold local/immediate arithmetic into register
+	// instructions: the last plain local load, the last immediate load,
+	// the last register instruction, the end of the last folded assignment
+	// and the highest jump target emitted so far
+	int lastLocalLoad;
+	int lastImmLoad;
+	int lastRegOp;
+	int regAssignEnd;
+	int lastJumpTarget;
 } Compiler;
 
 typedef struct ClassCompiler {
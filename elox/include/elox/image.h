@@ -0,0 +1,49 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ELOX_IMAGE_H
+#define ELOX_IMAGE_H
+
+#include <elox/value.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Precompiled module images (.eloxc). An image holds a compiled top level
+// function with all nested functions, in a layout that is specific to the
+// VM build that wrote it. Global and builtin operands are stored as indexes
+// into symbol tables that are resolved against the loading VM.
+
+#define ELOX_IMAGE_EXT "c"
+#define ELOX_IMAGE_VERSION 4
+
+#define ELOX_IMAGE_HASH_SEED 14695981039346656037ULL
+
+// 64-bit FNV-1a, chained through hash
+static inline uint64_t imageHash(uint64_t hash, const uint8_t *bytes, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Identifies the source an image was compiled from by its contents, all fields must match
+typedef struct {
+	uint64_t size;
+	uint64_t hash;
+} ImageSourceKey;
+
+struct ObjFunction;
+
+// Returns false if the image could not be written, the file is left untouched in that case
+bool writeImage(RunCtx *runCtx, struct ObjFunction *function, const ImageSourceKey *key,
+				const char *path);
+// Returns NULL without raising if the image is missing, stale or was written by another build.
+// Raises a runtime error if it matches the source but its contents are invalid
+struct ObjFunction *loadImage(RunCtx *runCtx, const char *path, const ImageSourceKey *key,
+							  EloxError *error);
+
+#endif // ELOX_IMAGE_H
@@ -0,0 +1,40 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ELOX_JIT_H
+#define ELOX_JIT_H
+
+#include <elox/value.h>
+#include <elox/elox-config-internal.h>
+
+#ifdef ELOX_ENABLE_JIT
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Calls plus backward jumps before a function is compiled to native code
+#define ELOX_JIT_HOTNESS_THRESHOLD 1000
+
+struct ObjFunction;
+struct CallFrame;
+
+typedef struct JitCode {
+	uint8_t *code;
+	size_t size;
+	// native offset for every bytecode offset that starts an instruction, 0 otherwise
+	uint32_t *entries;
+	int entryCount;
+} JitCode;
+
+// Compile a function, leaving jitCode NULL if it uses an instruction that
+// cannot even be stepped over
+void jitCompile(RunCtx *runCtx, struct ObjFunction *function);
+// Run native code from ip until the first instruction it cannot handle.
+// Returns the bytecode address to continue interpreting from
+uint8_t *jitExecute(RunCtx *runCtx, struct CallFrame *frame, uint8_t *ip);
+void jitFree(RunCtx *runCtx, struct ObjFunction *function);
+
+#endif // ELOX_ENABLE_JIT
+
+#endif // ELOX_JIT_H
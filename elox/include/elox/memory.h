@@ -25,7 +25,11 @@ typedef struct VMCtx VMCtx;
 #define FREE_ARRAY(runctx, type, pointer, oldCount) \
 	reallocate(runctx, pointer, sizeof(type) * (size_t)(oldCount), 0)
 
+#define FREE_OBJ(runctx, type, pointer) freeObjectMemory(runctx, pointer, sizeof(type))
+
 void *reallocate(RunCtx *runCtx, void *pointer, size_t oldSize, size_t newSize);
+void *allocateObjectMemory(RunCtx *runCtx, size_t size);
+void freeObjectMemory(RunCtx *runCtx, void *pointer, size_t size);
 void markObject(RunCtx *runCtx, Obj *object);
 void markValue(RunCtx *runCtx, Value value);
 void collectGarbage(RunCtx *runCtx);
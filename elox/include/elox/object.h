@@ -14,7 +14,9 @@
 #include "elox/chunk.h"
 #include "elox/ValueTable.h"
 #include "elox/function.h"
+#include "elox/jit.h"
 #include "elox/elox-config-internal.h"
+#include "elox/third-party/wyhash.h"
 
 typedef EloxString String;
 
@@ -92,15 +94,43 @@ Obj *allocateObject(RunCtx *runCtx, size_t size, ObjType type);
 #define ALLOCATE_OBJ(runCtx, type, objectType) \
 	(type *)allocateObject(runCtx, sizeof(type), objectType)
 
-static const uint8_t MARKER_BLACK = 1 << 0;
-static const uint8_t MARKER_GRAY =  1 << 1;
+static const uint8_t MARKER_BLACK =      1 << 0;
+static const uint8_t MARKER_GRAY =       1 << 1;
+// object lives in the old generation
+static const uint8_t MARKER_OLD =        1 << 2;
+// young object that already survived one minor collection
+static const uint8_t MARKER_SURVIVOR =   1 << 3;
+// old object present in the remembered set
+static const uint8_t MARKER_REMEMBERED = 1 << 4;
 
 struct Obj {
 	ObjType type: 8;
 	uint8_t markers;
+	// fits in the padding before next, 0 until assigned by objIdentityHash()
+	uint32_t identityHash;
 	struct Obj *next;
 };
 
+void gcWriteBarrierSlow(RunCtx *runCtx, Obj *object);
+
+// Must be called after storing a reference into an object that may already
+// have been promoted to the old generation or traced by incremental marking
+static inline void gcWriteBarrier(RunCtx *runCtx, Obj *owner) {
+	uint8_t markers = owner->markers;
+	if (ELOX_UNLIKELY(((markers & (MARKER_OLD | MARKER_REMEMBERED)) == MARKER_OLD) ||
+					  ((markers & (MARKER_BLACK | MARKER_GRAY)) == MARKER_BLACK)))
+		gcWriteBarrierSlow(runCtx, owner);
+}
+
+uint32_t assignIdentityHash(RunCtx *runCtx, Obj *object);
+
+// Random and stable for the lifetime of the object, assigned on first use
+static inline uint32_t objIdentityHash(RunCtx *runCtx, Obj *object) {
+	if (ELOX_UNLIKELY(object->identityHash == 0))
+		return assignIdentityHash(runCtx, object);
+	return object->identityHash;
+}
+
 typedef struct ObjClass ObjClass;
 
 typedef struct ObjFunction {
@@ -110,10 +140,16 @@ typedef struct ObjFunction {
 	uint16_t maxArgs;
 	uint16_t upvalueCount;
 	uint16_t refOffset;
+	// local slots used by the code, including slot 0
+	uint16_t slotCount;
 	Chunk chunk;
 	ObjString *name;
 	ObjClass *parentClass;
 	Value *defaultArgs;
+#ifdef ELOX_ENABLE_JIT
+	uint32_t hotness;
+	JitCode *jitCode;
+#endif
 } ObjFunction;
 
 typedef Value (*NativeFn)(Args *args);
@@ -137,12 +173,58 @@ typedef struct {
 	Value *upvalues;
 } ObjNativeClosure;
 
+// string is present in vm->strings, so equal interned strings are identical
+static const uint8_t STRING_INTERNED = 1 << 0;
+// object is an ObjRope
+static const uint8_t STRING_ROPE =     1 << 1;
+// hash has been computed
+static const uint8_t STRING_HASHED =   1 << 2;
+// bytes are stored right after the header (ObjInlineString)
+static const uint8_t STRING_INLINE =   1 << 3;
+// object is an ObjStringView
+static const uint8_t STRING_VIEW =     1 << 4;
+
 typedef struct ObjString {
 	Obj obj;
 	String string;
 	uint32_t hash;
+	uint8_t flags;
 } ObjString;
 
+// Concatenation whose bytes are only copied when they are first needed.
+// Until then string.chars is NULL; flattening fills it in place and drops
+// the children
+typedef struct {
+	ObjString str;
+	ObjString *left;
+	ObjString *right;
+} ObjRope;
+
+// Concatenations shorter than this are copied right away
+#define ELOX_ROPE_MIN_LENGTH 64
+
+// Short string, header and bytes in a single allocation. string.chars
+// points to chars
+typedef struct {
+	ObjString str;
+	uint8_t chars[];
+} ObjInlineString;
+
+// Longest string stored inline, keeps the object within a 64 byte slab class
+#define ELOX_INLINE_STRING_MAX 23
+
+static inline size_t inlineStringSize(int32_t length) {
+	return sizeof(ObjInlineString) + length + 1;
+}
+
+// Range of a flat parent string, sharing its bytes. string.chars points
+// into the parent and is not NUL terminated; terminating copies the range
+// and drops the parent
+typedef struct {
+	ObjString str;
+	ObjString *parent;
+} ObjStringView;
+
 typedef struct ObjStringPair {
 	Obj obj;
 	ObjString *str1;
@@ -213,6 +295,7 @@ typedef struct {
 } TypeInfo;
 
 typedef struct ObjMethod ObjMethod;
+typedef struct Shape Shape;
 
 typedef struct ObjClass {
 // [ Klass
@@ -225,7 +308,7 @@ typedef struct ObjClass {
 	ObjMethod *hashCode;
 	ObjMethod *equals;
 	Value super;
-	Table fields;
+	Shape *shape;
 	Table methods;
 	Table statics;
 	ValueArray staticValues;
@@ -237,14 +320,20 @@ typedef struct ObjClass {
 #define INST_HAS_HASHCODE (1UL << 0)
 #define INST_HAS_EQUALS   (1UL << 1)
 
+// Fields are stored right after the header, their number is fixed by the
+// class shape when the instance is allocated
 typedef struct ObjInstance {
 	Obj obj;
 	ObjClass *clazz;
-	uint32_t identityHash;
 	uint8_t flags;
-	ValueArray fields;
+	uint16_t fieldCount;
+	Value fields[];
 } ObjInstance;
 
+static inline size_t instanceSize(uint32_t fieldCount) {
+	return sizeof(ObjInstance) + fieldCount * sizeof(Value);
+}
+
 typedef struct ObjBoundMethod {
 	Obj obj;
 	Value receiver;
@@ -282,13 +371,10 @@ typedef struct {
 	int capacity;
 } HeapCString;
 
-static inline uint32_t hashString(const uint8_t *key, int length) {
-	uint32_t hash = 2166136261u;
-	for (int i = 0; i < length; i++) {
-		hash ^= (uint8_t)key[i];
-		hash *= 16777619;
-	}
-	return hash;
+// Seed with vm->hashSeed, hashes are only comparable within the same VM
+static inline uint32_t hashString(uint64_t seed, const uint8_t *key, int length) {
+	uint64_t hash = wyhash(key, length, seed);
+	return (uint32_t)(hash ^ (hash >> 32));
 }
 
 ObjBoundMethod *newBoundMethod(RunCtx *runCtx, Value receiver, ObjMethod *method);
@@ -312,8 +398,45 @@ ObjNative *addNativeMethod(RunCtx *runCtx, ObjClass *clazz, ObjString *methodNam
 						   NativeFn method, uint16_t arity, bool hasVarargs, EloxError *error);
 int addClassField(RunCtx *runCtx, ObjClass *clazz, ObjString *fieldName, EloxError *error);
 
+// Interned strings, for identifiers, constants and other long lived names
 ObjString *takeString(RunCtx *runCtx, uint8_t *chars, int length, int capacity);
 ObjString *copyString(RunCtx *runCtx, const uint8_t *chars, int32_t length);
+// Strings created while running, neither interned nor hashed up front
+ObjString *takeTransientString(RunCtx *runCtx, uint8_t *chars, int length, int capacity);
+ObjString *copyTransientString(RunCtx *runCtx, const uint8_t *chars, int32_t length);
+
+ObjString *concatStrings(RunCtx *runCtx, ObjString *a, ObjString *b);
+// Parent must be flat, short ranges are copied
+ObjString *newStringView(RunCtx *runCtx, ObjString *parent, int32_t start, int32_t length);
+void flattenRope(RunCtx *runCtx, ObjString *rope, EloxError *error);
+
+// Makes string.chars available
+static inline void flattenString(RunCtx *runCtx, ObjString *string, EloxError *error) {
+	if (ELOX_UNLIKELY(string->string.chars == NULL))
+		flattenRope(runCtx, string, error);
+}
+
+void terminateView(RunCtx *runCtx, ObjString *view, EloxError *error);
+
+// Makes string.chars available and NUL terminated, needed before it is
+// used as a C string
+static inline void terminateString(RunCtx *runCtx, ObjString *string, EloxError *error) {
+	if (ELOX_UNLIKELY(string->string.chars == NULL))
+		flattenRope(runCtx, string, error);
+	else if (ELOX_UNLIKELY((string->flags & STRING_VIEW) && (((ObjStringView *)string)->parent != NULL)))
+		terminateView(runCtx, string, error);
+}
+
+// String must be flat
+static inline uint32_t stringHash(uint64_t seed, ObjString *string) {
+	if (ELOX_UNLIKELY(!(string->flags & STRING_HASHED))) {
+		string->hash = hashString(seed, string->string.chars, string->string.length);
+		string->flags |= STRING_HASHED;
+	}
+	return string->hash;
+}
+
+bool stringsEqual(RunCtx *runCtx, ObjString *a, ObjString *b, EloxError *error);
 
 ObjStringPair *copyStrings(RunCtx *runCtx,
 						   const uint8_t *chars1, int len1, const uint8_t *chars2, int len2);
@@ -336,7 +459,7 @@ bool appendToArray(RunCtx *runCtx, ObjArray *array, Value value);
 bool isValidArrayIndex(ObjArray *array, int index);
 Value arrayAt(ObjArray *array, int index);
 Value arrayAtSafe(RunCtx *runCtx, ObjArray *array, int32_t index);
-void arraySet(ObjArray *array, int index, Value value);
+void arraySet(RunCtx *runCtx, ObjArray *array, int index, Value value);
 Value arraySlice(RunCtx *runCtx, ObjArray *array, ObjType type, Value start, Value end);
 bool arrayContains(RunCtx *runCtx, ObjArray *seq, const Value needle, EloxError *error);
 
@@ -418,7 +541,7 @@ static bool computeSlice(Value start, Value end, int32_t size,
 
 	if (*sliceEnd < *sliceStart)
 		*sliceEnd = *sliceStart;
-	else if (*sliceStart > size)
+	else if (*sliceEnd > size)
 		*sliceEnd = size;
 
 	return true;
@@ -83,6 +83,20 @@ OPCODE(FOREACH_INIT)
 OPCODE(UNPACK)
 OPCODE(IMPORT)
 OPCODE(DATA)
+// Register instructions, operands address frame->slots directly
+OPCODE(REG_ADD)
+OPCODE(REG_ADDI)
+OPCODE(REG_SUB)
+OPCODE(REG_SUBI)
+OPCODE(REG_MUL)
+OPCODE(REG_MULI)
+// Quickened forms, only ever written by the interpreter over their generic
+// counterparts, keeping the operand layout of the original sequence
+OPCODE(ADD_NUM_NUM)
+OPCODE(ADD_LOCAL_LOCAL)
+OPCODE(LESS_LOCAL_CONST)
+OPCODE(LESS_LOCAL_IMMI)
+OPCODE(GET_MEMBER_PROP_RETURN)
 
 #ifndef ELOX_OPCODES_INLINE
 #undef OPCODE
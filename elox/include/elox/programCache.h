@@ -0,0 +1,53 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ELOX_PROGRAM_CACHE_H
+#define ELOX_PROGRAM_CACHE_H
+
+#include <elox/object.h>
+
+// Header of a program compiled from a string, such as a parsed format
+// string or a compiled pattern. Programs are single allocations of size
+// bytes that start with this header
+typedef struct {
+	// one reference is held by the cache
+	uint32_t refCount;
+	size_t size;
+} CachedProgram;
+
+// Compiles source into a program with one reference, returns NULL after raising
+typedef CachedProgram *(*ProgramCompiler)(RunCtx *runCtx, ObjString *source, uint8_t variant,
+										  EloxError *error);
+
+// Direct-mapped, indexed by the source hash
+#define ELOX_PROGRAM_CACHE_SIZE 64
+
+typedef struct {
+	// keeps the key alive while cached, marked as a GC root
+	ObjString *source;
+	uint8_t variant;
+	CachedProgram *program;
+} ProgramCacheEntry;
+
+typedef struct {
+	ProgramCacheEntry entries[ELOX_PROGRAM_CACHE_SIZE];
+} ProgramCache;
+
+void initProgramCache(ProgramCache *cache);
+void markProgramCache(RunCtx *runCtx, ProgramCache *cache);
+void freeProgramCache(RunCtx *runCtx, ProgramCache *cache);
+
+/// Returns the program for source and variant, compiling it on a miss.
+/// The cache owns the result, which stays valid until the next lookup
+/// unless the caller retains it
+CachedProgram *getCachedProgram(RunCtx *runCtx, ProgramCache *cache, ObjString *source,
+								uint8_t variant, ProgramCompiler compile, EloxError *error);
+
+static inline void retainProgram(CachedProgram *program) {
+	program->refCount++;
+}
+
+void releaseProgram(RunCtx *runCtx, CachedProgram *program);
+
+#endif // ELOX_PROGRAM_CACHE_H
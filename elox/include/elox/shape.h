@@ -0,0 +1,63 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ELOX_SHAPE_H
+#define ELOX_SHAPE_H
+
+#include <elox/value.h>
+#include <elox/object.h>
+#include <elox/table.h>
+
+// Field layout of the instances of a class: maps field names to instance
+// slots. A class that adds no fields shares the shape of its superclass,
+// so that inline caches keyed on the shape hit for both.
+// Field names are interned and matched by identity; small shapes are
+// scanned linearly, larger ones also get a hash index
+typedef struct Shape {
+	uint32_t refCount;
+	uint32_t count;
+	uint32_t capacity;
+	// index capacity is 1 << (32 - indexShift)
+	uint32_t indexShift;
+	// slot -> name
+	ObjString **names;
+	// name -> slot + 1, 0 for empty slots
+	uint16_t *index;
+} Shape;
+
+#define ELOX_SHAPE_LINEAR_MAX 8
+
+Shape *newShape(RunCtx *runCtx);
+void releaseShape(RunCtx *runCtx, Shape *shape);
+// Adds a field in the next slot, copying the shape first if it is shared.
+// Returns the slot, or -1 if the field already exists or an error was raised
+int32_t shapeAddField(RunCtx *runCtx, Shape **shapeRef, ObjString *name, EloxError *error);
+void markShape(RunCtx *runCtx, Shape *shape);
+
+static inline Shape *retainShape(Shape *shape) {
+	shape->refCount++;
+	return shape;
+}
+
+// Returns the slot of the field, or -1
+static inline int32_t shapeLookup(const Shape *shape, const ObjString *name) {
+	if (shape->index == NULL) {
+		for (uint32_t i = 0; i < shape->count; i++) {
+			if (shape->names[i] == name)
+				return i;
+		}
+		return -1;
+	}
+
+	uint32_t mask = (1u << (32 - shape->indexShift)) - 1;
+	for (uint32_t i = indexFor(name->hash, shape->indexShift); ; i = (i + 1) & mask) {
+		uint16_t entry = shape->index[i];
+		if (entry == 0)
+			return -1;
+		if (shape->names[entry - 1] == name)
+			return entry - 1;
+	}
+}
+
+#endif // ELOX_SHAPE_H
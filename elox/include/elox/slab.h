@@ -0,0 +1,49 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef ELOX_SLAB_H
+#define ELOX_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct VMEnv VMEnv;
+
+// Size classes are multiples of the granule, up to SLAB_MAX_SIZE
+#define SLAB_GRANULE 16
+#define SLAB_MAX_SIZE 256
+#define SLAB_NUM_CLASSES (SLAB_MAX_SIZE / SLAB_GRANULE)
+// Pages are requested from the VM allocator and hold slots of a single class
+#define SLAB_PAGE_SIZE (64 * 1024)
+
+typedef struct SlabPage {
+	struct SlabPage *next;
+} SlabPage;
+
+typedef struct SlabSlot {
+	struct SlabSlot *next;
+} SlabSlot;
+
+typedef struct {
+	SlabSlot *freeList;
+	uint8_t *bump;
+	uint8_t *limit;
+} SlabClass;
+
+typedef struct {
+	SlabClass classes[SLAB_NUM_CLASSES];
+	SlabPage *pages;
+} SlabAllocator;
+
+static inline bool slabFits(size_t size) {
+	return size <= SLAB_MAX_SIZE;
+}
+
+void initSlabAllocator(SlabAllocator *slab);
+void *slabAlloc(VMEnv *env, SlabAllocator *slab, size_t size);
+void slabFree(SlabAllocator *slab, void *pointer, size_t size);
+void freeSlabAllocator(VMEnv *env, SlabAllocator *slab);
+
+#endif // ELOX_SLAB_H
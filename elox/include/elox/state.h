@@ -21,6 +21,9 @@ typedef struct VMEnv {
 
 	EloxIOWrite write;
 	EloxModuleLoader *loaders;
+	const char *moduleCacheDir;
+
+	EloxGCConfig gc;
 } VMEnv;
 
 typedef struct VMCtx {
@@ -65,7 +65,7 @@ bool tableDelete(Table *table, ObjString *key);
 void tableAddAll(RunCtx *runCtx, Table *from, Table *to, EloxError *error);
 ObjString *tableFindString(Table *table, const uint8_t *chars, int length, uint32_t hash);
 bool tableGetString(Table *table, const uint8_t *chars, int length, uint32_t hash, Value *value);
-void tableRemoveWhite(Table *table);
+void tableRemoveWhite(Table *table, uint8_t liveMask);
 void markTable(RunCtx *runCtx, Table *table);
 
 #endif // ELOX_TABLE_H
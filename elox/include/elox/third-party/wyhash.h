@@ -0,0 +1,108 @@
+/* This is free and unencumbered software released into the public domain under The Unlicense
+ * (http://unlicense.org/)
+ * main repo: https://github.com/wangyi-fudan/wyhash
+ * author: 王一 Wang Yi <godspeed_china@yeah.net>
+ * contributors: Reini Urban, Dietrich Epp, Joshua Haberman, Tommy Ettinger, Daniel Lemire,
+ * Otmar Ertl, cocowalla, leo-yuriev, Diego Barrios Romero, paulie-g, dumblob, Yann Collet,
+ * ivte-ms, hyb, James Z.M. Gao, easyaspi314 (Devin), TheOneric
+ */
+
+#ifndef ELOX_WYHASH_H
+#define ELOX_WYHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* wyhash final4, reduced to the default secret and the portable read path.
+ * Processes 16 bytes (48 in the bulk loop) per step with a 64x64->128
+ * multiply-fold, which is what makes it several times faster than a
+ * byte-at-a-time hash on long keys. The result depends on the host byte
+ * order, so hashes must not be persisted.
+ */
+
+static const uint64_t wyp[4] = {
+	0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline void wymum(uint64_t *A, uint64_t *B) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = *A;
+	r *= *B;
+	*A = (uint64_t)r;
+	*B = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *A >> 32, hb = *B >> 32, la = (uint32_t)*A, lb = (uint32_t)*B;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*A = lo;
+	*B = hi;
+#endif
+}
+
+static inline uint64_t wymix(uint64_t A, uint64_t B) {
+	wymum(&A, &B);
+	return A ^ B;
+}
+
+static inline uint64_t wyr8(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t wyr3(const uint8_t *p, size_t k) {
+	return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+static inline uint64_t wyhash(const void *key, size_t len, uint64_t seed) {
+	const uint8_t *p = (const uint8_t *)key;
+	uint64_t a, b;
+
+	seed ^= wymix(seed ^ wyp[0], wyp[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+			b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = wyr3(p, len);
+			b = 0;
+		} else
+			a = b = 0;
+	} else {
+		size_t i = len;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+				see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+				see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = wyr8(p + i - 16);
+		b = wyr8(p + i - 8);
+	}
+	a ^= wyp[1];
+	b ^= seed;
+	wymum(&a, &b);
+	return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+#endif // ELOX_WYHASH_H
@@ -11,8 +11,11 @@
 #include "elox/chunk.h"
 #include "elox/object.h"
 #include "elox/table.h"
+#include "elox/shape.h"
 #include "elox/handleSet.h"
+#include "elox/slab.h"
 #include "elox/function.h"
+#include "elox/programCache.h"
 #include <elox/third-party/rand.h>
 
 typedef struct CompilerState CompilerState;
@@ -22,6 +25,12 @@ typedef struct {
 	uint8_t initialMarkers;
 } VMHeap;
 
+typedef enum {
+	GC_PHASE_IDLE,
+	// incremental marking in progress
+	GC_PHASE_MARK
+} GCPhase;
+
 typedef struct VMTemp {
 	struct VMTemp *next;
 	Value val;
@@ -51,6 +60,7 @@ typedef struct VM {
 	Table strings;
 
 	stc64_t prng;
+	uint64_t hashSeed;
 
 	FiberCtx *initFiber;
 
@@ -222,9 +232,11 @@ typedef struct VM {
 			ObjClass *_class;
 			ObjString *mapStr;
 			ObjString *currentStr;
+			ObjString *lastRetStr;
 			ObjString *modCountStr;
 			uint16_t _map;
-			uint16_t _current;
+			uint16_t _current; // next entry to examine
+			uint16_t _lastRet; // last entry returned
 			uint16_t _modCount;
 		} biHashMapIterator;
 
@@ -236,6 +248,10 @@ typedef struct VM {
 	} builtins;
 // modules
 	Table modules;
+// compiled string patterns and format strings
+	// the pattern variant is whether a leading '^' is an anchor
+	ProgramCache patternCache;
+	ProgramCache fmtCache;
 
 	ObjClass *classes[VTYPE_MAX];
 // handles
@@ -243,15 +259,40 @@ typedef struct VM {
 // compilers
 	CompilerState *currentCompilerState;
 // for GC
+	// nursery, all new objects are allocated here
 	VMHeap mainHeap;
+	// objects promoted after surviving two collections
+	VMHeap oldHeap;
+	// old objects not yet swept after the last full collection
+	Obj *sweepList;
 	VMHeap permHeap;
 	VMHeap *heap;
+	// backing storage for fixed-size objects
+	SlabAllocator objectSlab;
 	size_t bytesAllocated;
 	size_t nextGC;
+	size_t nextFullGC;
+	bool fullGC;
+	bool youngRefSeen;
 	bool grayOverflow;
 	int grayCount;
 	int grayCapacity;
 	Obj **grayStack;
+	// old objects that may point into the nursery
+	bool rememberedOverflow;
+	int rememberedCount;
+	int rememberedCapacity;
+	Obj **rememberedSet;
+	GCPhase gcPhase;
+	// true while an incremental step traces the old generation
+	bool markingOld;
+	// old objects waiting to be traced by incremental marking
+	bool markOverflow;
+	int markCount;
+	int markCapacity;
+	Obj **markStack;
+	// minor collections keep running while marking incrementally
+	size_t nextMinorGC;
 } VM;
 
 FiberCtx *newFiberCtx(RunCtx *runCtx);
@@ -336,17 +377,15 @@ int eloxVPrintf(RunCtx *runCtx, EloxIOStream stream, const char *format, va_list
 	(runCtx)->vmEnv->write(stream, ELOX_STR_AND_LEN(string_literal))
 
 static inline bool getInstanceValue(ObjInstance *instance, ObjString *name, Value *value) {
-	ObjClass *clazz = instance->clazz;
-	Value valueIndex;
-	if (tableGet(&clazz->fields, name, &valueIndex)) {
-		int valueOffset = AS_NUMBER(valueIndex);
-		*value = instance->fields.values[valueOffset];
+	int32_t slot = shapeLookup(instance->clazz->shape, name);
+	if (slot >= 0) {
+		*value = instance->fields[slot];
 		return true;
 	}
 	return false;
 };
 
-bool setInstanceField(ObjInstance *instance, ObjString *name, Value value);
+bool setInstanceField(RunCtx *runCtx, ObjInstance *instance, ObjString *name, Value value);
 
 EloxInterpretResult run(RunCtx *runCtx);
 Value runCall(RunCtx *runCtx, int argCount);
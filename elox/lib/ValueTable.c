@@ -8,43 +8,181 @@
 
 #include <string.h>
 
-// Based on the deterministic hash table described by Jason Orendorff
+#ifdef ELOX_ENABLE_SIMD
+#include <emmintrin.h>
+#endif
+
+// Entries are kept in insertion order, as in the deterministic hash table
+// described by Jason Orendorff
 // (see https://wiki.mozilla.org/User:Jorend/Deterministic_hash_tables).
 // Originally attributed to Tyler Close
 
+#define GROUP_SIZE 16
+
+// Control bytes: full slots hold 7 bits of the hash, the markers have the
+// high bit set
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+
+// Each group holds its control bytes followed by the entry indexes of its
+// slots, so a probe mostly touches a single cache line before the entry
+#define GROUP_BYTES (GROUP_SIZE * (sizeof(uint8_t) + sizeof(int32_t)))
+
+static inline size_t indexBytes(int32_t indexSize) {
+	return (size_t)(indexSize / GROUP_SIZE) * GROUP_BYTES;
+}
+
+static inline uint8_t *groupCtrl(const ValueTable *table, uint32_t group) {
+	return table->groups + (size_t)group * GROUP_BYTES;
+}
+
+static inline int32_t *groupSlots(const ValueTable *table, uint32_t group) {
+	return (int32_t *)(groupCtrl(table, group) + GROUP_SIZE);
+}
+
+// The group and the control hash both come from the well mixed high half
+static inline uint64_t mixHash(uint32_t hash) {
+	return (uint64_t)hash * 0x9E3779B97F4A7C15ull;
+}
+
+static inline uint32_t firstGroup(uint64_t mixed, uint32_t groupMask) {
+	return (uint32_t)(mixed >> 32) & groupMask;
+}
+
+static inline uint8_t ctrlHash(uint64_t mixed) {
+	return (uint8_t)(mixed >> 57);
+}
+
+// Bit i is set if control byte i of the group matches
+
+#ifdef ELOX_ENABLE_SIMD
+
+static inline uint32_t matchByte(const uint8_t *group, uint8_t value) {
+	__m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+}
+
+static inline uint32_t matchEmptyOrDeleted(const uint8_t *group) {
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+#else
+
+static inline uint32_t matchByte(const uint8_t *group, uint8_t value) {
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; i++)
+		mask |= (uint32_t)(group[i] == value) << i;
+	return mask;
+}
+
+static inline uint32_t matchEmptyOrDeleted(const uint8_t *group) {
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; i++)
+		mask |= (uint32_t)(group[i] >> 7) << i;
+	return mask;
+}
+
+#endif // ELOX_ENABLE_SIMD
+
 void initValueTable(ValueTable *table) {
 	table->liveCount = table->fullCount = 0;
 	table->indexSize = table->dataSize = 0;
-	table->indexShift = 0;
+	table->groupMask = 0;
+	table->deletedSlots = 0;
 	table->modCount = 0;
-	table->chains = NULL;
+	table->groups = NULL;
 	table->entries = NULL;
 }
 
 void freeValueTable(RunCtx *runCtx, ValueTable *table) {
-	FREE_ARRAY(runCtx, int32_t, table->chains, table->indexSize);
+	if (table->groups != NULL)
+		GENERIC_FREE(runCtx, indexBytes(table->indexSize), table->groups);
 	FREE_ARRAY(runCtx, TableEntry, table->entries, table->dataSize);
 	initValueTable(table);
 }
 
+static inline bool keysEqual(RunCtx *runCtx, Value a, Value b, EloxError *error) {
+	if (IS_NUMBER(a) && IS_NUMBER(b))
+		return AS_NUMBER(a) == AS_NUMBER(b);
+	if (IS_OBJ(a) && IS_OBJ(b) && (AS_OBJ(a) == AS_OBJ(b)))
+		return true;
+	return valuesEquals(runCtx, a, b, error);
+}
+
+// Returns the slot holding key, or -1
 static int32_t lookup(RunCtx *runCtx, ValueTable *table, Value key, uint32_t keyHash,
 					  EloxError *error) {
-	uint32_t bucket = indexFor(keyHash, table->indexShift);
-	//uint32_t bucket = keyHash & (table->indexSize - 1);
+	uint64_t mixed = mixHash(keyHash);
+	uint8_t h2 = ctrlHash(mixed);
+	uint32_t group = firstGroup(mixed, table->groupMask);
+
+	for (uint32_t step = 1; ; step++) {
+		const uint8_t *ctrl = groupCtrl(table, group);
+		const int32_t *slots = groupSlots(table, group);
+		uint32_t match = matchByte(ctrl, h2);
+		while (match != 0) {
+			int32_t pos = ELOX_CTZ(match);
+			TableEntry *entry = &table->entries[slots[pos]];
+			if (entry->hash == keyHash) {
+				if (keysEqual(runCtx, entry->key, key, error))
+					return group * GROUP_SIZE + pos;
+				if (ELOX_UNLIKELY(error->raised))
+					return -1;
+			}
+			match &= match - 1;
+		}
+		if (matchByte(ctrl, CTRL_EMPTY) != 0)
+			return -1;
+		// triangular probing visits every group of a power of 2 table
+		group = (group + step) & table->groupMask;
+	}
+}
 
-	int32_t idx = table->chains[bucket];
-	while (idx >= 0) {
-		TableEntry *entry = &table->entries[idx];
-		if (!IS_UNDEFINED(entry->key)) {
-			if (valuesEquals(runCtx, entry->key, key, error))
-				return idx;
-			if (ELOX_UNLIKELY(error->raised))
-				return -1;
+static int32_t findInsertSlot(ValueTable *table, uint32_t keyHash) {
+	uint32_t group = firstGroup(mixHash(keyHash), table->groupMask);
+
+	for (uint32_t step = 1; ; step++) {
+		uint32_t match = matchEmptyOrDeleted(groupCtrl(table, group));
+		if (match != 0)
+			return group * GROUP_SIZE + ELOX_CTZ(match);
+		group = (group + step) & table->groupMask;
+	}
+}
+
+// Returns the slot indexing a live entry, found without comparing keys
+static int32_t findEntrySlot(ValueTable *table, int32_t entryIndex) {
+	uint64_t mixed = mixHash(table->entries[entryIndex].hash);
+	uint8_t h2 = ctrlHash(mixed);
+	uint32_t group = firstGroup(mixed, table->groupMask);
+
+	for (uint32_t step = 1; ; step++) {
+		const int32_t *slots = groupSlots(table, group);
+		uint32_t match = matchByte(groupCtrl(table, group), h2);
+		while (match != 0) {
+			int32_t pos = ELOX_CTZ(match);
+			if (slots[pos] == entryIndex)
+				return group * GROUP_SIZE + pos;
+			match &= match - 1;
 		}
-		idx = entry->next;
+		group = (group + step) & table->groupMask;
 	}
+}
 
-	return -1;
+static inline int32_t *slotEntry(ValueTable *table, int32_t slot) {
+	return &groupSlots(table, slot / GROUP_SIZE)[slot % GROUP_SIZE];
+}
+
+static inline uint8_t *slotCtrl(ValueTable *table, int32_t slot) {
+	return &groupCtrl(table, slot / GROUP_SIZE)[slot % GROUP_SIZE];
+}
+
+static inline void indexEntry(ValueTable *table, int32_t entryIndex, uint32_t keyHash) {
+	int32_t slot = findInsertSlot(table, keyHash);
+	uint8_t *ctrl = slotCtrl(table, slot);
+	if (*ctrl == CTRL_DELETED)
+		table->deletedSlots--;
+	*ctrl = ctrlHash(mixHash(keyHash));
+	*slotEntry(table, slot) = entryIndex;
 }
 
 bool valueTableGet(RunCtx *runCtx, ValueTable *table, Value key, Value *value, EloxError *error) {
@@ -55,9 +193,9 @@ bool valueTableGet(RunCtx *runCtx, ValueTable *table, Value key, Value *value, E
 	if (ELOX_UNLIKELY(error->raised))
 		return false;
 
-	int32_t idx = lookup(runCtx, table, key, keyHash, error);
-	if (idx >= 0) {
-		*value = table->entries[idx].value;
+	int32_t slot = lookup(runCtx, table, key, keyHash, error);
+	if (slot >= 0) {
+		*value = table->entries[*slotEntry(table, slot)].value;
 		return true;
 	}
 
@@ -72,8 +210,8 @@ bool valueTableContains(RunCtx *runCtx, ValueTable *table, Value key, EloxError
 	if (ELOX_UNLIKELY(error->raised))
 		return false;
 
-	int32_t idx = lookup(runCtx, table, key, keyHash, error);
-	return idx >= 0;
+	int32_t slot = lookup(runCtx, table, key, keyHash, error);
+	return slot >= 0;
 }
 
 int32_t valueTableGetNext(ValueTable *table, int32_t start, TableEntry **valueEntry) {
@@ -92,40 +230,28 @@ int32_t valueTableGetNext(ValueTable *table, int32_t start, TableEntry **valueEn
 }
 
 static void rehash(RunCtx *runCtx, ValueTable *table, int32_t newSize, EloxError *error) {
-	if (newSize == 0)
-		newSize = 8;
+	if (newSize < GROUP_SIZE)
+		newSize = GROUP_SIZE;
 
-	int32_t *newChains = NULL;
+	uint8_t *newGroups = NULL;
 	TableEntry *newEntries = NULL;
-	int32_t dataSize;
 
 	int32_t indexSize = newSize;
+	int32_t dataSize = (newSize * 3) / 4;  // fill factor: 0.75
 
 	if (newSize == table->indexSize) {
-		// rehash in place
-		for (int i = 0; i < indexSize; i++)
-			table->chains[i] = -1;
-		int j = 0;
-		for (int i = 0; i < table->dataSize; table++) {
-			TableEntry *entry = &table->entries[i];
-			uint32_t keyHash = entry->hash;
-			if (!IS_UNDEFINED(entry->key)) {
-				if (i != j) {
-					memcpy(table->entries + j, table->entries + i, sizeof(TableEntry));
-					entry = table->entries + j;
-				}
-				uint32_t bucket = indexFor(keyHash, table->indexShift);
-				//uint32_t bucket = keyHash & (indexSize - 1);
-				entry->next = table->chains[bucket];
-				table->chains[bucket] = j;
+		// compact and reindex in place
+		int32_t j = 0;
+		for (int32_t i = 0; i < table->fullCount; i++) {
+			if (!IS_UNDEFINED(table->entries[i].key)) {
+				if (i != j)
+					table->entries[j] = table->entries[i];
 				j++;
 			}
 		}
-		table->fullCount = table->liveCount;
 	} else {
-		dataSize = (newSize * 3) / 4;  // fill factor: 0.75
-		newChains = ALLOCATE(runCtx, int32_t, indexSize);
-		if (ELOX_UNLIKELY(newChains == NULL)) {
+		newGroups = ALLOCATE(runCtx, uint8_t, indexBytes(indexSize));
+		if (ELOX_UNLIKELY(newGroups == NULL)) {
 			oomError(runCtx);
 			goto cleanup;
 		}
@@ -135,49 +261,36 @@ static void rehash(RunCtx *runCtx, ValueTable *table, int32_t newSize, EloxError
 			goto cleanup;
 		}
 
-		uint32_t log2Size = ELOX_CTZ(indexSize);
-		uint32_t newShift = 8 * sizeof(uint32_t) - log2Size;
-
-		for (int i = 0; i < indexSize; i++)
-			newChains[i] = -1;
-
 		TableEntry *q = newEntries;
 		for (TableEntry *p = table->entries, *end = table->entries + table->fullCount; p != end; p++) {
-			if (!IS_UNDEFINED(p->key)) {
-				uint32_t keyHash = p->hash;
-				uint32_t bucket = indexFor(keyHash, newShift);
-				//uint32_t bucket = keyHash & (indexSize - 1);
-				q->key = p->key;
-				q->value = p->value;
-				q->next = newChains[bucket];
-				q->hash = keyHash;
-				newChains[bucket] = q - newEntries;
-				q++;
-			}
+			if (!IS_UNDEFINED(p->key))
+				*q++ = *p;
 		}
 
-		int32_t *oldChains = table->chains;
-		TableEntry *oldEntries = table->entries;
-		int32_t oldIndexSize = table->indexSize;
-		int32_t oldDataSize = table->dataSize;
+		if (table->groups != NULL)
+			GENERIC_FREE(runCtx, indexBytes(table->indexSize), table->groups);
+		FREE_ARRAY(runCtx, TableEntry, table->entries, table->dataSize);
 
-		table->chains = newChains;
+		table->groups = newGroups;
 		table->entries = newEntries;
 		table->indexSize = indexSize;
 		table->dataSize = dataSize;
-		table->indexShift = newShift;
-		table->fullCount = table->liveCount;
-
-		FREE_ARRAY(runCtx, int32_t, oldChains, oldIndexSize);
-		FREE_ARRAY(runCtx, TableEntry, oldEntries, oldDataSize);
+		table->groupMask = indexSize / GROUP_SIZE - 1;
 	}
 
+	table->fullCount = table->liveCount;
+	table->deletedSlots = 0;
+	for (uint32_t group = 0; group <= table->groupMask; group++)
+		memset(groupCtrl(table, group), CTRL_EMPTY, GROUP_SIZE);
+	for (int32_t i = 0; i < table->fullCount; i++)
+		indexEntry(table, i, table->entries[i].hash);
+
 	return;
 
 cleanup:
 	error->raised = true;
-	if (newChains != NULL)
-		FREE_ARRAY(runCtx, int32_t, newChains, indexSize);
+	if (newGroups != NULL)
+		GENERIC_FREE(runCtx, indexBytes(indexSize), newGroups);
 	if (newEntries != NULL)
 		FREE_ARRAY(runCtx, TableEntry, newEntries, dataSize);
 }
@@ -188,18 +301,21 @@ bool valueTableSet(RunCtx *runCtx, ValueTable *table, Value key, Value value, El
 		return false;
 
 	if (table->liveCount > 0) {
-		int32_t idx = lookup(runCtx, table, key, keyHash, error);
+		int32_t slot = lookup(runCtx, table, key, keyHash, error);
 		if (ELOX_UNLIKELY(error->raised))
 			return false;
-		if (idx >= 0) {
-			table->entries[idx].value = value;
+		if (slot >= 0) {
+			table->entries[*slotEntry(table, slot)].value = value;
 			return false;
 		}
 	}
 
 	table->modCount++;
 
-	if (table->fullCount == table->dataSize) {
+	// deleted index slots outlive compaction, so they count against the
+	// load factor on their own
+	if ((table->fullCount == table->dataSize) ||
+		(table->liveCount + table->deletedSlots >= table->dataSize)) {
 		rehash(runCtx, table,
 			   table->liveCount >= (table->dataSize * 3) / 4
 					? 2 * table->indexSize
@@ -210,18 +326,61 @@ bool valueTableSet(RunCtx *runCtx, ValueTable *table, Value key, Value value, El
 	}
 
 	table->liveCount++;
-	TableEntry *e = &table->entries[table->fullCount++];
+	int32_t entryIndex = table->fullCount++;
+	TableEntry *e = &table->entries[entryIndex];
 	e->key = key;
 	e->value = value;
 	e->hash = keyHash;
-	uint32_t bucket = indexFor(keyHash, table->indexShift);
-	//uint32_t bucket = keyHash & (table->indexSize - 1);
-	e->next = table->chains[bucket];
-	table->chains[bucket] = table->fullCount - 1;
+	indexEntry(table, entryIndex, keyHash);
 
 	return true;
 }
 
+// Slides the live entries over the deleted ones, keeping their order, and
+// points the index slots of the moved entries to their new positions
+static void compactEntries(ValueTable *table, int32_t *cursor) {
+	int32_t newCursor = table->liveCount;
+	int32_t j = 0;
+	for (int32_t i = 0; i < table->fullCount; i++) {
+		if ((cursor != NULL) && (i == *cursor))
+			newCursor = j;
+		TableEntry *entry = &table->entries[i];
+		if (IS_UNDEFINED(entry->key))
+			continue;
+		if (i != j) {
+			*slotEntry(table, findEntrySlot(table, i)) = j;
+			table->entries[j] = *entry;
+		}
+		j++;
+	}
+	table->fullCount = j;
+
+	if ((cursor != NULL) && (*cursor >= 0))
+		*cursor = newCursor;
+}
+
+static void removeSlot(ValueTable *table, int32_t slot, int32_t *cursor) {
+	table->modCount++;
+
+	table->entries[*slotEntry(table, slot)].key = UNDEFINED_VAL;
+	table->liveCount--;
+
+	// a group that still has an empty slot was never full, so no probe
+	// sequence continues past it and the slot can become empty again
+	bool groupHasEmpty = matchByte(groupCtrl(table, slot / GROUP_SIZE), CTRL_EMPTY) != 0;
+	if (groupHasEmpty)
+		*slotCtrl(table, slot) = CTRL_EMPTY;
+	else {
+		*slotCtrl(table, slot) = CTRL_DELETED;
+		table->deletedSlots++;
+	}
+
+	// keeping at most as many deleted entries as live ones bounds the
+	// cost of iteration by liveCount, at an amortized O(1) per delete
+	if (table->fullCount - table->liveCount > table->liveCount)
+		compactEntries(table, cursor);
+}
+
 bool valueTableDelete(RunCtx *runCtx, ValueTable *table, Value key, EloxError *error) {
 	if (table->liveCount == 0)
 		return false;
@@ -230,15 +389,20 @@ bool valueTableDelete(RunCtx *runCtx, ValueTable *table, Value key, EloxError *e
 	if (ELOX_UNLIKELY(error->raised))
 		return false; // TODO
 
-	int32_t idx = lookup(runCtx, table, key, keyHash, error);
-	if (idx < 0)
+	int32_t slot = lookup(runCtx, table, key, keyHash, error);
+	if (slot < 0)
 		return false;
 
-	table->modCount++;
+	removeSlot(table, slot, NULL);
+	return true;
+}
 
-	table->entries[idx].key = UNDEFINED_VAL;
-	table->liveCount--;
+bool valueTableRemoveEntry(ValueTable *table, int32_t entryIndex, int32_t *cursor) {
+	if ((entryIndex < 0) || (entryIndex >= table->fullCount) ||
+		IS_UNDEFINED(table->entries[entryIndex].key))
+		return false;
 
+	removeSlot(table, findEntrySlot(table, entryIndex), cursor);
 	return true;
 }
 
@@ -12,6 +12,7 @@
 #include <elox/builtins.h>
 #include <elox/builtins/string.h>
 #include <elox/builtins/array.h>
+#include <elox/builtins/number.h>
 
 static Value printNative(Args *args) {
 	RunCtx *runCtx = args->runCtx;
@@ -37,9 +38,10 @@ static Value assertNative(Args *args) {
 				Value strVal = toString(runCtx, getValueArg(args, 1), &error);
 				if (ELOX_UNLIKELY(error.raised))
 					return strVal;
-				const char *str = AS_CSTRING(strVal);
+				const String *str = &AS_STRING(strVal)->string;
 				push(fiber, strVal);
-				Value errorVal = runtimeError(runCtx, "Assertion failed: %s", str);
+				Value errorVal = runtimeError(runCtx, "Assertion failed: %.*s",
+											  str->length, (const char *)str->chars);
 				Value exception = pop(fiber);
 				pop(fiber);
 				push(fiber, exception);
@@ -59,16 +61,18 @@ static Value objectToString(Args *args) {
 	if (ELOX_UNLIKELY(!initHeapStringWithSize(runCtx, &ret, 16)))
 		return oomError(runCtx);
 	ObjInstance *inst = AS_INSTANCE(getValueArg(args, 0));
-	heapStringAddFmt(runCtx, &ret, "%s@%u", inst->clazz->name->string.chars, inst->identityHash);
-	ObjString *str = takeString(runCtx, ret.chars, ret.length, ret.capacity);
+	heapStringAddFmt(runCtx, &ret, "%s@%u", inst->clazz->name->string.chars,
+					 objIdentityHash(runCtx, (Obj *)inst));
+	ObjString *str = takeTransientString(runCtx, ret.chars, ret.length, ret.capacity);
 	if (ELOX_UNLIKELY(str == NULL))
 		return oomError(runCtx);
 	return OBJ_VAL(str);
 }
 
 static Value objectHashCode(Args *args) {
+	RunCtx *runCtx = args->runCtx;
 	ObjInstance *inst = AS_INSTANCE(getValueArg(args, 0));
-	return NUMBER_VAL(inst->identityHash);
+	return NUMBER_VAL(objIdentityHash(runCtx, (Obj *)inst));
 }
 
 //--- String --------------------
@@ -79,8 +83,9 @@ static Value stringToString(Args *args) {
 }
 
 static Value stringHashCode(Args *args) {
+	RunCtx *runCtx = args->runCtx;
 	ObjString *inst = AS_STRING(getValueArg(args, 0));
-	return NUMBER_VAL(inst->hash);
+	return NUMBER_VAL(stringHash(runCtx->vm->hashSeed, inst));
 }
 
 static Value stringLength(Args *args) {
@@ -94,14 +99,9 @@ static Value numberToString(Args *args) {
 	RunCtx *runCtx = args->runCtx;
 
 	double n = AS_NUMBER(getValueArg(args, 0));
-	HeapCString ret;
-	if (ELOX_UNLIKELY(!initHeapString(runCtx, &ret)))
-		return oomError(runCtx);
-	if (trunc(n) == n)
-		heapStringAddFmt(runCtx, &ret, "%" PRId64, (int64_t)n);
-	else
-		heapStringAddFmt(runCtx, &ret, "%g", n);
-	ObjString *str = takeString(runCtx, ret.chars, ret.length, ret.capacity);
+	char buffer[ELOX_NUMBER_BUFFER_SIZE];
+	int len = numberToChars(n, buffer);
+	ObjString *str = copyTransientString(runCtx, (const uint8_t *)buffer, len);
 	if (ELOX_UNLIKELY(str == NULL))
 		return oomError(runCtx);
 	return OBJ_VAL(str);
@@ -128,9 +128,10 @@ static Value stackTraceElementInit(Args *args) {
 	double lineNumber = AS_NUMBER(getValueArg(args, 2));
 	ObjString *functionName = AS_STRING(getValueArg(args, 3));
 
-	inst->fields.values[vm->builtins.biStackTraceElement._fileName] = OBJ_VAL(fileName);
-	inst->fields.values[vm->builtins.biStackTraceElement._lineNumber] = NUMBER_VAL(lineNumber);
-	inst->fields.values[vm->builtins.biStackTraceElement._functionName] = OBJ_VAL(functionName);
+	inst->fields[vm->builtins.biStackTraceElement._fileName] = OBJ_VAL(fileName);
+	inst->fields[vm->builtins.biStackTraceElement._lineNumber] = NUMBER_VAL(lineNumber);
+	inst->fields[vm->builtins.biStackTraceElement._functionName] = OBJ_VAL(functionName);
+	gcWriteBarrier(runCtx, (Obj *)inst);
 
 	return OBJ_VAL(inst);
 }
@@ -149,7 +150,7 @@ static Value throwableInit(Args *args) {
 		return oomError(runCtx);
 	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
 	PUSH_TEMP(temps, protectedName, OBJ_VAL(msgName));
-	setInstanceField(inst, msgName, OBJ_VAL(msg));
+	setInstanceField(runCtx, inst, msgName, OBJ_VAL(msg));
 	releaseTemps(&temps);
 	return OBJ_VAL(inst);
 }
@@ -181,7 +182,7 @@ static Value throwableToString(Args *args) {
 			}
 		}
 	}
-	ObjString *str = takeString(runCtx, ret.chars, ret.length, ret.capacity);
+	ObjString *str = takeTransientString(runCtx, ret.chars, ret.length, ret.capacity);
 	if (ELOX_UNLIKELY(str == NULL))
 		return oomError(runCtx);
 	return OBJ_VAL(str);
@@ -201,7 +202,7 @@ static Value exceptionInit(Args *args) {
 		return oomError(runCtx);
 	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
 	PUSH_TEMP(temps, protectedName, OBJ_VAL(msgName));
-	setInstanceField(inst, msgName, OBJ_VAL(msg));
+	setInstanceField(runCtx, inst, msgName, OBJ_VAL(msg));
 	releaseTemps(&temps);
 	return OBJ_VAL(inst);
 }
@@ -226,10 +227,10 @@ static Value exceptionPrintStackTrace(Args *args) {
 			for (int32_t i = 0; i < st->size; i++) {
 				ObjInstance *elem = AS_INSTANCE(st->items[i]);
 				eloxPrintf(runCtx, ELOX_IO_ERR, "\tat ");
-				ObjString *functionName = AS_STRING(elem->fields.values[vm->builtins.biStackTraceElement._functionName]);
+				ObjString *functionName = AS_STRING(elem->fields[vm->builtins.biStackTraceElement._functionName]);
 				eloxPrintf(runCtx, ELOX_IO_ERR, "%.*s", functionName->string.length, functionName->string.chars);
-				ObjString *fileName = AS_STRING(elem->fields.values[vm->builtins.biStackTraceElement._fileName]);
-				int lineNumber = (int)AS_NUMBER(elem->fields.values[vm->builtins.biStackTraceElement._lineNumber]);
+				ObjString *fileName = AS_STRING(elem->fields[vm->builtins.biStackTraceElement._fileName]);
+				int lineNumber = (int)AS_NUMBER(elem->fields[vm->builtins.biStackTraceElement._lineNumber]);
 				eloxPrintf(runCtx, ELOX_IO_ERR, " (%.*s:%d)\n",
 						   fileName->string.length, fileName->string.chars, lineNumber);
 			}
@@ -269,8 +270,8 @@ static Value hashMapIteratorHasNext(Args *args) {
 	struct BIHashMapIterator *mi = &vm->builtins.biHashMapIterator;
 
 	ObjInstance *inst = AS_INSTANCE(getValueArg(args, 0));
-	ObjHashMap *map = AS_HASHMAP(inst->fields.values[mi->_map]);
-	int current = AS_NUMBER(inst->fields.values[mi->_current]);
+	ObjHashMap *map = AS_HASHMAP(inst->fields[mi->_map]);
+	int current = AS_NUMBER(inst->fields[mi->_current]);
 
 	TableEntry *entry;
 	int32_t nextIndex = valueTableGetNext(&map->items, current, &entry);
@@ -286,17 +287,20 @@ static Value hashMapIteratorNext(Args *args) {
 	struct BIHashMapIterator *mi = &vm->builtins.biHashMapIterator;
 
 	ObjInstance *inst = AS_INSTANCE(getValueArg(args, 0));
-	ObjHashMap *map = AS_HASHMAP(inst->fields.values[mi->_map]);
-	int current = AS_NUMBER(inst->fields.values[mi->_current]);
-	uint32_t modCount = AS_NUMBER(inst->fields.values[mi->_modCount]);
+	ObjHashMap *map = AS_HASHMAP(inst->fields[mi->_map]);
+	int current = AS_NUMBER(inst->fields[mi->_current]);
+	uint32_t modCount = AS_NUMBER(inst->fields[mi->_modCount]);
 
 	if (ELOX_UNLIKELY(modCount != map->items.modCount))
 		return runtimeError(runCtx, "HashMap modified during iteration");
 
 	TableEntry *entry;
 	int nextIndex = valueTableGetNext(&map->items, current, &entry);
+	if (ELOX_UNLIKELY(nextIndex < 0))
+		return runtimeError(runCtx, "No more HashMap entries");
 
-	inst->fields.values[mi->_current] = NUMBER_VAL(nextIndex);
+	inst->fields[mi->_current] = NUMBER_VAL(nextIndex);
+	inst->fields[mi->_lastRet] = NUMBER_VAL(nextIndex - 1);
 
 	ObjArray *ret = newArray(runCtx, 2, OBJ_TUPLE);
 	if (ELOX_UNLIKELY(ret == NULL))
@@ -310,6 +314,33 @@ static Value hashMapIteratorNext(Args *args) {
 	return OBJ_VAL(ret);
 }
 
+static Value hashMapIteratorRemove(Args *args) {
+	RunCtx *runCtx = args->runCtx;
+	VM *vm = runCtx->vm;
+
+	struct BIHashMapIterator *mi = &vm->builtins.biHashMapIterator;
+
+	ObjInstance *inst = AS_INSTANCE(getValueArg(args, 0));
+	ObjHashMap *map = AS_HASHMAP(inst->fields[mi->_map]);
+	int32_t lastRet = AS_NUMBER(inst->fields[mi->_lastRet]);
+
+	if (ELOX_UNLIKELY(lastRet < 0))
+		return runtimeError(runCtx, "Illegal iterator state");
+
+	uint32_t modCount = AS_NUMBER(inst->fields[mi->_modCount]);
+	if (ELOX_UNLIKELY(modCount != map->items.modCount))
+		return runtimeError(runCtx, "HashMap modified during iteration");
+
+	// the removal may compact the map, which moves the iterator position
+	int32_t current = AS_NUMBER(inst->fields[mi->_current]);
+	valueTableRemoveEntry(&map->items, lastRet, &current);
+	inst->fields[mi->_current] = NUMBER_VAL(current);
+	inst->fields[mi->_lastRet] = NUMBER_VAL(-1);
+	inst->fields[mi->_modCount] = NUMBER_VAL(map->items.modCount);
+
+	return NIL_VAL;
+}
+
 static Value hashMapSize(Args *args) {
 	ObjHashMap *inst = AS_HASHMAP(getValueArg(args, 0));
 	return NUMBER_VAL(inst->items.liveCount);
@@ -326,6 +357,7 @@ static Value hashMapPut(Args *args) {
 	valueTableSet(runCtx, &inst->items, key, val, &error);
 	if (ELOX_UNLIKELY(error.raised))
 		return EXCEPTION_VAL;
+	gcWriteBarrier(runCtx, (Obj *)inst);
 
 	return NIL_VAL;
 }
@@ -354,9 +386,10 @@ static Value hashMapIterator(Args *args) {
 	ObjInstance *iter = newInstance(runCtx, mi->_class);
 	if (ELOX_UNLIKELY(iter == NULL))
 		return oomError(runCtx);
-	iter->fields.values[mi->_map] = OBJ_VAL(inst);
-	iter->fields.values[mi->_current] = NUMBER_VAL(0);
-	iter->fields.values[mi->_modCount] = NUMBER_VAL(inst->items.modCount);
+	iter->fields[mi->_map] = OBJ_VAL(inst);
+	iter->fields[mi->_current] = NUMBER_VAL(0);
+	iter->fields[mi->_lastRet] = NUMBER_VAL(-1);
+	iter->fields[mi->_modCount] = NUMBER_VAL(inst->items.modCount);
 	return OBJ_VAL(iter);
 }
 
@@ -548,17 +581,8 @@ static ObjClass *registerStaticClass(RunCtx *runCtx, bool abstract,
 			clazz->typeInfo.numRss = numSupertypes;
 			memcpy(clazz->typeInfo.rssList, supertypes, numSupertypes * sizeof(Obj *));
 		}
-		for (int i = 0; i < super->fields.capacity; i++) {
-			Entry *entry = &super->fields.entries[i];
-			if (entry->key != NULL) {
-				tableSet(runCtx, &clazz->fields, entry->key, entry->value, &localError);
-				if (ELOX_UNLIKELY(localError.raised)) {
-					pop(fiber); // discard error
-					rscErr = rscErrOOM;
-					goto cleanup;
-				}
-			}
-		}
+		releaseShape(runCtx, clazz->shape);
+		clazz->shape = retainShape(super->shape);
 		tableAddAll(runCtx, &super->methods, &clazz->methods, &localError);
 		if (ELOX_UNLIKELY(localError.raised)) {
 			pop(fiber); // discard error
@@ -830,16 +854,20 @@ bool registerBuiltins(RunCtx *runCtx) {
 							  objectClass, iteratorIntf);
 	bi->biHashMapIterator.mapStr = internString(runCtx, ELOX_USTR_AND_LEN("map"), &error);
 	bi->biHashMapIterator.currentStr = internString(runCtx, ELOX_USTR_AND_LEN("current"), &error);
+	bi->biHashMapIterator.lastRetStr = internString(runCtx, ELOX_USTR_AND_LEN("lastRet"), &error);
 	bi->biHashMapIterator.modCountStr = internString(runCtx, ELOX_USTR_AND_LEN("modCount"), &error);
 	bi->biHashMapIterator._map = addClassField(runCtx, hashMapIteratorClass,
 											   bi->biHashMapIterator.mapStr, &error);
 	bi->biHashMapIterator._current = addClassField(runCtx, hashMapIteratorClass,
 												   bi->biHashMapIterator.currentStr, &error);
+	bi->biHashMapIterator._lastRet = addClassField(runCtx, hashMapIteratorClass,
+												   bi->biHashMapIterator.lastRetStr, &error);
 	bi->biHashMapIterator._modCount = addClassField(runCtx, hashMapIteratorClass,
 													bi->biHashMapIterator.modCountStr, &error);
 	bi->biHashMapIterator._class = hashMapIteratorClass;
 	addNativeMethod(runCtx, hashMapIteratorClass, bi->biIterator.hasNextStr, hashMapIteratorHasNext, 0, false, &error);
 	addNativeMethod(runCtx, hashMapIteratorClass, bi->biIterator.nextStr, hashMapIteratorNext, 0, false, &error);
+	addNativeMethod(runCtx, hashMapIteratorClass, bi->biIterator.removeStr, hashMapIteratorRemove, 0, false, &error);
 
 	ObjInterface *mapIntf;
 	bi->biMap._nameStr = internString(runCtx, ELOX_USTR_AND_LEN("Map"), &error);
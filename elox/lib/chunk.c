@@ -12,6 +12,9 @@ void initChunk(Chunk *chunk, ObjString *fileName) {
 	chunk->count = 0;
 	chunk->capacity = 0;
 	chunk->code = NULL;
+	chunk->icCount = 0;
+	chunk->icCapacity = 0;
+	chunk->inlineCaches = NULL;
 	chunk->lineCount = 0;
 	chunk->lineCapacity = 0;
 	chunk->lines = NULL;
@@ -21,7 +24,8 @@ void initChunk(Chunk *chunk, ObjString *fileName) {
 
 void freeChunk(RunCtx *runCtx, Chunk *chunk) {
 	FREE_ARRAY(runCtx, uint8_t, chunk->code, chunk->capacity);
-	FREE_ARRAY(runCtx, LineStart, chunk->lines, chunk->capacity);
+	FREE_ARRAY(runCtx, LineStart, chunk->lines, chunk->lineCapacity);
+	FREE_ARRAY(runCtx, InlineCache, chunk->inlineCaches, chunk->icCapacity);
 	freeValueArray(runCtx, &chunk->constants);
 	initChunk(chunk, NULL);
 }
@@ -67,6 +71,12 @@ void writeChunk(CCtx *cCtx, Chunk *chunk, uint8_t *data, uint8_t len, int line)
 	lineStart->line = line;
 }
 
+void truncateChunk(Chunk *chunk, int count) {
+	chunk->count = count;
+	while ((chunk->lineCount > 0) && (chunk->lines[chunk->lineCount - 1].offset >= count))
+		chunk->lineCount--;
+}
+
 int addConstant(RunCtx *runCtx, Chunk *chunk, Value value) {
 	FiberCtx *fiber = runCtx->activeFiber;
 
@@ -84,6 +94,23 @@ cleanup:
 	return ret;
 }
 
+int addInlineCache(RunCtx *runCtx, Chunk *chunk) {
+	if (chunk->icCapacity < chunk->icCount + 1) {
+		int oldCapacity = chunk->icCapacity;
+		int newCapacity = GROW_CAPACITY(oldCapacity);
+		InlineCache *newCaches = GROW_ARRAY(runCtx, InlineCache, chunk->inlineCaches,
+											oldCapacity, newCapacity);
+		if (ELOX_UNLIKELY(newCaches == NULL))
+			return -1;
+		chunk->inlineCaches = newCaches;
+		chunk->icCapacity = newCapacity;
+	}
+
+	InlineCache *cache = &chunk->inlineCaches[chunk->icCount];
+	memset(cache, 0, sizeof(InlineCache));
+	return chunk->icCount++;
+}
+
 int getLine(Chunk *chunk, int instruction) {
 	int start = 0;
 	int end = chunk->lineCount - 1;
@@ -101,3 +128,135 @@ int getLine(Chunk *chunk, int instruction) {
 		}
 	}
 }
+
+uint8_t genericOpcode(uint8_t op) {
+	switch (op) {
+		case OP_ADD_NUM_NUM:
+			return OP_ADD;
+		case OP_ADD_LOCAL_LOCAL:
+		case OP_LESS_LOCAL_CONST:
+		case OP_LESS_LOCAL_IMMI:
+			return OP_GET_LOCAL;
+		case OP_GET_MEMBER_PROP_RETURN:
+			return OP_GET_MEMBER_PROP;
+		default:
+			return op;
+	}
+}
+
+int instructionLength(Chunk *chunk, int offset) {
+	switch (genericOpcode(chunk->code[offset])) {
+		case OP_NIL:
+		case OP_TRUE:
+		case OP_FALSE:
+		case OP_POP:
+		case OP_SWAP:
+		case OP_NUM_VARARGS:
+		case OP_GET_VARARG:
+		case OP_SET_VARARG:
+		case OP_EQUAL:
+		case OP_GREATER:
+		case OP_LESS:
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+		case OP_MODULO:
+		case OP_INSTANCEOF:
+		case OP_IN:
+		case OP_NOT:
+		case OP_NEGATE:
+		case OP_CLOSE_UPVALUE:
+		case OP_RETURN:
+		case OP_INDEX:
+		case OP_INDEX_STORE:
+		case OP_SLICE:
+		case OP_THROW:
+		case OP_END:
+			return 1;
+		case OP_CONST8:
+		case OP_POPN:
+		case OP_EXPAND_VARARGS:
+		case OP_EXPAND:
+		case OP_PEEK:
+		case OP_GET_UPVALUE:
+		case OP_SET_UPVALUE:
+		case OP_UNROLL_EXH:
+		case OP_UNROLL_EXH_R:
+		case OP_UNROLL_EXH_F:
+			return 2;
+		case OP_CONST16:
+		case OP_GET_LOCAL:
+		case OP_SET_LOCAL:
+		case OP_GET_GLOBAL:
+		case OP_GET_BUILTIN:
+		case OP_DEFINE_GLOBAL:
+		case OP_SET_GLOBAL:
+		case OP_GET_MEMBER_PROP:
+		case OP_MAP_GET:
+		case OP_SET_PROP:
+		case OP_SET_MEMBER_PROP:
+		case OP_MAP_SET:
+		case OP_GET_SUPER:
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_LOOP:
+		case OP_CALL:
+		case OP_SUPER_INIT:
+		case OP_MAP_BUILD:
+		case OP_INTF:
+		case OP_METHOD:
+		case OP_FIELD:
+		case OP_STATIC:
+			return 3;
+		case OP_ARRAY_BUILD:
+		case OP_PUSH_EXH:
+		case OP_CLASS:
+		case OP_INHERIT:
+			return 4;
+		case OP_IMMI:
+		case OP_GET_PROP:
+		case OP_MEMBER_INVOKE:
+		case OP_SUPER_INVOKE:
+		case OP_FOREACH_INIT:
+			return 5;
+		case OP_ABS_METHOD:
+			return 6;
+		case OP_INVOKE:
+		case OP_REG_ADD:
+		case OP_REG_SUB:
+		case OP_REG_MUL:
+			return 7;
+		case OP_REG_ADDI:
+		case OP_REG_SUBI:
+		case OP_REG_MULI:
+			return 9;
+		case OP_CLOSURE: {
+			uint16_t constant;
+			memcpy(&constant, chunk->code + offset + 1, sizeof(uint16_t));
+			ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
+			return 3 + 2 * function->upvalueCount;
+		}
+		case OP_CLOSE_CLASS: {
+			uint16_t numMembers;
+			memcpy(&numMembers, chunk->code + offset + 1, sizeof(uint16_t));
+			return 3 + 5 * numMembers;
+		}
+		case OP_IMPORT: {
+			uint16_t numArgs;
+			memcpy(&numArgs, chunk->code + offset + 3, sizeof(uint16_t));
+			return 5 + 2 * numArgs;
+		}
+		case OP_UNPACK: {
+			uint8_t numVal = chunk->code[offset + 1];
+			int length = 2;
+			for (int i = 0; i < numVal; i++)
+				length += (chunk->code[offset + length] == VAR_UPVALUE) ? 2 : 3;
+			return length;
+		}
+		case OP_DATA:
+			return 2 + chunk->code[offset + 1];
+		default:
+			return -1;
+	}
+}
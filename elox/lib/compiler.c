@@ -211,6 +211,16 @@ static void emitBytes(CCtx *cCtx, uint8_t byte1, uint8_t byte2) {
 	emitByte(cCtx, byte2);
 }
 
+static int emitInstruction(CCtx *cCtx, uint8_t *data, uint8_t len) {
+	Compiler *current = cCtx->compilerState.current;
+	Parser *parser = &cCtx->compilerState.parser;
+
+	// opcode first, so a new line starts at the instruction
+	int offset = emitByte(cCtx, data[0]);
+	writeChunk(cCtx, currentChunk(current), data + 1, len - 1, parser->previous.line);
+	return offset;
+}
+
 static void emitPop(CCtx *cCtx, uint8_t n) {
 	if (n == 0)
 		return;
@@ -272,6 +282,7 @@ static int emitAddress(CCtx *cCtx) {
 
 static void patchAddress(Compiler *current, uint16_t offset) {
 	uint16_t address = currentChunk(current)->count;
+	current->lastJumpTarget = address;
 	memcpy(currentChunk(current)->code + offset, &address, sizeof(uint16_t));
 }
 
@@ -302,6 +313,22 @@ static uint16_t makeConstant(CCtx *cCtx, Value value) {
 	return (uint16_t)constant;
 }
 
+static void emitInlineCache(CCtx *cCtx) {
+	Compiler *current = cCtx->compilerState.current;
+
+	int cacheIndex = addInlineCache(cCtx->runCtx, currentChunk(current));
+	if (ELOX_UNLIKELY(cacheIndex < 0)) {
+		compileError(cCtx, "Out of memory");
+		return;
+	}
+	if (cacheIndex > UINT16_MAX) {
+		compileError(cCtx, "Too many property accesses in one chunk");
+		return;
+	}
+
+	emitUShort(cCtx, (uint16_t)cacheIndex);
+}
+
 static void emitConstantOp(CCtx *cCtx, uint16_t constantIndex) {
 	if (constantIndex < 256) {
 		emitByte(cCtx, OP_CONST8);
@@ -317,7 +344,7 @@ static void emitConstant(CCtx *cCtx, Value value) {
 		double val = AS_NUMBER(value);
 		if (trunc(val) == val) {
 			if ((val >= INT32_MIN) && (val <= INT32_MAX)) {
-				emitByte(cCtx, OP_IMMI);
+				cCtx->compilerState.current->lastImmLoad = emitByte(cCtx, OP_IMMI);
 				emitInt(cCtx, val);
 				return;
 			}
@@ -332,6 +359,7 @@ static void patchJump(CCtx *cCtx, int offset) {
 
 	// -2 to adjust for the bytecode for the jump offset itself
 	int jump = currentChunk(current)->count - offset - 2;
+	current->lastJumpTarget = currentChunk(current)->count;
 
 	if (jump > UINT16_MAX)
 		compileError(cCtx, "Too much code to jump over");
@@ -428,6 +456,11 @@ static Compiler *initCompiler(CCtx *cCtx, Compiler *compiler, FunctionType type,
 	compiler->catchStackDepth = 0;
 	compiler->catchDepth = 0;
 	compiler->finallyDepth = 0;
+	compiler->lastLocalLoad = -1;
+	compiler->lastImmLoad = -1;
+	compiler->lastRegOp = -1;
+	compiler->regAssignEnd = -1;
+	compiler->lastJumpTarget = -1;
 	compiler->numArgs = 0;
 	compiler->function = function;
 	initTable(&compiler->stringConstants);
@@ -462,6 +495,7 @@ static Compiler *initCompiler(CCtx *cCtx, Compiler *compiler, FunctionType type,
 	}
 
 	Local *local = &current->locals[current->localCount++];
+	current->function->slotCount = current->localCount;
 	local->depth = 0;
 	local->isCaptured = false;
 	local->postArgs = false;
@@ -566,10 +600,72 @@ static ExpressionType expression(CCtx *cCtx, Precedence precedence,
 	return type;
 }
 
+// Replace a 'local op local' or 'local op immediate' sequence ending at the
+// current offset with a single register instruction that pushes the result.
+// leftStart is where the left operand started, before the right one was compiled
+static bool foldRegisterOp(CCtx *cCtx, int leftStart, uint8_t op) {
+	Compiler *current = cCtx->compilerState.current;
+	Chunk *chunk = currentChunk(current);
+
+	uint8_t regOp, immOp;
+	switch (op) {
+		case OP_ADD:
+			regOp = OP_REG_ADD;
+			immOp = OP_REG_ADDI;
+			break;
+		case OP_SUBTRACT:
+			regOp = OP_REG_SUB;
+			immOp = OP_REG_SUBI;
+			break;
+		case OP_MULTIPLY:
+			regOp = OP_REG_MUL;
+			immOp = OP_REG_MULI;
+			break;
+		default:
+			return false;
+	}
+
+	// a jump landing inside the sequence would end up mid-instruction
+	if ((leftStart < 0) || (current->lastJumpTarget > leftStart))
+		return false;
+	uint8_t *code = chunk->code + leftStart;
+	if (code[0] != OP_GET_LOCAL)
+		return false;
+	// register operands keep the slot, postArgs layout of GET_LOCAL
+	uint8_t a = code[1];
+	uint8_t aPost = code[2];
+
+	int rightStart = leftStart + 3;
+	if ((chunk->count == rightStart + 3) && (current->lastLocalLoad == rightStart)) {
+		uint8_t b = code[4];
+		uint8_t bPost = code[5];
+		truncateChunk(chunk, leftStart);
+		uint8_t instr[] = { regOp, REG_STACK, 0, a, aPost, b, bPost };
+		current->lastRegOp = emitInstruction(cCtx, instr, sizeof(instr));
+	} else if ((chunk->count == rightStart + 5) && (current->lastImmLoad == rightStart)) {
+		int32_t imm;
+		memcpy(&imm, code + 4, sizeof(int32_t));
+		truncateChunk(chunk, leftStart);
+		uint8_t instr[] = { immOp, REG_STACK, 0, a, aPost };
+		current->lastRegOp = emitInstruction(cCtx, instr, sizeof(instr));
+		emitInt(cCtx, imm);
+	} else
+		return false;
+
+	current->lastLocalLoad = -1;
+	current->lastImmLoad = -1;
+	return true;
+}
+
 static ExpressionType binary(CCtx *cCtx, bool canAssign ELOX_UNUSED,
 							 bool canExpand ELOX_UNUSED, bool firstExpansion ELOX_UNUSED) {
+	Compiler *current = cCtx->compilerState.current;
 	Parser *parser = &cCtx->compilerState.parser;
 
+	int leftStart = currentChunk(current)->count - 3;
+	if (current->lastLocalLoad != leftStart)
+		leftStart = -1;
+
 	EloxTokenType operatorType = parser->previous.type;
 	ParseRule *rule = getRule(operatorType);
 	expression(cCtx, (Precedence)(rule->precedence + 1), false, false);
@@ -594,13 +690,16 @@ static ExpressionType binary(CCtx *cCtx, bool canAssign ELOX_UNUSED,
 			emitBytes(cCtx, OP_GREATER, OP_NOT);
 			break;
 		case TOKEN_PLUS:
-			emitByte(cCtx, OP_ADD);
+			if (!foldRegisterOp(cCtx, leftStart, OP_ADD))
+				emitByte(cCtx, OP_ADD);
 			break;
 		case TOKEN_MINUS:
-			emitByte(cCtx, OP_SUBTRACT);
+			if (!foldRegisterOp(cCtx, leftStart, OP_SUBTRACT))
+				emitByte(cCtx, OP_SUBTRACT);
 			break;
 		case TOKEN_STAR:
-			emitByte(cCtx, OP_MULTIPLY);
+			if (!foldRegisterOp(cCtx, leftStart, OP_MULTIPLY))
+				emitByte(cCtx, OP_MULTIPLY);
 			break;
 		case TOKEN_SLASH:
 			emitByte(cCtx, OP_DIVIDE);
@@ -808,6 +907,7 @@ static ExpressionType colon(CCtx *cCtx, bool canAssign,
 			emitByte(cCtx, OP_INVOKE);
 			emitUShort(cCtx, name);
 			emitBytes(cCtx, argCount, hasExpansions);
+			emitInlineCache(cCtx);
 		}
 	} else {
 		if (isThisRef) {
@@ -818,6 +918,7 @@ static ExpressionType colon(CCtx *cCtx, bool canAssign,
 		} else {
 			emitByte(cCtx, OP_GET_PROP);
 			emitUShort(cCtx, name);
+			emitInlineCache(cCtx);
 		}
 	}
 
@@ -997,6 +1098,8 @@ static Local *addLocal(CCtx *cCtx, Token name, uint8_t *handle) {
 	}
 
 	Local *local = &current->locals[current->localCount++];
+	if (current->localCount > current->function->slotCount)
+		current->function->slotCount = current->localCount;
 	local->name = name;
 	local->depth = -1;
 	local->postArgs = current->postArgs;
@@ -1174,12 +1277,55 @@ static void emitStore(CCtx *cCtx, ArgDesc *arg, uint8_t setOp) {
 	}
 }
 
+// Turn a register instruction that is the whole right-hand side of an
+// assignment to a local into one that stores directly into the local
+static bool foldRegisterStore(CCtx *cCtx, int exprStart, ArgDesc *arg) {
+	Compiler *current = cCtx->compilerState.current;
+	Chunk *chunk = currentChunk(current);
+
+	if (!arg->isLocal || (arg->handle == REG_STACK))
+		return false;
+	if (current->lastRegOp != exprStart)
+		return false;
+	uint8_t op = chunk->code[exprStart];
+	int length = ((op == OP_REG_ADD) || (op == OP_REG_SUB) || (op == OP_REG_MUL)) ? 7 : 9;
+	if (chunk->count != exprStart + length)
+		return false;
+
+	chunk->code[exprStart + 1] = (uint8_t)arg->handle;
+	chunk->code[exprStart + 2] = (uint8_t)arg->postArgs;
+	current->lastRegOp = -1;
+	// the assignment value, dropped again if used as a statement
+	emitLoad(cCtx, arg, OP_GET_LOCAL);
+	current->regAssignEnd = chunk->count;
+	return true;
+}
+
+static void emitExpressionPop(CCtx *cCtx) {
+	Compiler *current = cCtx->compilerState.current;
+	Chunk *chunk = currentChunk(current);
+
+	if ((current->regAssignEnd == chunk->count) && (current->lastJumpTarget < chunk->count)) {
+		truncateChunk(chunk, chunk->count - 3);
+		current->regAssignEnd = -1;
+	} else
+		emitByte(cCtx, OP_POP);
+}
+
 static void emitShorthandAssign(CCtx *cCtx, ArgDesc *arg,
 								uint8_t getOp, uint8_t setOp, uint8_t op) {
+	Compiler *current = cCtx->compilerState.current;
+
+	int leftStart = currentChunk(current)->count;
+	if (arg->isLocal)
+		current->lastLocalLoad = leftStart;
 	emitLoad(cCtx, arg, getOp);
 	expression(cCtx, PREC_ASSIGNMENT, false, false);
-	emitByte(cCtx, op);
-	emitStore(cCtx, arg, setOp);
+	bool folded = foldRegisterOp(cCtx, leftStart, op);
+	if (!folded)
+		emitByte(cCtx, op);
+	if (!folded || !foldRegisterStore(cCtx, leftStart, arg))
+		emitStore(cCtx, arg, setOp);
 }
 
 static void emitLoadOrAssignVariable(CCtx *cCtx, Token name, bool canAssign) {
@@ -1209,7 +1355,7 @@ static void emitLoadOrAssignVariable(CCtx *cCtx, Token name, bool canAssign) {
 		bool isBuiltin = false;
 		uint16_t builtinIndex;
 		if (moduleName == NULL) {
-			uint32_t nameHash = hashString(name.string.chars, name.string.length);
+			uint32_t nameHash = hashString(vm->hashSeed, name.string.chars, name.string.length);
 			Value indexVal;
 			isBuiltin = tableGetString(&vm->builtinSymbols,
 									   name.string.chars, name.string.length, nameHash, &indexVal);
@@ -1232,8 +1378,10 @@ static void emitLoadOrAssignVariable(CCtx *cCtx, Token name, bool canAssign) {
 	}
 
 	if (canAssign && consumeIfMatch(cCtx, TOKEN_EQUAL)) {
+		int exprStart = currentChunk(current)->count;
 		expression(cCtx, PREC_ASSIGNMENT, false, false);
-		emitStore(cCtx, &arg, setOp);
+		if (!foldRegisterStore(cCtx, exprStart, &arg))
+			emitStore(cCtx, &arg, setOp);
 	} else if (canAssign && consumeIfMatch(cCtx, TOKEN_PLUS_EQUAL))
 		emitShorthandAssign(cCtx, &arg, getOp, setOp, OP_ADD);
 	else if (canAssign && consumeIfMatch(cCtx, TOKEN_MINUS_EQUAL))
@@ -1244,8 +1392,11 @@ static void emitLoadOrAssignVariable(CCtx *cCtx, Token name, bool canAssign) {
 		emitShorthandAssign(cCtx, &arg, getOp, setOp, OP_DIVIDE);
 	else if (canAssign && consumeIfMatch(cCtx, TOKEN_PERCENT_EQUAL))
 		emitShorthandAssign(cCtx, &arg, getOp, setOp, OP_MODULO);
-	else
+	else {
+		if (arg.isLocal)
+			current->lastLocalLoad = currentChunk(current)->count;
 		emitLoad(cCtx, &arg, getOp);
+	}
 }
 
 Token syntheticToken(const uint8_t *text) {
@@ -1505,6 +1656,7 @@ static ExpressionType fString(CCtx *cCtx, bool canAssign ELOX_UNUSED,
 			emitByte(cCtx, OP_INVOKE);
 			emitUShort(cCtx, toStringConst);
 			emitBytes(cCtx, 0, 0);
+			emitInlineCache(cCtx);
 			emitted = true;
 		}
 
@@ -1593,7 +1745,7 @@ static VarRef resolveVar(CCtx *cCtx, Token name) {
 	}
 	bool isBuiltin = false;
 	if (moduleName == NULL) {
-		uint32_t nameHash = hashString(name.string.chars, name.string.length);
+		uint32_t nameHash = hashString(vm->hashSeed, name.string.chars, name.string.length);
 		isBuiltin = tableFindString(&vm->builtinSymbols,
 										 name.string.chars, name.string.length, nameHash);
 		if (!isBuiltin)
@@ -2178,7 +2330,7 @@ static void varDeclaration(CCtx *cCtx, VarScope varType) {
 static void expressionStatement(CCtx *cCtx) {
 	expression(cCtx, PREC_ASSIGNMENT, false, false);
 	consume(cCtx, TOKEN_SEMICOLON, "Expect ';' after expression");
-	emitByte(cCtx, OP_POP);
+	emitExpressionPop(cCtx);
 }
 
 static void unpackStatement(CCtx *cCtx) {
@@ -2299,7 +2451,7 @@ static void forStatement(CCtx *cCtx) {
 		int bodyJump = emitJump(cCtx, OP_JUMP);
 		int incrementStart = currentChunk(current)->count;
 		expression(cCtx, PREC_ASSIGNMENT, false, false);
-		emitByte(cCtx, OP_POP);
+		emitExpressionPop(cCtx);
 		consume(cCtx, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
 
 		emitLoop(cCtx, compilerState->innermostLoop.start);
@@ -62,10 +62,12 @@ static int classInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int
 static int getPropertyInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int offset) {
 	uint16_t constant;
 	memcpy(&constant, &chunk->code[offset + 1], sizeof(uint16_t));
+	uint16_t cacheIndex;
+	memcpy(&cacheIndex, &chunk->code[offset + 3], sizeof(uint16_t));
 	eloxPrintf(runCtx, ELOX_IO_DEBUG, "%-22s %5d (", name, constant);
 	printValue(runCtx, ELOX_IO_DEBUG, chunk->constants.values[constant]);
-	ELOX_WRITE(runCtx, ELOX_IO_DEBUG, ")\n");
-	return offset + 3;
+	eloxPrintf(runCtx, ELOX_IO_DEBUG, ") ic %u\n", cacheIndex);
+	return offset + 5;
 }
 
 static int invokeInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int offset) {
@@ -79,6 +81,19 @@ static int invokeInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int
 	return offset + 5;
 }
 
+static int cachedInvokeInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int offset) {
+	uint16_t constant;
+	memcpy(&constant, &chunk->code[offset + 1], sizeof(uint16_t));
+	uint8_t argCount = chunk->code[offset + 3];
+	uint8_t hasExpansions = chunk->code[offset + 4];
+	uint16_t cacheIndex;
+	memcpy(&cacheIndex, &chunk->code[offset + 5], sizeof(uint16_t));
+	eloxPrintf(runCtx, ELOX_IO_DEBUG, "%-22s (%d args %d) %4d (", name, argCount, hasExpansions, constant);
+	printValue(runCtx, ELOX_IO_DEBUG, chunk->constants.values[constant]);
+	eloxPrintf(runCtx, ELOX_IO_DEBUG, ") ic %u\n", cacheIndex);
+	return offset + 7;
+}
+
 static int memberInvokeInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int offset) {
 	uint16_t slot;
 	memcpy(&slot, &chunk->code[offset + 1], sizeof(uint16_t));
@@ -265,6 +280,39 @@ static int localInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int
 	return offset + 3;
 }
 
+static void printRegister(RunCtx *runCtx, const uint8_t *reg) {
+	if (reg[0] == REG_STACK)
+		ELOX_WRITE(runCtx, ELOX_IO_DEBUG, " stack");
+	else
+		eloxPrintf(runCtx, ELOX_IO_DEBUG, " r%u %s", reg[0], reg[1] ? "POST" : "PRE");
+}
+
+static int registerInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int offset) {
+	eloxPrintf(runCtx, ELOX_IO_DEBUG, "%-22s", name);
+	for (int i = 0; i < 3; i++)
+		printRegister(runCtx, &chunk->code[offset + 1 + 2 * i]);
+	ELOX_WRITE(runCtx, ELOX_IO_DEBUG, "\n");
+	return offset + 7;
+}
+
+static int registerImmInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int offset) {
+	int32_t imm;
+	memcpy(&imm, &chunk->code[offset + 5], sizeof(int32_t));
+	eloxPrintf(runCtx, ELOX_IO_DEBUG, "%-22s", name);
+	printRegister(runCtx, &chunk->code[offset + 1]);
+	printRegister(runCtx, &chunk->code[offset + 3]);
+	eloxPrintf(runCtx, ELOX_IO_DEBUG, " %d\n", imm);
+	return offset + 9;
+}
+
+static int fusedLocalInstruction(RunCtx *runCtx, const char *name, Chunk *chunk,
+								 int offset, int length) {
+	uint8_t slot = chunk->code[offset + 1];
+	uint8_t postArgs = chunk->code[offset + 2];
+	eloxPrintf(runCtx, ELOX_IO_DEBUG, "%-22s %4d %d (fused)\n", name, slot, postArgs);
+	return offset + length;
+}
+
 static int importInstruction(RunCtx *runCtx, const char *name, Chunk *chunk, int offset) {
 	uint16_t module;
 	memcpy(&module, &chunk->code[offset + 1], sizeof(uint16_t));
@@ -388,7 +436,7 @@ int disassembleInstruction(RunCtx *runCtx, Chunk *chunk, int offset) {
 		case OP_CALL:
 			return callInstruction(runCtx, "CALL", chunk, offset);
 		case OP_INVOKE:
-			return invokeInstruction(runCtx, "INVOKE", chunk, offset);
+			return cachedInvokeInstruction(runCtx, "INVOKE", chunk, offset);
 		case OP_MEMBER_INVOKE:
 			return memberInvokeInstruction(runCtx, "MEMBER_INVOKE", chunk, offset);
 		case OP_SUPER_INVOKE:
@@ -464,6 +512,28 @@ int disassembleInstruction(RunCtx *runCtx, Chunk *chunk, int offset) {
 			return importInstruction(runCtx, "IMPORT", chunk, offset);
 		case OP_DATA:
 			return dataInstruction(runCtx, "DATA", chunk, offset);
+		case OP_REG_ADD:
+			return registerInstruction(runCtx, "REG_ADD", chunk, offset);
+		case OP_REG_ADDI:
+			return registerImmInstruction(runCtx, "REG_ADDI", chunk, offset);
+		case OP_REG_SUB:
+			return registerInstruction(runCtx, "REG_SUB", chunk, offset);
+		case OP_REG_SUBI:
+			return registerImmInstruction(runCtx, "REG_SUBI", chunk, offset);
+		case OP_REG_MUL:
+			return registerInstruction(runCtx, "REG_MUL", chunk, offset);
+		case OP_REG_MULI:
+			return registerImmInstruction(runCtx, "REG_MULI", chunk, offset);
+		case OP_ADD_NUM_NUM:
+			return simpleInstruction(runCtx, "ADD_NUM_NUM", offset);
+		case OP_ADD_LOCAL_LOCAL:
+			return fusedLocalInstruction(runCtx, "ADD_LOCAL_LOCAL", chunk, offset, 7);
+		case OP_LESS_LOCAL_CONST:
+			return fusedLocalInstruction(runCtx, "LESS_LOCAL_CONST", chunk, offset, 6);
+		case OP_LESS_LOCAL_IMMI:
+			return fusedLocalInstruction(runCtx, "LESS_LOCAL_IMMI", chunk, offset, 9);
+		case OP_GET_MEMBER_PROP_RETURN:
+			return shortInstruction(runCtx, "GET_MEMBER_PROP_RETURN", chunk, offset) + 1;
 		default:
 			eloxPrintf(runCtx, ELOX_IO_DEBUG, "Unknown opcode %d\n", instruction);
 			return offset + 1;
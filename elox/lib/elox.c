@@ -38,6 +38,12 @@ void eloxInitConfig(EloxConfig *config) {
 		{ .loader = NULL }
 	};
 	config->moduleLoaders = defaultLoaders;
+	config->moduleCacheDir = NULL;
+	config->gc = (EloxGCConfig){
+		.incremental = false,
+		.markBudget = 4096,
+		.maxPauseUs = 1000
+	};
 }
 
 void eloxReleaseHandle(EloxHandle *handle) {
@@ -196,5 +202,17 @@ const char *eloxGetResultString(EloxCallableInfo *callableInfo) {
 	// result is just above the top of the stack
 	Value *res = fiber->stackTop;
 	assert(IS_STRING(*res));
+	ObjString *str = AS_STRING(*res);
+	if (ELOX_UNLIKELY((str->string.chars == NULL) || (str->flags & STRING_VIEW))) {
+		// terminating allocates, keep the result reachable meanwhile
+		push(fiber, *res);
+		EloxError error = ELOX_ERROR_INITIALIZER;
+		terminateString(callableInfo->runCtx, str, &error);
+		if (ELOX_UNLIKELY(error.raised))
+			pop(fiber); // discard error
+		pop(fiber);
+		if (ELOX_UNLIKELY(error.raised))
+			return NULL;
+	}
 	return AS_CSTRING(*res);
 }
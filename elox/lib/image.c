@@ -0,0 +1,1179 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <elox/elox-config-internal.h>
+
+#include "elox/image.h"
+#include "elox/state.h"
+#include "elox/object.h"
+#include "elox/table.h"
+#include "elox/compiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(ELOX_CONFIG_WIN32)
+	#include <process.h>
+	#define getpid _getpid
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif // ELOX_CONFIG_WIN32
+
+// Image layout, all integers in host byte order:
+//   header
+//   strings:   u32 length, bytes
+//   globals:   u32 name string, u32 module string
+//   builtins:  u32 name string
+//   functions: in post-order, nested functions before the functions that use
+//              them as constants, the top level function last
+
+#define ELOX_OPCODES_INLINE
+enum {
+#define OPCODE(name) IMAGE_OPCODE_##name,
+#include "elox/opcodes.h"
+#undef OPCODE
+	IMAGE_NUM_OPCODES
+};
+#undef ELOX_OPCODES_INLINE
+
+static const uint8_t imageMagic[8] = { 'E', 'L', 'O', 'X', 'C', 0, '\r', '\n' };
+
+typedef struct {
+	uint8_t magic[8];
+	uint32_t version;
+	uint32_t numOpcodes;
+	ImageSourceKey source;
+	// hash of everything after the header
+	uint64_t checksum;
+	uint32_t stringCount;
+	uint32_t globalCount;
+	uint32_t builtinCount;
+	uint32_t functionCount;
+} ImageHeader;
+
+typedef enum {
+	IMG_CONST_NIL,
+	IMG_CONST_FALSE,
+	IMG_CONST_TRUE,
+	IMG_CONST_NUMBER,
+	IMG_CONST_STRING,
+	IMG_CONST_FUNCTION
+} ImageConstType;
+
+#define IMG_NO_STRING UINT32_MAX
+
+typedef struct {
+	uint32_t name;
+	uint32_t fileName;
+	uint16_t arity;
+	uint16_t maxArgs;
+	uint16_t upvalueCount;
+	uint16_t refOffset;
+	uint8_t isMethod;
+	uint8_t hasDefaultArgs;
+	uint16_t slotCount;
+	uint32_t codeCount;
+	uint32_t lineCount;
+	uint32_t constantCount;
+	uint32_t icCount;
+} ImageFunctionHeader;
+
+// --- symbol operands ----------------------------------------------------
+
+typedef bool (*SymbolVisitor)(void *ctx, VarScope scope, uint8_t *operand);
+
+// Calls visit for every global or builtin index operand in the code of chunk
+static bool visitSymbols(Chunk *chunk, SymbolVisitor visit, void *ctx) {
+	uint8_t *code = chunk->code;
+
+	for (int offset = 0; offset < chunk->count; ) {
+		uint8_t op = genericOpcode(code[offset]);
+		if (op == OP_CLOSURE) {
+			uint16_t constant;
+			if (offset + 3 > chunk->count)
+				return false;
+			memcpy(&constant, code + offset + 1, sizeof(uint16_t));
+			if ((constant >= chunk->constants.count) ||
+				!IS_FUNCTION(chunk->constants.values[constant]))
+				return false;
+		}
+		int length = instructionLength(chunk, offset);
+		if ((length < 0) || (offset + length > chunk->count))
+			return false;
+
+		uint8_t *operands = code + offset + 1;
+		switch (op) {
+			case OP_GET_GLOBAL:
+			case OP_SET_GLOBAL:
+			case OP_DEFINE_GLOBAL:
+				if (!visit(ctx, VAR_GLOBAL, operands))
+					return false;
+				break;
+			case OP_GET_BUILTIN:
+				if (!visit(ctx, VAR_BUILTIN, operands))
+					return false;
+				break;
+			case OP_IMPORT: {
+				uint16_t numArgs;
+				memcpy(&numArgs, operands + 2, sizeof(uint16_t));
+				for (int i = 0; i < numArgs; i++) {
+					if (!visit(ctx, VAR_GLOBAL, operands + 4 + 2 * i))
+						return false;
+				}
+				break;
+			}
+			case OP_UNPACK: {
+				uint8_t *ptr = operands + 1;
+				for (int i = 0; i < operands[0]; i++) {
+					VarScope scope = ptr[0];
+					if ((scope == VAR_GLOBAL) || (scope == VAR_BUILTIN)) {
+						if (!visit(ctx, scope, ptr + 1))
+							return false;
+					}
+					ptr += (scope == VAR_UPVALUE) ? 2 : 3;
+				}
+				break;
+			}
+			case OP_DATA: {
+				// catch table, finally address followed by the handlers
+				int numHandlers = (operands[0] - 2) / 6;
+				uint8_t *handler = operands + 3;
+				for (int i = 0; i < numHandlers; i++, handler += 6) {
+					VarScope scope = handler[0];
+					if ((scope == VAR_GLOBAL) || (scope == VAR_BUILTIN)) {
+						if (!visit(ctx, scope, handler + 2))
+							return false;
+					}
+				}
+				break;
+			}
+			default:
+				break;
+		}
+		offset += length;
+	}
+
+	return true;
+}
+
+// --- writer -------------------------------------------------------------
+
+typedef struct {
+	RunCtx *runCtx;
+	FILE *file;
+	bool ok;
+	uint64_t checksum;
+
+	Table stringIndexes;
+	ObjString **strings;
+	int stringCount;
+	int stringCapacity;
+
+	ObjStringPair **globalNames;
+	int32_t *globalMap;
+	uint16_t *globals;
+	int globalCount;
+	int numVMGlobals;
+
+	ObjString **builtinNames;
+	int32_t *builtinMap;
+	uint16_t *builtins;
+	int builtinCount;
+	int numVMBuiltins;
+
+	ObjFunction **functions;
+	int functionCount;
+	int functionCapacity;
+} ImageWriter;
+
+static uint32_t addString(ImageWriter *w, ObjString *string) {
+	RunCtx *runCtx = w->runCtx;
+
+	if (string == NULL)
+		return IMG_NO_STRING;
+
+	Value indexVal;
+	if (tableGet(&w->stringIndexes, string, &indexVal))
+		return (uint32_t)AS_NUMBER(indexVal);
+
+	if (w->stringCapacity < w->stringCount + 1) {
+		int oldCapacity = w->stringCapacity;
+		int newCapacity = GROW_CAPACITY(oldCapacity);
+		ObjString **newStrings = GROW_ARRAY(runCtx, ObjString *, w->strings,
+											oldCapacity, newCapacity);
+		if (ELOX_UNLIKELY(newStrings == NULL)) {
+			w->ok = false;
+			return IMG_NO_STRING;
+		}
+		w->strings = newStrings;
+		w->stringCapacity = newCapacity;
+	}
+
+	uint32_t index = w->stringCount;
+	EloxError error = ELOX_ERROR_INITIALIZER;
+	tableSet(runCtx, &w->stringIndexes, string, NUMBER_VAL(index), &error);
+	if (ELOX_UNLIKELY(error.raised)) {
+		pop(runCtx->activeFiber); // discard error
+		w->ok = false;
+		return IMG_NO_STRING;
+	}
+	w->strings[w->stringCount++] = string;
+	return index;
+}
+
+static bool collectSymbol(void *ctx, VarScope scope, uint8_t *operand) {
+	ImageWriter *w = ctx;
+	uint16_t id;
+	memcpy(&id, operand, sizeof(uint16_t));
+
+	if (scope == VAR_GLOBAL) {
+		if ((id >= w->numVMGlobals) || (w->globalNames[id] == NULL))
+			return false;
+		if (w->globalMap[id] < 0) {
+			w->globalMap[id] = w->globalCount;
+			w->globals[w->globalCount++] = id;
+			addString(w, w->globalNames[id]->str1);
+			addString(w, w->globalNames[id]->str2);
+		}
+	} else {
+		if ((id >= w->numVMBuiltins) || (w->builtinNames[id] == NULL))
+			return false;
+		if (w->builtinMap[id] < 0) {
+			w->builtinMap[id] = w->builtinCount;
+			w->builtins[w->builtinCount++] = id;
+			addString(w, w->builtinNames[id]);
+		}
+	}
+	return true;
+}
+
+static bool remapSymbol(void *ctx, VarScope scope, uint8_t *operand) {
+	ImageWriter *w = ctx;
+	uint16_t id;
+	memcpy(&id, operand, sizeof(uint16_t));
+	uint16_t imageId = (scope == VAR_GLOBAL) ? w->globalMap[id] : w->builtinMap[id];
+	memcpy(operand, &imageId, sizeof(uint16_t));
+	return true;
+}
+
+static bool collectConstant(ImageWriter *w, Value value);
+
+static void collectFunction(ImageWriter *w, ObjFunction *function) {
+	RunCtx *runCtx = w->runCtx;
+	Chunk *chunk = &function->chunk;
+
+	for (uint32_t i = 0; (i < chunk->constants.count) && w->ok; i++)
+		w->ok = collectConstant(w, chunk->constants.values[i]);
+	if ((function->defaultArgs != NULL) && w->ok) {
+		for (int i = 0; (i < function->arity) && w->ok; i++)
+			w->ok = collectConstant(w, function->defaultArgs[i]);
+	}
+	addString(w, function->name);
+	addString(w, chunk->fileName);
+	if (!w->ok)
+		return;
+
+	if (!visitSymbols(chunk, collectSymbol, w)) {
+		w->ok = false;
+		return;
+	}
+
+	if (w->functionCapacity < w->functionCount + 1) {
+		int oldCapacity = w->functionCapacity;
+		int newCapacity = GROW_CAPACITY(oldCapacity);
+		ObjFunction **newFunctions = GROW_ARRAY(runCtx, ObjFunction *, w->functions,
+												oldCapacity, newCapacity);
+		if (ELOX_UNLIKELY(newFunctions == NULL)) {
+			w->ok = false;
+			return;
+		}
+		w->functions = newFunctions;
+		w->functionCapacity = newCapacity;
+	}
+	w->functions[w->functionCount++] = function;
+}
+
+static bool collectConstant(ImageWriter *w, Value value) {
+	if (IS_NIL(value) || IS_BOOL(value) || IS_NUMBER(value))
+		return true;
+	if (IS_STRING(value)) {
+		addString(w, AS_STRING(value));
+		return w->ok;
+	}
+	if (IS_FUNCTION(value)) {
+		collectFunction(w, AS_FUNCTION(value));
+		return w->ok;
+	}
+	// not a compile time constant
+	return false;
+}
+
+static void writeBytes(ImageWriter *w, const void *data, size_t size) {
+	if (w->ok && (size > 0)) {
+		w->ok = (fwrite(data, 1, size, w->file) == size);
+		w->checksum = imageHash(w->checksum, data, size);
+	}
+}
+
+static void writeU8(ImageWriter *w, uint8_t val) {
+	writeBytes(w, &val, sizeof(uint8_t));
+}
+
+static void writeU32(ImageWriter *w, uint32_t val) {
+	writeBytes(w, &val, sizeof(uint32_t));
+}
+
+static int32_t functionIndex(ImageWriter *w, ObjFunction *function, int before) {
+	// nested functions are collected just before their parent
+	for (int i = before - 1; i >= 0; i--) {
+		if (w->functions[i] == function)
+			return i;
+	}
+	return -1;
+}
+
+static uint32_t stringIndex(ImageWriter *w, ObjString *string) {
+	Value indexVal;
+	if ((string == NULL) || !tableGet(&w->stringIndexes, string, &indexVal))
+		return IMG_NO_STRING;
+	return (uint32_t)AS_NUMBER(indexVal);
+}
+
+static void writeConstant(ImageWriter *w, Value value, int functionIdx) {
+	if (IS_NIL(value))
+		writeU8(w, IMG_CONST_NIL);
+	else if (IS_BOOL(value))
+		writeU8(w, AS_BOOL(value) ? IMG_CONST_TRUE : IMG_CONST_FALSE);
+	else if (IS_NUMBER(value)) {
+		double number = AS_NUMBER(value);
+		writeU8(w, IMG_CONST_NUMBER);
+		writeBytes(w, &number, sizeof(double));
+	} else if (IS_STRING(value)) {
+		writeU8(w, IMG_CONST_STRING);
+		writeU32(w, stringIndex(w, AS_STRING(value)));
+	} else {
+		int32_t index = functionIndex(w, AS_FUNCTION(value), functionIdx);
+		if (index < 0)
+			w->ok = false;
+		writeU8(w, IMG_CONST_FUNCTION);
+		writeU32(w, index);
+	}
+}
+
+static void writeFunction(ImageWriter *w, int functionIdx) {
+	RunCtx *runCtx = w->runCtx;
+	ObjFunction *function = w->functions[functionIdx];
+	Chunk *chunk = &function->chunk;
+
+	ImageFunctionHeader header = {
+		.name = stringIndex(w, function->name),
+		.fileName = stringIndex(w, chunk->fileName),
+		.arity = function->arity,
+		.maxArgs = function->maxArgs,
+		.upvalueCount = function->upvalueCount,
+		.refOffset = function->refOffset,
+		.isMethod = function->isMethod,
+		.hasDefaultArgs = (function->defaultArgs != NULL),
+		.slotCount = function->slotCount,
+		.codeCount = chunk->count,
+		.lineCount = chunk->lineCount,
+		.constantCount = chunk->constants.count,
+		.icCount = chunk->icCount
+	};
+	writeBytes(w, &header, sizeof(ImageFunctionHeader));
+
+	uint8_t *code = ALLOCATE(runCtx, uint8_t, chunk->count);
+	if (ELOX_UNLIKELY(code == NULL)) {
+		w->ok = false;
+		return;
+	}
+	memcpy(code, chunk->code, chunk->count);
+	Chunk imageChunk = *chunk;
+	imageChunk.code = code;
+	visitSymbols(&imageChunk, remapSymbol, w);
+	writeBytes(w, code, chunk->count);
+	FREE_ARRAY(runCtx, uint8_t, code, chunk->count);
+
+	writeBytes(w, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+	for (uint32_t i = 0; i < chunk->constants.count; i++)
+		writeConstant(w, chunk->constants.values[i], functionIdx);
+	if (function->defaultArgs != NULL) {
+		for (int i = 0; i < function->arity; i++)
+			writeConstant(w, function->defaultArgs[i], functionIdx);
+	}
+}
+
+static bool initSymbolNames(ImageWriter *w) {
+	RunCtx *runCtx = w->runCtx;
+	VM *vm = runCtx->vm;
+
+	w->numVMGlobals = vm->globalValues.count;
+	w->globalNames = ALLOCATE(runCtx, ObjStringPair *, w->numVMGlobals + 1);
+	w->globalMap = ALLOCATE(runCtx, int32_t, w->numVMGlobals + 1);
+	w->globals = ALLOCATE(runCtx, uint16_t, w->numVMGlobals + 1);
+	w->numVMBuiltins = vm->builtinValues.count;
+	w->builtinNames = ALLOCATE(runCtx, ObjString *, w->numVMBuiltins + 1);
+	w->builtinMap = ALLOCATE(runCtx, int32_t, w->numVMBuiltins + 1);
+	w->builtins = ALLOCATE(runCtx, uint16_t, w->numVMBuiltins + 1);
+	if (ELOX_UNLIKELY((w->globalNames == NULL) || (w->globalMap == NULL) ||
+					  (w->globals == NULL) || (w->builtinNames == NULL) ||
+					  (w->builtinMap == NULL) || (w->builtins == NULL)))
+		return false;
+
+	for (int i = 0; i < w->numVMGlobals; i++) {
+		w->globalNames[i] = NULL;
+		w->globalMap[i] = -1;
+	}
+	for (int i = 0; i < w->numVMBuiltins; i++) {
+		w->builtinNames[i] = NULL;
+		w->builtinMap[i] = -1;
+	}
+
+	TableEntry *entry;
+	int32_t entryIndex = 0;
+	while ((entryIndex = valueTableGetNext(&vm->globalNames, entryIndex, &entry)) >= 0) {
+		int id = AS_NUMBER(entry->value);
+		if (id < w->numVMGlobals)
+			w->globalNames[id] = AS_STRINGPAIR(entry->key);
+	}
+
+	for (int i = 0; i < vm->builtinSymbols.capacity; i++) {
+		Entry *entry = &vm->builtinSymbols.entries[i];
+		if ((entry->key != NULL) && IS_NUMBER(entry->value)) {
+			int id = AS_NUMBER(entry->value);
+			if (id < w->numVMBuiltins)
+				w->builtinNames[id] = entry->key;
+		}
+	}
+
+	return true;
+}
+
+#define FREE_SYMBOL_ARRAY(runCtx, type, pointer, count) \
+	if ((pointer) != NULL) \
+		FREE_ARRAY(runCtx, type, pointer, count)
+
+static void freeSymbolNames(ImageWriter *w) {
+	RunCtx *runCtx = w->runCtx;
+
+	FREE_SYMBOL_ARRAY(runCtx, ObjStringPair *, w->globalNames, w->numVMGlobals + 1);
+	FREE_SYMBOL_ARRAY(runCtx, int32_t, w->globalMap, w->numVMGlobals + 1);
+	FREE_SYMBOL_ARRAY(runCtx, uint16_t, w->globals, w->numVMGlobals + 1);
+	FREE_SYMBOL_ARRAY(runCtx, ObjString *, w->builtinNames, w->numVMBuiltins + 1);
+	FREE_SYMBOL_ARRAY(runCtx, int32_t, w->builtinMap, w->numVMBuiltins + 1);
+	FREE_SYMBOL_ARRAY(runCtx, uint16_t, w->builtins, w->numVMBuiltins + 1);
+}
+
+bool writeImage(RunCtx *runCtx, ObjFunction *function, const ImageSourceKey *key,
+				const char *path) {
+	ImageWriter w = { .runCtx = runCtx, .ok = true };
+	initTable(&w.stringIndexes);
+
+	char tmpPath[1024];
+	bool written = false;
+
+	if (!initSymbolNames(&w))
+		goto cleanup;
+	collectFunction(&w, function);
+	if (!w.ok)
+		goto cleanup;
+
+	// write to a private file first, so concurrent loaders never see a partial image
+	int len = snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long)getpid());
+	if ((len < 0) || ((size_t)len >= sizeof(tmpPath)))
+		goto cleanup;
+	w.file = fopen(tmpPath, "wb");
+	if (w.file == NULL)
+		goto cleanup;
+
+	ImageHeader header = {
+		.version = ELOX_IMAGE_VERSION,
+		.numOpcodes = IMAGE_NUM_OPCODES,
+		.source = *key,
+		.stringCount = w.stringCount,
+		.globalCount = w.globalCount,
+		.builtinCount = w.builtinCount,
+		.functionCount = w.functionCount
+	};
+	memcpy(header.magic, imageMagic, sizeof(imageMagic));
+	writeBytes(&w, &header, sizeof(ImageHeader));
+	w.checksum = ELOX_IMAGE_HASH_SEED;
+
+	for (int i = 0; i < w.stringCount; i++) {
+		String *str = &w.strings[i]->string;
+		writeU32(&w, str->length);
+		writeBytes(&w, str->chars, str->length);
+	}
+	for (int i = 0; i < w.globalCount; i++) {
+		ObjStringPair *name = w.globalNames[w.globals[i]];
+		writeU32(&w, stringIndex(&w, name->str1));
+		writeU32(&w, stringIndex(&w, name->str2));
+	}
+	for (int i = 0; i < w.builtinCount; i++)
+		writeU32(&w, stringIndex(&w, w.builtinNames[w.builtins[i]]));
+	for (int i = 0; (i < w.functionCount) && w.ok; i++)
+		writeFunction(&w, i);
+
+	// the checksum is only known now, patch it into the header
+	header.checksum = w.checksum;
+	if (w.ok && (fseek(w.file, 0L, SEEK_SET) == 0))
+		writeBytes(&w, &header, sizeof(ImageHeader));
+	else
+		w.ok = false;
+
+	if (fclose(w.file) != 0)
+		w.ok = false;
+	w.file = NULL;
+
+	if (w.ok && (rename(tmpPath, path) == 0))
+		written = true;
+	else
+		remove(tmpPath);
+
+cleanup:
+	freeTable(runCtx, &w.stringIndexes);
+	FREE_ARRAY(runCtx, ObjString *, w.strings, w.stringCapacity);
+	FREE_ARRAY(runCtx, ObjFunction *, w.functions, w.functionCapacity);
+	freeSymbolNames(&w);
+
+	return written;
+}
+
+// --- loader -------------------------------------------------------------
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+} ImageMapping;
+
+#if defined(ELOX_CONFIG_WIN32)
+
+static bool mapImage(RunCtx *runCtx, const char *path, ImageMapping *mapping) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+
+	bool ret = false;
+	fseek(file, 0L, SEEK_END);
+	long fileSize = ftell(file);
+	rewind(file);
+	if (fileSize <= 0)
+		goto cleanup;
+
+	uint8_t *buffer = ALLOCATE(runCtx, uint8_t, fileSize);
+	if (buffer == NULL)
+		goto cleanup;
+	if (fread(buffer, 1, fileSize, file) != (size_t)fileSize) {
+		FREE_ARRAY(runCtx, uint8_t, buffer, fileSize);
+		goto cleanup;
+	}
+	mapping->data = buffer;
+	mapping->size = fileSize;
+	ret = true;
+
+cleanup:
+	fclose(file);
+	return ret;
+}
+
+static void unmapImage(RunCtx *runCtx, ImageMapping *mapping) {
+	FREE_ARRAY(runCtx, uint8_t, (uint8_t *)mapping->data, mapping->size);
+}
+
+#else
+
+static bool mapImage(RunCtx *runCtx ELOX_UNUSED, const char *path, ImageMapping *mapping) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	bool ret = false;
+	struct stat fileStat;
+	if ((fstat(fd, &fileStat) < 0) || (fileStat.st_size <= 0))
+		goto cleanup;
+
+	void *data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto cleanup;
+	mapping->data = data;
+	mapping->size = fileStat.st_size;
+	ret = true;
+
+cleanup:
+	close(fd);
+	return ret;
+}
+
+static void unmapImage(RunCtx *runCtx ELOX_UNUSED, ImageMapping *mapping) {
+	munmap((void *)mapping->data, mapping->size);
+}
+
+#endif // ELOX_CONFIG_WIN32
+
+typedef struct {
+	RunCtx *runCtx;
+	const uint8_t *ptr;
+	const uint8_t *end;
+	// loaded strings, followed by the loaded functions
+	ObjArray *objects;
+	uint32_t stringCount;
+	uint16_t *globals;
+	uint32_t globalCount;
+	uint16_t *builtins;
+	uint32_t builtinCount;
+	bool valid;
+} ImageReader;
+
+static const uint8_t *readBytes(ImageReader *r, size_t size) {
+	if (!r->valid || ((size_t)(r->end - r->ptr) < size)) {
+		r->valid = false;
+		return NULL;
+	}
+	const uint8_t *ret = r->ptr;
+	r->ptr += size;
+	return ret;
+}
+
+static bool readInto(ImageReader *r, void *dest, size_t size) {
+	const uint8_t *data = readBytes(r, size);
+	if (data == NULL)
+		return false;
+	memcpy(dest, data, size);
+	return true;
+}
+
+static uint32_t readU32(ImageReader *r) {
+	uint32_t val = 0;
+	readInto(r, &val, sizeof(uint32_t));
+	return val;
+}
+
+static ObjString *imageString(ImageReader *r, uint32_t index) {
+	if (index == IMG_NO_STRING)
+		return NULL;
+	if (index >= r->stringCount) {
+		r->valid = false;
+		return NULL;
+	}
+	return AS_STRING(r->objects->items[index]);
+}
+
+static Value readConstant(ImageReader *r, uint32_t loadedFunctions) {
+	uint8_t type = IMG_CONST_NIL;
+	readInto(r, &type, sizeof(uint8_t));
+	switch (type) {
+		case IMG_CONST_NIL:
+			return NIL_VAL;
+		case IMG_CONST_FALSE:
+			return BOOL_VAL(false);
+		case IMG_CONST_TRUE:
+			return BOOL_VAL(true);
+		case IMG_CONST_NUMBER: {
+			double number = 0;
+			readInto(r, &number, sizeof(double));
+			return NUMBER_VAL(number);
+		}
+		case IMG_CONST_STRING: {
+			ObjString *string = imageString(r, readU32(r));
+			return (string == NULL) ? NIL_VAL : OBJ_VAL(string);
+		}
+		case IMG_CONST_FUNCTION: {
+			uint32_t index = readU32(r);
+			if (index >= loadedFunctions)
+				break;
+			return r->objects->items[r->stringCount + index];
+		}
+		default:
+			break;
+	}
+	r->valid = false;
+	return NIL_VAL;
+}
+
+static bool resolveSymbol(void *ctx, VarScope scope, uint8_t *operand) {
+	ImageReader *r = ctx;
+	uint16_t imageId;
+	memcpy(&imageId, operand, sizeof(uint16_t));
+
+	uint16_t id;
+	if (scope == VAR_GLOBAL) {
+		if (imageId >= r->globalCount)
+			return false;
+		id = r->globals[imageId];
+	} else {
+		if (imageId >= r->builtinCount)
+			return false;
+		id = r->builtins[imageId];
+	}
+	memcpy(operand, &id, sizeof(uint16_t));
+	return true;
+}
+
+// Class declarations nested in a chunk, deeper ones are rejected
+#define IMG_MAX_CLASS_DEPTH 32
+
+static bool isCodeStart(const uint8_t *starts, int count, int offset) {
+	return (offset >= 0) && (offset < count) && starts[offset];
+}
+
+// Like instructionLength(), but never reads past the end of the code
+static int checkedLength(Chunk *chunk, int offset) {
+	const uint8_t *code = chunk->code;
+	int avail = chunk->count - offset;
+	uint8_t op = code[offset];
+
+	if ((op >= IMAGE_NUM_OPCODES) || (genericOpcode(op) != op))
+		return -1;
+
+	switch (op) {
+		case OP_CLOSURE: {
+			if (avail < 3)
+				return -1;
+			uint16_t constant;
+			memcpy(&constant, code + offset + 1, sizeof(uint16_t));
+			if ((constant >= chunk->constants.count) ||
+				!IS_FUNCTION(chunk->constants.values[constant]))
+				return -1;
+			break;
+		}
+		case OP_CLOSE_CLASS:
+			if (avail < 3)
+				return -1;
+			break;
+		case OP_IMPORT:
+			if (avail < 5)
+				return -1;
+			break;
+		case OP_DATA:
+			if (avail < 2)
+				return -1;
+			break;
+		case OP_UNPACK: {
+			if (avail < 2)
+				return -1;
+			int length = 2;
+			for (int i = 0; i < code[offset + 1]; i++) {
+				if (length >= avail)
+					return -1;
+				length += (code[offset + length] == VAR_UPVALUE) ? 2 : 3;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+
+	int length = instructionLength(chunk, offset);
+	if ((length < 0) || (length > avail))
+		return -1;
+	return length;
+}
+
+static bool validConstant(Chunk *chunk, const uint8_t *operand) {
+	uint16_t constant;
+	memcpy(&constant, operand, sizeof(uint16_t));
+	return constant < chunk->constants.count;
+}
+
+static bool validStringConstant(Chunk *chunk, const uint8_t *operand) {
+	uint16_t constant;
+	memcpy(&constant, operand, sizeof(uint16_t));
+	return (constant < chunk->constants.count) && IS_STRING(chunk->constants.values[constant]);
+}
+
+static bool validCache(Chunk *chunk, const uint8_t *operand) {
+	uint16_t cacheIndex;
+	memcpy(&cacheIndex, operand, sizeof(uint16_t));
+	return cacheIndex < chunk->icCount;
+}
+
+static bool validJump(const uint8_t *starts, int count, int offset, const uint8_t *operand,
+					  int sign) {
+	uint16_t jump;
+	memcpy(&jump, operand, sizeof(uint16_t));
+	return isCodeStart(starts, count, offset + 3 + sign * jump);
+}
+
+// Local slot operands are slot, postArgs pairs, as for GET_LOCAL
+static bool validLocal(ObjFunction *function, uint16_t slot, uint8_t postArgs) {
+	return (slot < function->slotCount) && (postArgs <= 1);
+}
+
+static bool validVar(ObjFunction *function, VarScope scope, uint16_t handle, uint8_t postArgs) {
+	switch (scope) {
+		case VAR_LOCAL:
+			return validLocal(function, handle, postArgs);
+		case VAR_GLOBAL:
+		case VAR_BUILTIN:
+			// globals and builtins are checked when they are resolved
+			return true;
+		case VAR_UPVALUE:
+			return handle < function->upvalueCount;
+	}
+	return false;
+}
+
+// The interpreter trusts its operands, so everything it uses to index into
+// the function or its frame (constants, local slots, upvalues, inline caches,
+// jump targets, handler tables and class member slots) is checked once before
+// image code runs.
+// Runs before the symbols are resolved, visitSymbols() expects valid code
+static bool validateCode(ObjFunction *function, uint8_t *starts) {
+	Chunk *chunk = &function->chunk;
+	const uint8_t *code = chunk->code;
+	int count = chunk->count;
+
+	int lastOffset = -1;
+	for (int offset = 0; offset < count; ) {
+		int length = checkedLength(chunk, offset);
+		if (length < 0)
+			return false;
+		starts[offset] = 1;
+		lastOffset = offset;
+		offset += length;
+	}
+	// execution cannot run off the end of the code
+	if ((lastOffset < 0) || (code[lastOffset] != OP_RETURN))
+		return false;
+
+	uint16_t classRefs[IMG_MAX_CLASS_DEPTH];
+	int classDepth = 0;
+
+	for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+		const uint8_t *operands = code + offset + 1;
+		bool valid = true;
+
+		switch (code[offset]) {
+			case OP_CONST8:
+				valid = operands[0] < chunk->constants.count;
+				break;
+			case OP_CONST16:
+				valid = validConstant(chunk, operands);
+				break;
+			case OP_GET_LOCAL:
+			case OP_SET_LOCAL:
+				valid = validLocal(function, operands[0], operands[1]);
+				break;
+			case OP_GET_UPVALUE:
+			case OP_SET_UPVALUE:
+				valid = operands[0] < function->upvalueCount;
+				break;
+			case OP_REG_ADD:
+			case OP_REG_SUB:
+			case OP_REG_MUL:
+				valid = validLocal(function, operands[4], operands[5]);
+				// FALLTHROUGH
+			case OP_REG_ADDI:
+			case OP_REG_SUBI:
+			case OP_REG_MULI:
+				valid = valid && validLocal(function, operands[2], operands[3]) &&
+						(((operands[0] == REG_STACK) && (operands[1] == 0)) ||
+						 validLocal(function, operands[0], operands[1]));
+				break;
+			case OP_GET_PROP:
+				valid = validStringConstant(chunk, operands) && validCache(chunk, operands + 2);
+				break;
+			case OP_INVOKE:
+				valid = validStringConstant(chunk, operands) && validCache(chunk, operands + 4);
+				break;
+			case OP_MAP_GET:
+			case OP_SET_PROP:
+			case OP_MAP_SET:
+			case OP_INTF:
+			case OP_CLASS:
+			case OP_ABS_METHOD:
+			case OP_METHOD:
+			case OP_FIELD:
+			case OP_STATIC:
+			case OP_IMPORT:
+				valid = validStringConstant(chunk, operands);
+				break;
+			case OP_JUMP:
+			case OP_JUMP_IF_FALSE:
+				valid = validJump(starts, count, offset, operands, 1);
+				break;
+			case OP_LOOP:
+				valid = validJump(starts, count, offset, operands, -1);
+				break;
+			case OP_CLOSURE: {
+				uint16_t constant;
+				memcpy(&constant, operands, sizeof(uint16_t));
+				ObjFunction *closureFunction = AS_FUNCTION(chunk->constants.values[constant]);
+				for (int i = 0; (i < closureFunction->upvalueCount) && valid; i++) {
+					uint8_t isLocal = operands[2 + 2 * i];
+					uint8_t index = operands[3 + 2 * i];
+					valid = ((isLocal == 1) && (index < function->slotCount)) ||
+							((isLocal == 0) && (index < function->upvalueCount));
+				}
+				break;
+			}
+			case OP_ARRAY_BUILD:
+				valid = (operands[0] == OBJ_ARRAY) || (operands[0] == OBJ_TUPLE);
+				break;
+			case OP_INHERIT:
+				if (classDepth == IMG_MAX_CLASS_DEPTH)
+					return false;
+				memcpy(&classRefs[classDepth++], operands + 1, sizeof(uint16_t));
+				break;
+			case OP_CLOSE_CLASS: {
+				if (classDepth == 0)
+					return false;
+				uint16_t numRefs = classRefs[--classDepth];
+				uint16_t numMembers;
+				memcpy(&numMembers, operands, sizeof(uint16_t));
+				for (int i = 0; (i < numMembers) && valid; i++) {
+					const uint8_t *member = operands + 2 + 5 * i;
+					uint16_t slot;
+					memcpy(&slot, member + 3, sizeof(uint16_t));
+					valid = validStringConstant(chunk, member + 1) && (slot < numRefs);
+				}
+				break;
+			}
+			case OP_PUSH_EXH: {
+				// points just after the DATA opcode of the catch table
+				uint16_t handlerData;
+				memcpy(&handlerData, operands + 1, sizeof(uint16_t));
+				valid = isCodeStart(starts, count, handlerData - 1) &&
+						(code[handlerData - 1] == OP_DATA);
+				break;
+			}
+			case OP_DATA: {
+				// catch table, finally address followed by the handlers
+				uint8_t tableSize = operands[0];
+				if ((tableSize < 2) || ((tableSize - 2) % 6 != 0))
+					return false;
+				uint16_t finallyAddress;
+				memcpy(&finallyAddress, operands + 1, sizeof(uint16_t));
+				valid = (finallyAddress == 0) || isCodeStart(starts, count, finallyAddress);
+				const uint8_t *handler = operands + 3;
+				for (int i = 0; (i < (tableSize - 2) / 6) && valid; i++, handler += 6) {
+					uint16_t typeHandle;
+					memcpy(&typeHandle, handler + 2, sizeof(uint16_t));
+					uint16_t handlerAddress;
+					memcpy(&handlerAddress, handler + 4, sizeof(uint16_t));
+					valid = validVar(function, handler[0], typeHandle, handler[1]) &&
+							isCodeStart(starts, count, handlerAddress);
+				}
+				break;
+			}
+			case OP_UNPACK: {
+				const uint8_t *var = operands + 1;
+				for (int i = 0; (i < operands[0]) && valid; i++) {
+					VarScope scope = var[0];
+					valid = validVar(function, scope, var[1], (scope == VAR_LOCAL) ? var[2] : 0);
+					var += (scope == VAR_UPVALUE) ? 2 : 3;
+				}
+				break;
+			}
+			default:
+				break;
+		}
+
+		if (!valid)
+			return false;
+	}
+
+	return classDepth == 0;
+}
+
+static bool readFunction(ImageReader *r, uint32_t loadedFunctions, EloxError *error) {
+	RunCtx *runCtx = r->runCtx;
+
+	ImageFunctionHeader header;
+	if (!readInto(r, &header, sizeof(ImageFunctionHeader)))
+		return false;
+
+	ObjString *fileName = imageString(r, header.fileName);
+	ObjString *name = imageString(r, header.name);
+	// argument adjustment reads the defaults of every function with parameters
+	if ((header.hasDefaultArgs != (header.arity > 0)) || (header.maxArgs < header.arity) ||
+		(header.isMethod > 1) || (header.isMethod && (header.arity == 0)) ||
+		(header.icCount > header.codeCount) ||
+		(header.slotCount == 0) || (header.slotCount > UINT8_COUNT))
+		r->valid = false;
+	if (!r->valid)
+		return false;
+
+	ObjFunction *function = newFunction(runCtx, fileName);
+	ELOX_CHECK_THROW_RET_VAL(function != NULL, error, OOM(runCtx), false);
+	ELOX_CHECK_THROW_RET_VAL(appendToArray(runCtx, r->objects, OBJ_VAL(function)),
+							 error, OOM(runCtx), false);
+	function->name = name;
+	function->arity = header.arity;
+	function->maxArgs = header.maxArgs;
+	function->upvalueCount = header.upvalueCount;
+	function->refOffset = header.refOffset;
+	function->slotCount = header.slotCount;
+	function->isMethod = header.isMethod;
+
+	Chunk *chunk = &function->chunk;
+	const uint8_t *code = readBytes(r, header.codeCount);
+	const uint8_t *lines = readBytes(r, sizeof(LineStart) * header.lineCount);
+	if (!r->valid)
+		return false;
+
+	chunk->code = ALLOCATE(runCtx, uint8_t, header.codeCount);
+	ELOX_CHECK_THROW_RET_VAL(chunk->code != NULL, error, OOM(runCtx), false);
+	memcpy(chunk->code, code, header.codeCount);
+	chunk->count = chunk->capacity = header.codeCount;
+
+	if (header.lineCount > 0) {
+		chunk->lines = ALLOCATE(runCtx, LineStart, header.lineCount);
+		ELOX_CHECK_THROW_RET_VAL(chunk->lines != NULL, error, OOM(runCtx), false);
+		memcpy(chunk->lines, lines, sizeof(LineStart) * header.lineCount);
+		chunk->lineCount = chunk->lineCapacity = header.lineCount;
+	}
+
+	if (header.icCount > 0) {
+		chunk->inlineCaches = ALLOCATE(runCtx, InlineCache, header.icCount);
+		ELOX_CHECK_THROW_RET_VAL(chunk->inlineCaches != NULL, error, OOM(runCtx), false);
+		memset(chunk->inlineCaches, 0, sizeof(InlineCache) * header.icCount);
+		chunk->icCount = chunk->icCapacity = header.icCount;
+	}
+
+	for (uint32_t i = 0; i < header.constantCount; i++) {
+		Value constant = readConstant(r, loadedFunctions);
+		if (!r->valid)
+			return false;
+		ELOX_CHECK_THROW_RET_VAL(valueArrayPush(runCtx, &chunk->constants, constant),
+								 error, OOM(runCtx), false);
+	}
+
+	if (header.hasDefaultArgs) {
+		function->defaultArgs = ALLOCATE(runCtx, Value, header.arity);
+		ELOX_CHECK_THROW_RET_VAL(function->defaultArgs != NULL, error, OOM(runCtx), false);
+		for (int i = 0; i < header.arity; i++)
+			function->defaultArgs[i] = readConstant(r, loadedFunctions);
+		if (!r->valid)
+			return false;
+	}
+
+	uint8_t *starts = ALLOCATE(runCtx, uint8_t, chunk->count);
+	ELOX_CHECK_THROW_RET_VAL(starts != NULL, error, OOM(runCtx), false);
+	memset(starts, 0, chunk->count);
+	bool validCode = validateCode(function, starts);
+	FREE_ARRAY(runCtx, uint8_t, starts, chunk->count);
+
+	if (!validCode || !visitSymbols(chunk, resolveSymbol, r))
+		r->valid = false;
+	return r->valid;
+}
+
+static bool readSymbols(ImageReader *r, EloxError *error) {
+	RunCtx *runCtx = r->runCtx;
+	VM *vm = runCtx->vm;
+
+	for (uint32_t i = 0; i < r->globalCount; i++) {
+		ObjString *name = imageString(r, readU32(r));
+		ObjString *moduleName = imageString(r, readU32(r));
+		if (!r->valid || (name == NULL) || (moduleName == NULL))
+			return false;
+		suint16_t id = globalIdentifierConstant(runCtx, &name->string, &moduleName->string);
+		ELOX_CHECK_THROW_RET_VAL(id >= 0, error, OOM(runCtx), false);
+		r->globals[i] = id;
+	}
+
+	for (uint32_t i = 0; i < r->builtinCount; i++) {
+		ObjString *name = imageString(r, readU32(r));
+		Value idVal;
+		if (!r->valid || (name == NULL) || !tableGet(&vm->builtinSymbols, name, &idVal))
+			return false;
+		r->builtins[i] = AS_NUMBER(idVal);
+	}
+
+	return true;
+}
+
+ObjFunction *loadImage(RunCtx *runCtx, const char *path, const ImageSourceKey *key,
+					   EloxError *error) {
+	FiberCtx *fiber = runCtx->activeFiber;
+
+	ImageMapping mapping;
+	if (!mapImage(runCtx, path, &mapping))
+		return NULL;
+
+	ObjFunction *ret = NULL;
+	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
+	ImageReader r = {
+		.runCtx = runCtx,
+		.ptr = mapping.data,
+		.end = mapping.data + mapping.size,
+		.valid = true
+	};
+
+	ImageHeader header;
+	if (!readInto(&r, &header, sizeof(ImageHeader)) ||
+		(memcmp(header.magic, imageMagic, sizeof(imageMagic)) != 0) ||
+		(header.version != ELOX_IMAGE_VERSION) ||
+		(header.numOpcodes != IMAGE_NUM_OPCODES) ||
+		(header.source.size != key->size) ||
+		(header.source.hash != key->hash) ||
+		(header.functionCount == 0))
+		goto cleanup;
+	// catches truncated and damaged images, the checks below catch bad ones written intact
+	if (imageHash(ELOX_IMAGE_HASH_SEED, r.ptr, r.end - r.ptr) != header.checksum) {
+		r.valid = false;
+		goto cleanup;
+	}
+	// every entry takes up some room, reject counts that cannot fit before allocating
+	uint64_t minSize = sizeof(ImageHeader) + (uint64_t)header.stringCount * sizeof(uint32_t) +
+					   (uint64_t)header.globalCount * 2 * sizeof(uint32_t) +
+					   (uint64_t)header.builtinCount * sizeof(uint32_t) +
+					   (uint64_t)header.functionCount * sizeof(ImageFunctionHeader);
+	if (minSize > mapping.size) {
+		r.valid = false;
+		goto cleanup;
+	}
+
+	r.objects = newArray(runCtx, header.stringCount + header.functionCount, OBJ_ARRAY);
+	ELOX_CHECK_THROW_GOTO(r.objects != NULL, error, OOM(runCtx), cleanup);
+	PUSH_TEMP(temps, protectedObjects, OBJ_VAL(r.objects));
+
+	for (uint32_t i = 0; i < header.stringCount; i++) {
+		uint32_t length = readU32(&r);
+		const uint8_t *chars = readBytes(&r, length);
+		if (!r.valid)
+			goto cleanup;
+		ObjString *string = copyString(runCtx, chars, length);
+		ELOX_CHECK_THROW_GOTO(string != NULL, error, OOM(runCtx), cleanup);
+		ELOX_CHECK_THROW_GOTO(appendToArray(runCtx, r.objects, OBJ_VAL(string)),
+							  error, OOM(runCtx), cleanup);
+	}
+	r.stringCount = header.stringCount;
+
+	r.globalCount = header.globalCount;
+	r.builtinCount = header.builtinCount;
+	r.globals = ALLOCATE(runCtx, uint16_t, r.globalCount + 1);
+	r.builtins = ALLOCATE(runCtx, uint16_t, r.builtinCount + 1);
+	ELOX_CHECK_THROW_GOTO((r.globals != NULL) && (r.builtins != NULL),
+						  error, OOM(runCtx), cleanup);
+	if (!readSymbols(&r, error))
+		goto cleanup;
+
+	for (uint32_t i = 0; i < header.functionCount; i++) {
+		if (!readFunction(&r, i, error))
+			goto cleanup;
+	}
+
+	if (r.valid && (r.ptr == r.end))
+		ret = AS_FUNCTION(r.objects->items[r.objects->size - 1]);
+	else
+		r.valid = false;
+
+cleanup:
+	if (ELOX_UNLIKELY(!r.valid) && !error->raised) {
+		// matches the source, but cannot be trusted
+		runtimeError(runCtx, "Corrupt image '%s'", path);
+		error->raised = true;
+	}
+	FREE_SYMBOL_ARRAY(runCtx, uint16_t, r.globals, r.globalCount + 1);
+	FREE_SYMBOL_ARRAY(runCtx, uint16_t, r.builtins, r.builtinCount + 1);
+	releaseTemps(&temps);
+	unmapImage(runCtx, &mapping);
+
+	return ret;
+}
@@ -0,0 +1,688 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "elox/jit.h"
+
+#ifdef ELOX_ENABLE_JIT
+
+#include "elox/state.h"
+#include "elox/object.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+// Baseline template JIT for x86-64 (System V). Every supported instruction
+// is a fixed machine code template with holes for its operands, copied back
+// to back. Native code keeps the frame slots in rbx, the slots of the locals
+// declared after the arguments (which move with the number of varargs) in r14
+// and the value stack top in r13 and only handles the common case; whenever an operand has an
+// unexpected type, or for instructions without a template, it stores the
+// stack top back and returns the bytecode offset to the interpreter, which
+// executes that one instruction (raising any error) and then re-enters.
+
+_Static_assert(sizeof(Value) == 16, "JIT templates assume 16 byte values");
+_Static_assert(offsetof(Value, type) == 0, "JIT templates assume the value type first");
+_Static_assert(offsetof(Value, as) == 8, "JIT templates assume the payload at offset 8");
+_Static_assert(VAL_NUMBER == 0, "JIT templates assume number type 0");
+
+typedef uint32_t (*JitEntry)(Value *slots, Value *postSlots, Value **stackTop, uint8_t *target);
+
+typedef enum {
+	FIX_TARGET,  // jump to the native code of a bytecode offset
+	FIX_EXIT,    // leave native code at a bytecode offset
+	FIX_EPILOGUE
+} JitFixupType;
+
+typedef struct {
+	JitFixupType type;
+	int pos;
+	int offset;
+} JitFixup;
+
+typedef struct {
+	uint8_t *code;
+	int count;
+	JitFixup *fixups;
+	int fixupCount;
+	uint32_t *entries;
+	int *exits;
+} JitBuffer;
+
+// Worst case native bytes per bytecode byte, instruction plus exit stub
+#define JIT_BYTES_PER_OP 96
+// At most two guards per instruction
+#define JIT_FIXUPS_PER_OP 2
+// Native instructions in a row before entering native code pays back the call
+#define JIT_MIN_RUN 3
+
+static const uint8_t prologueTemplate[] = {
+	0x53,                         // push rbx
+	0x41, 0x54,                   // push r12
+	0x41, 0x55,                   // push r13
+	0x41, 0x56,                   // push r14
+	0x48, 0x89, 0xfb,             // mov rbx, rdi
+	0x49, 0x89, 0xf6,             // mov r14, rsi
+	0x49, 0x89, 0xd4,             // mov r12, rdx
+	0x4d, 0x8b, 0x2c, 0x24,       // mov r13, [r12]
+	0xff, 0xe1                    // jmp rcx
+};
+
+static const uint8_t epilogueTemplate[] = {
+	0x4d, 0x89, 0x2c, 0x24,       // mov [r12], r13
+	0x41, 0x5e,                   // pop r14
+	0x41, 0x5d,                   // pop r13
+	0x41, 0x5c,                   // pop r12
+	0x5b,                         // pop rbx
+	0xc3                          // ret
+};
+
+static const uint8_t getLocalTemplate[] = {
+	0xf3, 0x0f, 0x6f, 0x83, 0, 0, 0, 0,     // movdqu xmm0, [rbx + slot]
+	0xf3, 0x41, 0x0f, 0x7f, 0x45, 0x00,     // movdqu [r13], xmm0
+	0x49, 0x83, 0xc5, 0x10                  // add r13, 16
+};
+#define GET_LOCAL_SLOT 4
+
+static const uint8_t getPostLocalTemplate[] = {
+	0xf3, 0x41, 0x0f, 0x6f, 0x86, 0, 0, 0, 0,   // movdqu xmm0, [r14 + slot]
+	0xf3, 0x41, 0x0f, 0x7f, 0x45, 0x00,         // movdqu [r13], xmm0
+	0x49, 0x83, 0xc5, 0x10                      // add r13, 16
+};
+#define GET_POST_LOCAL_SLOT 5
+
+static const uint8_t setLocalTemplate[] = {
+	0xf3, 0x41, 0x0f, 0x6f, 0x45, 0xf0,     // movdqu xmm0, [r13 - 16]
+	0xf3, 0x0f, 0x7f, 0x83, 0, 0, 0, 0      // movdqu [rbx + slot], xmm0
+};
+#define SET_LOCAL_SLOT 10
+
+static const uint8_t setPostLocalTemplate[] = {
+	0xf3, 0x41, 0x0f, 0x6f, 0x45, 0xf0,         // movdqu xmm0, [r13 - 16]
+	0xf3, 0x41, 0x0f, 0x7f, 0x86, 0, 0, 0, 0    // movdqu [r14 + slot], xmm0
+};
+#define SET_POST_LOCAL_SLOT 11
+
+static const uint8_t popTemplate[] = {
+	0x49, 0x83, 0xed, 0x10                  // sub r13, 16
+};
+
+// Values are always written with a single 16 byte store, so that loading
+// them back as a whole does not stall on store forwarding
+
+static const uint8_t pushValueTemplate[] = {
+	0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rax, type
+	0x66, 0x48, 0x0f, 0x6e, 0xc0,           // movq xmm0, rax
+	0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rax, payload
+	0x66, 0x48, 0x0f, 0x6e, 0xc8,           // movq xmm1, rax
+	0x66, 0x0f, 0x6c, 0xc1,                 // punpcklqdq xmm0, xmm1
+	0xf3, 0x41, 0x0f, 0x7f, 0x45, 0x00,     // movdqu [r13], xmm0
+	0x49, 0x83, 0xc5, 0x10                  // add r13, 16
+};
+#define PUSH_VALUE_TYPE 2
+#define PUSH_VALUE_PAYLOAD 17
+
+static const uint8_t getGlobalTemplate[] = {
+	0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rax, &values
+	0x48, 0x8b, 0x00,                       // mov rax, [rax]
+	0x80, 0xb8, 0, 0, 0, 0, VAL_UNDEFINED,  // cmp byte [rax + index], VAL_UNDEFINED
+	0x0f, 0x84, 0, 0, 0, 0,                 // je exit
+	0xf3, 0x0f, 0x6f, 0x80, 0, 0, 0, 0,     // movdqu xmm0, [rax + index]
+	0xf3, 0x41, 0x0f, 0x7f, 0x45, 0x00,     // movdqu [r13], xmm0
+	0x49, 0x83, 0xc5, 0x10                  // add r13, 16
+};
+#define GET_GLOBAL_VALUES 2
+#define GET_GLOBAL_CHECK_INDEX 15
+#define GET_GLOBAL_EXIT 22
+#define GET_GLOBAL_INDEX 30
+
+static const uint8_t numberGuardsTemplate[] = {
+	0x41, 0x80, 0x7d, 0xe0, 0x00,           // cmp byte [r13 - 32], VAL_NUMBER
+	0x0f, 0x85, 0, 0, 0, 0,                 // jne exit
+	0x41, 0x80, 0x7d, 0xf0, 0x00,           // cmp byte [r13 - 16], VAL_NUMBER
+	0x0f, 0x85, 0, 0, 0, 0                  // jne exit
+};
+#define NUMBER_GUARD_EXIT1 7
+#define NUMBER_GUARD_EXIT2 18
+
+static const uint8_t arithmeticTemplate[] = {
+	0xf2, 0x41, 0x0f, 0x10, 0x45, 0xe8,     // movsd xmm0, [r13 - 24]
+	0xf2, 0x41, 0x0f, 0, 0x45, 0xf8,        // {add,sub,mul,div}sd xmm0, [r13 - 8]
+	0xf3, 0x0f, 0x7e, 0xc0,                 // movq xmm0, xmm0
+	0x66, 0x0f, 0x73, 0xf8, 0x08,           // pslldq xmm0, 8
+	0xf3, 0x41, 0x0f, 0x7f, 0x45, 0xe0,     // movdqu [r13 - 32], xmm0
+	0x49, 0x83, 0xed, 0x10                  // sub r13, 16
+};
+#define ARITHMETIC_OP 9
+
+static const uint8_t compareTemplate[] = {
+	0xf2, 0x41, 0x0f, 0x10, 0x45, 0,        // movsd xmm0, [r13 + lhs]
+	0x66, 0x41, 0x0f, 0x2e, 0x45, 0,        // ucomisd xmm0, [r13 + rhs]
+	0x0f, 0x97, 0xc0,                       // seta al
+	0x0f, 0xb6, 0xc0,                       // movzx eax, al
+	0x66, 0x48, 0x0f, 0x6e, 0xc0,           // movq xmm0, rax
+	0x66, 0x0f, 0x73, 0xf8, 0x08,           // pslldq xmm0, 8
+	0xb9, VAL_BOOL, 0, 0, 0,                // mov ecx, VAL_BOOL
+	0x66, 0x48, 0x0f, 0x6e, 0xc9,           // movq xmm1, rcx
+	0x66, 0x0f, 0xeb, 0xc1,                 // por xmm0, xmm1
+	0xf3, 0x41, 0x0f, 0x7f, 0x45, 0xe0,     // movdqu [r13 - 32], xmm0
+	0x49, 0x83, 0xed, 0x10                  // sub r13, 16
+};
+#define COMPARE_LHS 5
+#define COMPARE_RHS 11
+
+static const uint8_t jumpIfFalseTemplate[] = {
+	0x41, 0x8a, 0x45, 0xf0,                 // mov al, [r13 - 16]
+	0x3c, VAL_NIL,                          // cmp al, VAL_NIL
+	0x0f, 0x84, 0, 0, 0, 0,                 // je target
+	0x3c, VAL_BOOL,                         // cmp al, VAL_BOOL
+	0x75, 0x0b,                             // jne next
+	0x41, 0x80, 0x7d, 0xf8, 0x00,           // cmp byte [r13 - 8], 0
+	0x0f, 0x84, 0, 0, 0, 0                  // je target
+};
+#define JUMP_IF_FALSE_TARGET1 8
+#define JUMP_IF_FALSE_TARGET2 23
+
+static const uint8_t slotNumberGuardTemplate[] = {
+	0x80, 0xbb, 0, 0, 0, 0, 0x00,           // cmp byte [rbx + slot], VAL_NUMBER
+	0x0f, 0x85, 0, 0, 0, 0                  // jne exit
+};
+#define SLOT_GUARD_SLOT 2
+#define SLOT_GUARD_EXIT 9
+
+static const uint8_t postSlotNumberGuardTemplate[] = {
+	0x41, 0x80, 0xbe, 0, 0, 0, 0, 0x00,     // cmp byte [r14 + slot], VAL_NUMBER
+	0x0f, 0x85, 0, 0, 0, 0                  // jne exit
+};
+#define POST_SLOT_GUARD_SLOT 3
+#define POST_SLOT_GUARD_EXIT 10
+
+static const uint8_t loadSlotNumberTemplate[] = {
+	0xf2, 0x0f, 0x10, 0x83, 0, 0, 0, 0      // movsd xmm0, [rbx + slot + 8]
+};
+#define LOAD_SLOT_NUMBER_SLOT 4
+
+static const uint8_t loadPostSlotNumberTemplate[] = {
+	0xf2, 0x41, 0x0f, 0x10, 0x86, 0, 0, 0, 0    // movsd xmm0, [r14 + slot + 8]
+};
+#define LOAD_POST_SLOT_NUMBER_SLOT 5
+
+static const uint8_t slotArithmeticTemplate[] = {
+	0xf2, 0x0f, 0, 0x83, 0, 0, 0, 0         // {add,sub,mul}sd xmm0, [rbx + slot + 8]
+};
+#define SLOT_ARITHMETIC_OP 2
+#define SLOT_ARITHMETIC_SLOT 4
+
+static const uint8_t postSlotArithmeticTemplate[] = {
+	0xf2, 0x41, 0x0f, 0, 0x86, 0, 0, 0, 0       // {add,sub,mul}sd xmm0, [r14 + slot + 8]
+};
+#define POST_SLOT_ARITHMETIC_OP 3
+#define POST_SLOT_ARITHMETIC_SLOT 5
+
+static const uint8_t immArithmeticTemplate[] = {
+	0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0,     // mov rax, imm
+	0x66, 0x48, 0x0f, 0x6e, 0xc8,           // movq xmm1, rax
+	0xf2, 0x0f, 0, 0xc1                     // {add,sub,mul}sd xmm0, xmm1
+};
+#define IMM_ARITHMETIC_IMM 2
+#define IMM_ARITHMETIC_OP 17
+
+// Turn the double in xmm0 into a number value
+static const uint8_t boxNumberTemplate[] = {
+	0xf3, 0x0f, 0x7e, 0xc0,                 // movq xmm0, xmm0
+	0x66, 0x0f, 0x73, 0xf8, 0x08            // pslldq xmm0, 8
+};
+
+static const uint8_t pushNumberTemplate[] = {
+	0xf3, 0x41, 0x0f, 0x7f, 0x45, 0x00,     // movdqu [r13], xmm0
+	0x49, 0x83, 0xc5, 0x10                  // add r13, 16
+};
+
+static const uint8_t storeSlotNumberTemplate[] = {
+	0xf3, 0x0f, 0x7f, 0x83, 0, 0, 0, 0      // movdqu [rbx + slot], xmm0
+};
+#define STORE_SLOT_NUMBER 4
+
+static const uint8_t storePostSlotNumberTemplate[] = {
+	0xf3, 0x41, 0x0f, 0x7f, 0x86, 0, 0, 0, 0    // movdqu [r14 + slot], xmm0
+};
+#define STORE_POST_SLOT_NUMBER 5
+
+static const uint8_t jumpTemplate[] = {
+	0xe9, 0, 0, 0, 0                        // jmp target
+};
+
+static const uint8_t exitTemplate[] = {
+	0xb8, 0, 0, 0, 0,                       // mov eax, offset
+	0xe9, 0, 0, 0, 0                        // jmp epilogue
+};
+#define EXIT_OFFSET 1
+#define EXIT_EPILOGUE 6
+
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5c
+#define SSE_DIV 0x5e
+
+static int emitTemplate(JitBuffer *buf, const uint8_t *template, size_t size) {
+	int pos = buf->count;
+	memcpy(buf->code + pos, template, size);
+	buf->count += size;
+	return pos;
+}
+
+#define EMIT(buf, template) emitTemplate(buf, template, sizeof(template))
+
+static void patch32(JitBuffer *buf, int pos, int32_t val) {
+	memcpy(buf->code + pos, &val, sizeof(int32_t));
+}
+
+static void patch64(JitBuffer *buf, int pos, uint64_t val) {
+	memcpy(buf->code + pos, &val, sizeof(uint64_t));
+}
+
+static void addFixup(JitBuffer *buf, JitFixupType type, int pos, int offset) {
+	buf->fixups[buf->fixupCount++] = (JitFixup){ .type = type, .pos = pos, .offset = offset };
+}
+
+static int emitExit(JitBuffer *buf, int offset) {
+	int pos = EMIT(buf, exitTemplate);
+	patch32(buf, pos + EXIT_OFFSET, offset);
+	addFixup(buf, FIX_EPILOGUE, pos + EXIT_EPILOGUE, 0);
+	return pos;
+}
+
+static int32_t slotDisp(uint8_t slot) {
+	return (int32_t)slot * (int32_t)sizeof(Value);
+}
+
+static void emitPushValue(JitBuffer *buf, Value value) {
+	int pos = EMIT(buf, pushValueTemplate);
+	uint64_t payload;
+	memcpy(&payload, &value.as, sizeof(uint64_t));
+	patch64(buf, pos + PUSH_VALUE_TYPE, value.type);
+	patch64(buf, pos + PUSH_VALUE_PAYLOAD, payload);
+}
+
+static void emitPushNumber(JitBuffer *buf, double number) {
+	emitPushValue(buf, NUMBER_VAL(number));
+}
+
+static void emitGetGlobal(JitBuffer *buf, Value **values, uint16_t index, bool checkDefined,
+						  int offset) {
+	int pos = EMIT(buf, getGlobalTemplate);
+	patch64(buf, pos + GET_GLOBAL_VALUES, (uint64_t)(uintptr_t)values);
+	int32_t disp = (int32_t)index * (int32_t)sizeof(Value);
+	patch32(buf, pos + GET_GLOBAL_CHECK_INDEX, disp);
+	patch32(buf, pos + GET_GLOBAL_INDEX, disp);
+	if (checkDefined)
+		addFixup(buf, FIX_EXIT, pos + GET_GLOBAL_EXIT, offset);
+	else {
+		// builtins are always defined, turn the check into a no-op jump
+		patch32(buf, pos + GET_GLOBAL_EXIT, 0);
+	}
+}
+
+static void emitNumberGuards(JitBuffer *buf, int offset) {
+	int pos = EMIT(buf, numberGuardsTemplate);
+	addFixup(buf, FIX_EXIT, pos + NUMBER_GUARD_EXIT1, offset);
+	addFixup(buf, FIX_EXIT, pos + NUMBER_GUARD_EXIT2, offset);
+}
+
+static void emitGetLocal(JitBuffer *buf, uint8_t slot, uint8_t postArgs) {
+	if (postArgs) {
+		int pos = EMIT(buf, getPostLocalTemplate);
+		patch32(buf, pos + GET_POST_LOCAL_SLOT, slotDisp(slot));
+	} else {
+		int pos = EMIT(buf, getLocalTemplate);
+		patch32(buf, pos + GET_LOCAL_SLOT, slotDisp(slot));
+	}
+}
+
+static void emitSetLocal(JitBuffer *buf, uint8_t slot, uint8_t postArgs) {
+	if (postArgs) {
+		int pos = EMIT(buf, setPostLocalTemplate);
+		patch32(buf, pos + SET_POST_LOCAL_SLOT, slotDisp(slot));
+	} else {
+		int pos = EMIT(buf, setLocalTemplate);
+		patch32(buf, pos + SET_LOCAL_SLOT, slotDisp(slot));
+	}
+}
+
+static void emitSlotGuard(JitBuffer *buf, uint8_t slot, uint8_t postArgs, int offset) {
+	if (postArgs) {
+		int pos = EMIT(buf, postSlotNumberGuardTemplate);
+		patch32(buf, pos + POST_SLOT_GUARD_SLOT, slotDisp(slot));
+		addFixup(buf, FIX_EXIT, pos + POST_SLOT_GUARD_EXIT, offset);
+	} else {
+		int pos = EMIT(buf, slotNumberGuardTemplate);
+		patch32(buf, pos + SLOT_GUARD_SLOT, slotDisp(slot));
+		addFixup(buf, FIX_EXIT, pos + SLOT_GUARD_EXIT, offset);
+	}
+}
+
+static void emitLoadSlotNumber(JitBuffer *buf, uint8_t slot, uint8_t postArgs) {
+	if (postArgs) {
+		int pos = EMIT(buf, loadPostSlotNumberTemplate);
+		patch32(buf, pos + LOAD_POST_SLOT_NUMBER_SLOT, slotDisp(slot) + 8);
+	} else {
+		int pos = EMIT(buf, loadSlotNumberTemplate);
+		patch32(buf, pos + LOAD_SLOT_NUMBER_SLOT, slotDisp(slot) + 8);
+	}
+}
+
+static void emitSlotArithmetic(JitBuffer *buf, uint8_t sse, uint8_t slot, uint8_t postArgs) {
+	if (postArgs) {
+		int pos = EMIT(buf, postSlotArithmeticTemplate);
+		buf->code[pos + POST_SLOT_ARITHMETIC_OP] = sse;
+		patch32(buf, pos + POST_SLOT_ARITHMETIC_SLOT, slotDisp(slot) + 8);
+	} else {
+		int pos = EMIT(buf, slotArithmeticTemplate);
+		buf->code[pos + SLOT_ARITHMETIC_OP] = sse;
+		patch32(buf, pos + SLOT_ARITHMETIC_SLOT, slotDisp(slot) + 8);
+	}
+}
+
+static void emitRegisterResult(JitBuffer *buf, uint8_t dst, uint8_t dstPostArgs) {
+	EMIT(buf, boxNumberTemplate);
+	if (dst == REG_STACK)
+		EMIT(buf, pushNumberTemplate);
+	else if (dstPostArgs) {
+		int pos = EMIT(buf, storePostSlotNumberTemplate);
+		patch32(buf, pos + STORE_POST_SLOT_NUMBER, slotDisp(dst));
+	} else {
+		int pos = EMIT(buf, storeSlotNumberTemplate);
+		patch32(buf, pos + STORE_SLOT_NUMBER, slotDisp(dst));
+	}
+}
+
+static uint8_t sseOp(uint8_t op) {
+	switch (op) {
+		case OP_ADD:
+		case OP_REG_ADD:
+		case OP_REG_ADDI:
+			return SSE_ADD;
+		case OP_SUBTRACT:
+		case OP_REG_SUB:
+		case OP_REG_SUBI:
+			return SSE_SUB;
+		case OP_MULTIPLY:
+		case OP_REG_MUL:
+		case OP_REG_MULI:
+			return SSE_MUL;
+		case OP_DIVIDE:
+			return SSE_DIV;
+		default:
+			ELOX_UNREACHABLE();
+	}
+}
+
+// Returns false for instructions that are left to the interpreter
+static bool emitInstruction(VM *vm, JitBuffer *buf, Chunk *chunk, int offset, uint8_t op) {
+	uint8_t *operands = chunk->code + offset + 1;
+
+	switch (op) {
+		case OP_CONST8:
+			emitPushValue(buf, chunk->constants.values[operands[0]]);
+			break;
+		case OP_CONST16: {
+			uint16_t index;
+			memcpy(&index, operands, sizeof(uint16_t));
+			emitPushValue(buf, chunk->constants.values[index]);
+			break;
+		}
+		case OP_IMMI: {
+			int32_t val;
+			memcpy(&val, operands, sizeof(int32_t));
+			emitPushNumber(buf, val);
+			break;
+		}
+		case OP_NIL:
+			emitPushValue(buf, NIL_VAL);
+			break;
+		case OP_TRUE:
+			emitPushValue(buf, BOOL_VAL(true));
+			break;
+		case OP_FALSE:
+			emitPushValue(buf, BOOL_VAL(false));
+			break;
+		case OP_POP:
+			EMIT(buf, popTemplate);
+			break;
+		case OP_GET_LOCAL:
+			emitGetLocal(buf, operands[0], operands[1]);
+			break;
+		case OP_SET_LOCAL:
+			emitSetLocal(buf, operands[0], operands[1]);
+			break;
+		case OP_GET_GLOBAL:
+		case OP_GET_BUILTIN: {
+			uint16_t index;
+			memcpy(&index, operands, sizeof(uint16_t));
+			if (op == OP_GET_GLOBAL)
+				emitGetGlobal(buf, &vm->globalValues.values, index, true, offset);
+			else
+				emitGetGlobal(buf, &vm->builtinValues.values, index, false, offset);
+			break;
+		}
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE: {
+			emitNumberGuards(buf, offset);
+			int pos = EMIT(buf, arithmeticTemplate);
+			buf->code[pos + ARITHMETIC_OP] = sseOp(op);
+			break;
+		}
+		case OP_LESS:
+		case OP_GREATER: {
+			emitNumberGuards(buf, offset);
+			int pos = EMIT(buf, compareTemplate);
+			// a < b is computed as b > a, so both are false for NaN
+			buf->code[pos + COMPARE_LHS] = (op == OP_LESS) ? 0xf8 : 0xe8;
+			buf->code[pos + COMPARE_RHS] = (op == OP_LESS) ? 0xe8 : 0xf8;
+			break;
+		}
+		case OP_JUMP:
+		case OP_LOOP: {
+			uint16_t jump;
+			memcpy(&jump, operands, sizeof(uint16_t));
+			int target = (op == OP_JUMP) ? offset + 3 + jump : offset + 3 - jump;
+			int pos = EMIT(buf, jumpTemplate);
+			addFixup(buf, FIX_TARGET, pos + 1, target);
+			break;
+		}
+		case OP_JUMP_IF_FALSE: {
+			uint16_t jump;
+			memcpy(&jump, operands, sizeof(uint16_t));
+			int target = offset + 3 + jump;
+			int pos = EMIT(buf, jumpIfFalseTemplate);
+			addFixup(buf, FIX_TARGET, pos + JUMP_IF_FALSE_TARGET1, target);
+			addFixup(buf, FIX_TARGET, pos + JUMP_IF_FALSE_TARGET2, target);
+			break;
+		}
+		case OP_REG_ADD:
+		case OP_REG_SUB:
+		case OP_REG_MUL: {
+			uint8_t a = operands[2];
+			uint8_t aPost = operands[3];
+			uint8_t b = operands[4];
+			uint8_t bPost = operands[5];
+			emitSlotGuard(buf, a, aPost, offset);
+			emitSlotGuard(buf, b, bPost, offset);
+			emitLoadSlotNumber(buf, a, aPost);
+			emitSlotArithmetic(buf, sseOp(op), b, bPost);
+			emitRegisterResult(buf, operands[0], operands[1]);
+			break;
+		}
+		case OP_REG_ADDI:
+		case OP_REG_SUBI:
+		case OP_REG_MULI: {
+			uint8_t a = operands[2];
+			uint8_t aPost = operands[3];
+			int32_t imm;
+			memcpy(&imm, operands + 4, sizeof(int32_t));
+			emitSlotGuard(buf, a, aPost, offset);
+			emitLoadSlotNumber(buf, a, aPost);
+			int pos = EMIT(buf, immArithmeticTemplate);
+			double immVal = imm;
+			uint64_t immBits;
+			memcpy(&immBits, &immVal, sizeof(uint64_t));
+			patch64(buf, pos + IMM_ARITHMETIC_IMM, immBits);
+			buf->code[pos + IMM_ARITHMETIC_OP] = sseOp(op);
+			emitRegisterResult(buf, operands[0], operands[1]);
+			break;
+		}
+		default:
+			return false;
+	}
+	return true;
+}
+
+static bool worthEntering(Chunk *chunk, uint32_t *entries, int offset) {
+	for (int i = 0; i < JIT_MIN_RUN; i++) {
+		if ((offset >= chunk->count) || (entries[offset] == 0))
+			return false;
+		uint8_t op = genericOpcode(chunk->code[offset]);
+		if ((op == OP_JUMP) || (op == OP_LOOP))
+			return true;
+		offset += instructionLength(chunk, offset);
+	}
+	return true;
+}
+
+void jitCompile(RunCtx *runCtx, ObjFunction *function) {
+	VM *vm = runCtx->vm;
+	VMEnv *env = runCtx->vmEnv;
+	Chunk *chunk = &function->chunk;
+
+	JitBuffer buf = { 0 };
+	JitCode *jit = NULL;
+	size_t codeSize = (size_t)chunk->count * JIT_BYTES_PER_OP + sizeof(prologueTemplate) +
+					  sizeof(epilogueTemplate);
+	buf.code = env->realloc(NULL, codeSize, env->allocatorUserData);
+	buf.fixups = env->realloc(NULL, sizeof(JitFixup) * chunk->count * JIT_FIXUPS_PER_OP,
+							  env->allocatorUserData);
+	buf.entries = env->realloc(NULL, sizeof(uint32_t) * chunk->count, env->allocatorUserData);
+	buf.exits = env->realloc(NULL, sizeof(int) * chunk->count, env->allocatorUserData);
+	if (ELOX_UNLIKELY((buf.code == NULL) || (buf.fixups == NULL) ||
+					  (buf.entries == NULL) || (buf.exits == NULL)))
+		goto cleanup;
+	memset(buf.entries, 0, sizeof(uint32_t) * chunk->count);
+	for (int i = 0; i < chunk->count; i++)
+		buf.exits[i] = -1;
+
+	EMIT(&buf, prologueTemplate);
+
+	for (int offset = 0; offset < chunk->count; ) {
+		uint8_t op = genericOpcode(chunk->code[offset]);
+		int length = instructionLength(chunk, offset);
+		if (length < 0)
+			goto cleanup;
+		int pos = buf.count;
+		if (emitInstruction(vm, &buf, chunk, offset, op))
+			buf.entries[offset] = pos;
+		else
+			buf.exits[offset] = emitExit(&buf, offset);
+		offset += length;
+	}
+
+	int epilogue = EMIT(&buf, epilogueTemplate);
+
+	for (int i = 0; i < buf.fixupCount; i++) {
+		JitFixup *fixup = &buf.fixups[i];
+		int target = 0;
+		switch (fixup->type) {
+			case FIX_TARGET:
+				if (fixup->offset >= chunk->count)
+					goto cleanup;
+				if (buf.entries[fixup->offset] != 0)
+					target = buf.entries[fixup->offset];
+				else if (buf.exits[fixup->offset] >= 0)
+					target = buf.exits[fixup->offset];
+				else
+					goto cleanup;
+				break;
+			case FIX_EXIT:
+				if (buf.exits[fixup->offset] < 0) {
+					buf.exits[fixup->offset] = buf.count;
+					int pos = EMIT(&buf, exitTemplate);
+					patch32(&buf, pos + EXIT_OFFSET, fixup->offset);
+					patch32(&buf, pos + EXIT_EPILOGUE, epilogue - (pos + EXIT_EPILOGUE + 4));
+				}
+				target = buf.exits[fixup->offset];
+				break;
+			case FIX_EPILOGUE:
+				target = epilogue;
+				break;
+		}
+		patch32(&buf, fixup->pos, target - (fixup->pos + 4));
+	}
+
+	// Native code still jumps to every instruction it compiled, but the
+	// interpreter only enters it where a few of them run in a row
+	for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+		if (!worthEntering(chunk, buf.entries, offset))
+			buf.entries[offset] = 0;
+	}
+
+	jit = env->realloc(NULL, sizeof(JitCode), env->allocatorUserData);
+	if (ELOX_UNLIKELY(jit == NULL))
+		goto cleanup;
+	void *code = mmap(NULL, buf.count, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ELOX_UNLIKELY(code == MAP_FAILED))
+		goto cleanup;
+	memcpy(code, buf.code, buf.count);
+	if (ELOX_UNLIKELY(mprotect(code, buf.count, PROT_READ | PROT_EXEC) != 0)) {
+		munmap(code, buf.count);
+		goto cleanup;
+	}
+
+	jit->code = code;
+	jit->size = buf.count;
+	jit->entries = buf.entries;
+	jit->entryCount = chunk->count;
+	buf.entries = NULL;
+	function->jitCode = jit;
+	jit = NULL;
+
+cleanup:
+	env->free(jit, env->allocatorUserData);
+	env->free(buf.code, env->allocatorUserData);
+	env->free(buf.fixups, env->allocatorUserData);
+	env->free(buf.entries, env->allocatorUserData);
+	env->free(buf.exits, env->allocatorUserData);
+}
+
+uint8_t *jitExecute(RunCtx *runCtx, CallFrame *frame, uint8_t *ip) {
+	FiberCtx *fiber = runCtx->activeFiber;
+	ObjFunction *function = frame->function;
+	JitCode *jit = function->jitCode;
+	uint8_t *code = function->chunk.code;
+
+	uint32_t target = jit->entries[ip - code];
+	if (target == 0)
+		return ip;
+
+	JitEntry entry = (JitEntry)(void *)jit->code;
+	uint32_t resume = entry(frame->slots, frame->slots + frame->varArgs, &fiber->stackTop,
+							jit->code + target);
+	return code + resume;
+}
+
+void jitFree(RunCtx *runCtx, ObjFunction *function) {
+	VMEnv *env = runCtx->vmEnv;
+	JitCode *jit = function->jitCode;
+
+	if (jit == NULL)
+		return;
+
+	munmap(jit->code, jit->size);
+	env->free(jit->entries, env->allocatorUserData);
+	env->free(jit, env->allocatorUserData);
+	function->jitCode = NULL;
+}
+
+#endif // ELOX_ENABLE_JIT
@@ -12,9 +12,12 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include <elox/elox-internal.h>
 #include <elox/value.h>
+#include <elox/image.h>
 #include <elox/builtins/string.h>
 
 #if defined(ELOX_CONFIG_WIN32)
@@ -223,15 +226,73 @@ cleanup:
 	return ret;
 }
 
-Value eloxFileModuleLoader(RunCtx *runCtx, const String *moduleName, uint64_t options ELOX_UNUSED,
-						   EloxError *error) {
+// Images are matched by contents, timestamps miss edits within their resolution.
+// The file name ends up in the compiled code, so it is part of the key
+static ImageSourceKey imageSourceKey(const uint8_t *source, const String *fileName) {
+	size_t sourceLen = strlen((const char *)source);
+	return (ImageSourceKey){
+		.size = sourceLen,
+		.hash = imageHash(imageHash(ELOX_IMAGE_HASH_SEED, source, sourceLen),
+						  fileName->chars, fileName->length)
+	};
+}
+
+// Loads a module from imagePath if the image matches key, otherwise compiles
+// it from source and, if requested, writes a new image. imagePath can be NULL
+// to always compile
+static Value loadScriptModule(RunCtx *runCtx, const String *moduleName, const char *sourcePath,
+							  const uint8_t *source, const char *imagePath,
+							  const ImageSourceKey *key, bool writeImages, EloxError *error) {
 	FiberCtx *fiber = runCtx->activeFiber;
 
+	if (imagePath != NULL) {
+		EloxError imageError = ELOX_ERROR_INITIALIZER;
+		ObjFunction *function = loadImage(runCtx, imagePath, key, &imageError);
+		if (function != NULL)
+			return OBJ_VAL(function);
+		// corrupt images are recompiled like stale ones
+		if (imageError.raised)
+			pop(fiber); // discard error
+	}
+
+	Value ret = NIL_VAL;
+	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
+
+	String fileName = eloxBasename(sourcePath);
+
+	ObjFunction *function = compile(runCtx, (uint8_t *)source, &fileName, moduleName);
+	if (function == NULL) {
+		runtimeError(runCtx, "Could not compile module '%s'", moduleName->chars);
+		error->raised = true;
+		goto cleanup;
+	}
+	ret = OBJ_VAL(function);
+
+	if ((imagePath != NULL) && writeImages) {
+		PUSH_TEMP(temps, protectedFunction, ret);
+		// best effort, the module still loads from source if the image cannot be written
+		writeImage(runCtx, function, key, imagePath);
+	}
+
+cleanup:
+	releaseTemps(&temps);
+
+	return ret;
+}
+
+static Value findModuleSource(RunCtx *runCtx, const String *moduleName, EloxError *error) {
 	const char *modulePath = getenv("ELOX_LIBRARY_PATH");
 	if (modulePath == NULL)
 		modulePath = "?.elox";
 
-	Value moduleFile = searchPath(runCtx, moduleName, modulePath, error);
+	return searchPath(runCtx, moduleName, modulePath, error);
+}
+
+Value eloxFileModuleLoader(RunCtx *runCtx, const String *moduleName, uint64_t options,
+						   EloxError *error) {
+	FiberCtx *fiber = runCtx->activeFiber;
+
+	Value moduleFile = findModuleSource(runCtx, moduleName, error);
 	if (ELOX_UNLIKELY(error->raised))
 		return NIL_VAL;
 	if (IS_NIL(moduleFile))
@@ -239,22 +300,68 @@ Value eloxFileModuleLoader(RunCtx *runCtx, const String *moduleName, uint64_t op
 
 	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
 	PUSH_TEMP(temps, protectedFile, moduleFile);
-	ObjString *filePath = AS_STRING(moduleFile);
+	const char *sourcePath = AS_CSTRING(moduleFile);
 
 	Value ret = NIL_VAL;
-	uint8_t *source = loadFile(runCtx, (const char *)filePath->string.chars, error);
+
+	uint8_t *source = loadFile(runCtx, sourcePath, error);
 	if (ELOX_UNLIKELY(error->raised))
 		goto cleanup;
 
-	String fileName = eloxBasename((const char *)filePath->string.chars);
+	String fileName = eloxBasename(sourcePath);
+	ImageSourceKey key = imageSourceKey(source, &fileName);
 
-	ObjFunction *function = compile(runCtx, source, &fileName, moduleName);
-	if (function == NULL) {
-		runtimeError(runCtx, "Could not compile module '%s'", moduleName->chars);
-		error->raised = true;
+	char imagePath[1024];
+	int imagePathLen = snprintf(imagePath, sizeof(imagePath), "%s" ELOX_IMAGE_EXT, sourcePath);
+	bool useImage = (imagePathLen > 0) && ((size_t)imagePathLen < sizeof(imagePath));
+
+	ret = loadScriptModule(runCtx, moduleName, sourcePath, source,
+						   useImage ? imagePath : NULL, &key,
+						   (options & ELOX_FML_WRITE_IMAGES) != 0, error);
+
+cleanup:
+	if (source != NULL)
+		FREE(runCtx, char, source);
+	releaseTemps(&temps);
+
+	return ret;
+}
+
+Value eloxCachingModuleLoader(RunCtx *runCtx, const String *moduleName, uint64_t options,
+							  EloxError *error) {
+	FiberCtx *fiber = runCtx->activeFiber;
+	const char *cacheDir = runCtx->vmEnv->moduleCacheDir;
+
+	Value moduleFile = findModuleSource(runCtx, moduleName, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return NIL_VAL;
+	if (IS_NIL(moduleFile))
+		return NIL_VAL;
+
+	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
+	PUSH_TEMP(temps, protectedFile, moduleFile);
+	const char *sourcePath = AS_CSTRING(moduleFile);
+
+	Value ret = NIL_VAL;
+
+	uint8_t *source = loadFile(runCtx, sourcePath, error);
+	if (ELOX_UNLIKELY(error->raised))
 		goto cleanup;
+
+	String fileName = eloxBasename(sourcePath);
+	ImageSourceKey key = imageSourceKey(source, &fileName);
+
+	char imagePath[1024];
+	bool useCache = false;
+	if (cacheDir != NULL) {
+		int imagePathLen = snprintf(imagePath, sizeof(imagePath), "%s/%.*s-%016" PRIx64 ".elox" ELOX_IMAGE_EXT,
+									cacheDir, moduleName->length, (const char *)moduleName->chars, key.hash);
+		useCache = (imagePathLen > 0) && ((size_t)imagePathLen < sizeof(imagePath));
 	}
-	ret = OBJ_VAL(function);
+
+	ret = loadScriptModule(runCtx, moduleName, sourcePath, source,
+						   useCache ? imagePath : NULL, &key,
+						   (options & ELOX_CML_READ_ONLY) == 0, error);
 
 cleanup:
 	if (source != NULL)
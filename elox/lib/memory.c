@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "elox/compiler.h"
 #include "elox/memory.h"
@@ -14,20 +15,35 @@
 #endif
 
 #define GC_HEAP_GROW_FACTOR 2
+// minimum amount of allocation between two minor collections
+#define GC_MIN_NURSERY_SIZE (256 * 1024)
+// nursery budget, as a fraction of the bytes surviving the last collection
+#define GC_NURSERY_RATIO 4
+#define GC_MIN_FULL_THRESHOLD (4 * 1024 * 1024)
+// amount of allocation between two incremental marking steps
+#define GC_INCREMENTAL_STEP_SIZE (64 * 1024)
+// number of objects traced between two clock checks
+#define GC_CLOCK_CHECK_INTERVAL 64
+// number of old objects swept for each object allocation
+#define GC_LAZY_SWEEP_STEP 64
+
+static inline void checkGC(RunCtx *runCtx) {
+#ifdef ELOX_DEBUG_STRESS_GC
+	collectGarbage(runCtx);
+#else
+	VM *vm = runCtx->vm;
+	if (vm->bytesAllocated > vm->nextGC)
+		collectGarbage(runCtx);
+#endif
+}
 
 void *reallocate(RunCtx *runCtx, void *pointer, size_t oldSize, size_t newSize) {
 	VM *vm = runCtx->vm;
 	VMEnv *env = runCtx->vmEnv;
 
 	vm->bytesAllocated += newSize - oldSize;
-	if (newSize > oldSize) {
-#ifdef ELOX_DEBUG_STRESS_GC
-		collectGarbage(runCtx);
-#else
-		if (vm->bytesAllocated > vm->nextGC)
-			collectGarbage(runCtx);
-#endif
-	}
+	if (newSize > oldSize)
+		checkGC(runCtx);
 
 	if (newSize == 0) {
 		env->free(pointer, env->allocatorUserData);
@@ -38,14 +54,65 @@ void *reallocate(RunCtx *runCtx, void *pointer, size_t oldSize, size_t newSize)
 	return result;
 }
 
+static void sweepOld(RunCtx *runCtx, size_t maxObjects);
+
+void *allocateObjectMemory(RunCtx *runCtx, size_t size) {
+	VM *vm = runCtx->vm;
+
+	if (ELOX_UNLIKELY(vm->sweepList != NULL))
+		sweepOld(runCtx, GC_LAZY_SWEEP_STEP);
+
+	if (!slabFits(size))
+		return reallocate(runCtx, NULL, 0, size);
+
+	vm->bytesAllocated += size;
+	checkGC(runCtx);
+
+	return slabAlloc(runCtx->vmEnv, &vm->objectSlab, size);
+}
+
+void freeObjectMemory(RunCtx *runCtx, void *pointer, size_t size) {
+	if (!slabFits(size)) {
+		reallocate(runCtx, pointer, size, 0);
+		return;
+	}
+
+	VM *vm = runCtx->vm;
+
+	vm->bytesAllocated -= size;
+	slabFree(&vm->objectSlab, pointer, size);
+}
+
+static void pushGray(RunCtx *runCtx, Obj *object);
+static void pushMark(RunCtx *runCtx, Obj *object);
+
 void markObject(RunCtx *runCtx, Obj *object) {
 	if (object == NULL)
 		return;
-	if (object->markers & MARKER_BLACK)
-		return;
 
 	VM *vm = runCtx->vm;
 
+	uint8_t markers = object->markers;
+	// object will still be in the nursery after this collection
+	if (!(markers & (MARKER_OLD | MARKER_SURVIVOR)))
+		vm->youngRefSeen = true;
+	if (markers & MARKER_BLACK)
+		return;
+	if (markers & MARKER_OLD) {
+		if (vm->gcPhase == GC_PHASE_MARK) {
+			// traced later, by an incremental step
+			object->markers |= (MARKER_BLACK | MARKER_GRAY);
+			pushMark(runCtx, object);
+			return;
+		}
+		// minor collections assume that all old objects are alive
+		if (!vm->fullGC)
+			return;
+	} else if (vm->markingOld) {
+		// the nursery is left to the minor collections
+		return;
+	}
+
 #ifdef ELOX_DEBUG_LOG_GC
 	eloxPrintf(vmCtx, ELOX_IO_DEBUG, "%p mark ", (void *)object);
 	printValue(vmCtx, ELOX_IO_DEBUG, OBJ_VAL(object));
@@ -53,6 +120,12 @@ void markObject(RunCtx *runCtx, Obj *object) {
 #endif
 
 	object->markers |= (MARKER_BLACK | MARKER_GRAY);
+	pushGray(runCtx, object);
+}
+
+static void pushGray(RunCtx *runCtx, Obj *object) {
+	VM *vm = runCtx->vm;
+	VMEnv *env = runCtx->vmEnv;
 
 #ifdef ELOX_DEBUG_FORCE_SLOW_GC
 	vm->grayOverflow = true;
@@ -61,8 +134,6 @@ void markObject(RunCtx *runCtx, Obj *object) {
 	if (ELOX_UNLIKELY(vm->grayOverflow))
 		return;
 
-	VMEnv *env = runCtx->vmEnv;
-
 	if (vm->grayCapacity < vm->grayCount + 1) {
 		int newGrayCapacity = GROW_CAPACITY(vm->grayCapacity);
 		Obj **oldStack = vm->grayStack;
@@ -80,6 +151,84 @@ void markObject(RunCtx *runCtx, Obj *object) {
 	vm->grayStack[vm->grayCount++] = object;
 }
 
+static void pushMark(RunCtx *runCtx, Obj *object) {
+	VM *vm = runCtx->vm;
+	VMEnv *env = runCtx->vmEnv;
+
+	if (ELOX_UNLIKELY(vm->markOverflow))
+		return;
+
+	if (vm->markCapacity < vm->markCount + 1) {
+		int newCapacity = GROW_CAPACITY(vm->markCapacity);
+		Obj **newStack = (Obj **)env->realloc(vm->markStack,
+											  sizeof(Obj *) * newCapacity,
+											  env->allocatorUserData);
+		if (ELOX_UNLIKELY(newStack == NULL)) {
+			// incremental marking is abandoned at the next step
+			vm->markOverflow = true;
+			return;
+		}
+		vm->markStack = newStack;
+		vm->markCapacity = newCapacity;
+	}
+
+	vm->markStack[vm->markCount++] = object;
+}
+
+static void rememberObject(RunCtx *runCtx, Obj *object) {
+	VM *vm = runCtx->vm;
+	VMEnv *env = runCtx->vmEnv;
+
+	if (object->markers & MARKER_REMEMBERED)
+		return;
+
+	if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+		int newCapacity = GROW_CAPACITY(vm->rememberedCapacity);
+		Obj **newSet = (Obj **)env->realloc(vm->rememberedSet,
+											sizeof(Obj *) * newCapacity,
+											env->allocatorUserData);
+		if (ELOX_UNLIKELY(newSet == NULL)) {
+			// can't track it, fall back to a full collection next time
+			vm->rememberedOverflow = true;
+			return;
+		}
+		vm->rememberedSet = newSet;
+		vm->rememberedCapacity = newCapacity;
+	}
+
+	object->markers |= MARKER_REMEMBERED;
+	vm->rememberedSet[vm->rememberedCount++] = object;
+}
+
+// Code and metadata objects are mutated from too many places (compiler, class
+// setup) to carry write barriers, so once old they are rescanned on every
+// minor collection. This also makes incremental marking see their updates
+static bool isAlwaysRemembered(ObjType type) {
+	switch (type) {
+		case OBJ_INTERFACE:
+		case OBJ_CLASS:
+		case OBJ_FUNCTION:
+		case OBJ_NATIVE:
+		case OBJ_NATIVE_CLOSURE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void gcWriteBarrierSlow(RunCtx *runCtx, Obj *object) {
+	VM *vm = runCtx->vm;
+
+	uint8_t markers = object->markers;
+	if ((markers & (MARKER_OLD | MARKER_REMEMBERED)) == MARKER_OLD)
+		rememberObject(runCtx, object);
+	if ((vm->gcPhase == GC_PHASE_MARK) && ((markers & (MARKER_BLACK | MARKER_GRAY)) == MARKER_BLACK)) {
+		// already traced, trace again before marking ends
+		object->markers |= MARKER_GRAY;
+		pushMark(runCtx, object);
+	}
+}
+
 void markValue(RunCtx *runCtx, Value value) {
 	if (IS_OBJ(value))
 		markObject(runCtx, AS_OBJ(value));
@@ -134,7 +283,8 @@ static void blackenObject(RunCtx *runCtx, Obj *object) {
 			ObjKlass *klass = (ObjKlass *)object;
 			markObject(runCtx, (Obj *)klass->name);
 			ObjClass *clazz = (ObjClass *)object;
-			markTable(runCtx, &clazz->fields);
+			if (clazz->shape != NULL)
+				markShape(runCtx, clazz->shape);
 			markTable(runCtx, &clazz->methods);
 			markTable(runCtx, &clazz->statics);
 			markArray(runCtx, &clazz->staticValues);
@@ -171,6 +321,11 @@ static void blackenObject(RunCtx *runCtx, Obj *object) {
 #endif
 			markArray(runCtx, &function->chunk.constants);
 			markObject(runCtx, (Obj *)function->chunk.fileName);
+			for (int i = 0; i < function->chunk.icCount; i++) {
+				InlineCache *cache = &function->chunk.inlineCaches[i];
+				for (int j = 0; j < ELOX_IC_WAYS; j++)
+					markObject(runCtx, (Obj *)cache->entries[j].clazz);
+			}
 			if (function->defaultArgs != NULL) {
 				for (int i = 0; i < function->arity; i++)
 					markValue(runCtx, function->defaultArgs[i]);
@@ -180,7 +335,8 @@ static void blackenObject(RunCtx *runCtx, Obj *object) {
 		case OBJ_INSTANCE: {
 			ObjInstance *instance = (ObjInstance *)object;
 			markObject(runCtx, (Obj *)instance->clazz);
-			markArray(runCtx, &instance->fields);
+			for (uint32_t i = 0; i < instance->fieldCount; i++)
+				markValue(runCtx, instance->fields[i]);
 			break;
 		}
 		case OBJ_UPVALUE:
@@ -198,11 +354,31 @@ static void blackenObject(RunCtx *runCtx, Obj *object) {
 			}
 			break;
 		}
-		case OBJ_STRING:
+		case OBJ_STRING: {
+			uint8_t flags = ((ObjString *)object)->flags;
+			if (flags & STRING_ROPE) {
+				markObject(runCtx, (Obj *)((ObjRope *)object)->left);
+				markObject(runCtx, (Obj *)((ObjRope *)object)->right);
+			} else if (flags & STRING_VIEW)
+				markObject(runCtx, (Obj *)((ObjStringView *)object)->parent);
 			break;
+		}
 	}
 }
 
+static void traceObject(RunCtx *runCtx, Obj *object) {
+	VM *vm = runCtx->vm;
+
+	vm->youngRefSeen = false;
+	blackenObject(runCtx, object);
+	uint8_t markers = object->markers;
+	// old (or about to be promoted) objects still pointing into the nursery
+	if (vm->youngRefSeen && (markers & (MARKER_OLD | MARKER_SURVIVOR)))
+		rememberObject(runCtx, object);
+	else if (vm->fullGC && (markers & MARKER_OLD) && isAlwaysRemembered(object->type))
+		rememberObject(runCtx, object);
+}
+
 static void freeObject(RunCtx *runCtx, Obj *object) {
 //#if defined(ELOX_DEBUG_LOG_GC) || defined(ELOX_DEBUG_TRACE_EXECUTION)
 #ifdef ELOX_DEBUG_LOG_GC
@@ -216,85 +392,102 @@ static void freeObject(RunCtx *runCtx, Obj *object) {
 		case OBJ_HASHMAP: {
 			ObjHashMap *map = (ObjHashMap *)object;
 			freeValueTable(runCtx, &map->items);
-			FREE(runCtx, ObjHashMap, object);
+			FREE_OBJ(runCtx, ObjHashMap, object);
 			break;
 		}
 		case OBJ_TUPLE:
 		case OBJ_ARRAY: {
 			ObjArray *array = (ObjArray *)object;
 			FREE_ARRAY(runCtx, Value *, array->items, array->size);
-			FREE(runCtx, ObjArray, object);
+			FREE_OBJ(runCtx, ObjArray, object);
 			break;
 		}
 		case OBJ_BOUND_METHOD:
-			FREE(runCtx, ObjBoundMethod, object);
+			FREE_OBJ(runCtx, ObjBoundMethod, object);
 			break;
 		case OBJ_METHOD:
-			FREE(runCtx, ObjMethod, object);
+			FREE_OBJ(runCtx, ObjMethod, object);
 			break;
 		case OBJ_METHOD_DESC:
-			FREE(runCtx, ObjMethodDesc, object);
+			FREE_OBJ(runCtx, ObjMethodDesc, object);
 			break;
 		case OBJ_INTERFACE: {
 			ObjInterface *intf = (ObjInterface *)object;
 			freeTable(runCtx, &intf->methods);
-			FREE(runCtx, ObjInterface, object);
+			FREE_OBJ(runCtx, ObjInterface, object);
 			break;
 		}
 		case OBJ_CLASS: {
 			ObjClass *clazz = (ObjClass *)object;
-			freeTable(runCtx, &clazz->fields);
+			releaseShape(runCtx, clazz->shape);
 			freeTable(runCtx, &clazz->methods);
 			freeTable(runCtx, &clazz->statics);
 			freeValueArray(runCtx, &clazz->staticValues);
 			FREE_ARRAY(runCtx, MemberRef, clazz->memberRefs, clazz->memberRefCount);
 			if (clazz->typeInfo.rssList != NULL)
 				FREE_ARRAY(runCtx, Obj *, clazz->typeInfo.rssList, clazz->typeInfo.numRss);
-			FREE(runCtx, ObjClass, object);
+			FREE_OBJ(runCtx, ObjClass, object);
 			break;
 		}
 		case OBJ_CLOSURE: {
 			ObjClosure *closure = (ObjClosure *)object;
 			FREE_ARRAY(runCtx, ObjUpvalue *, closure->upvalues, closure->upvalueCount);
-			FREE(runCtx, ObjClosure, object);
+			FREE_OBJ(runCtx, ObjClosure, object);
 			break;
 		}
 		case OBJ_NATIVE_CLOSURE: {
 			ObjNativeClosure *closure = (ObjNativeClosure *)object;
 			FREE_ARRAY(runCtx, Value, closure->upvalues, closure->upvalueCount);
-			FREE(runCtx, ObjNativeClosure, object);
+			FREE_OBJ(runCtx, ObjNativeClosure, object);
 			break;
 		}
 		case OBJ_FUNCTION: {
 			ObjFunction *function = (ObjFunction *)object;
+#ifdef ELOX_ENABLE_JIT
+			jitFree(runCtx, function);
+#endif
 			freeChunk(runCtx, &function->chunk);
 			FREE_ARRAY(runCtx, Value, function->defaultArgs, function->arity);
-			FREE(runCtx, ObjFunction, object);
+			FREE_OBJ(runCtx, ObjFunction, object);
 			break;
 		}
 		case OBJ_INSTANCE: {
 			ObjInstance *instance = (ObjInstance *)object;
-			freeValueArray(runCtx, &instance->fields);
-			FREE(runCtx, ObjInstance, object);
+			freeObjectMemory(runCtx, object, instanceSize(instance->fieldCount));
 			break;
 		}
 		case OBJ_NATIVE: {
 			ObjNative *native = (ObjNative *)object;
 			FREE_ARRAY(runCtx, Value, native->defaultArgs, native->arity);
-			FREE(runCtx, ObjNative, object);
+			FREE_OBJ(runCtx, ObjNative, object);
 			break;
 		}
 		case OBJ_STRING: {
 			ObjString *string = (ObjString *)object;
-			FREE_ARRAY(runCtx, char, ELOX_UNCONST(string->string.chars), string->string.length + 1);
-			FREE(runCtx, ObjString, object);
+			if (string->flags & STRING_INLINE) {
+				freeObjectMemory(runCtx, object, inlineStringSize(string->string.length));
+				break;
+			}
+			if (string->flags & STRING_VIEW) {
+				// bytes are owned only once the view was terminated
+				if (((ObjStringView *)string)->parent == NULL)
+					FREE_ARRAY(runCtx, char, ELOX_UNCONST(string->string.chars), string->string.length + 1);
+				FREE_OBJ(runCtx, ObjStringView, object);
+				break;
+			}
+			if (string->string.chars != NULL)
+				FREE_ARRAY(runCtx, char, ELOX_UNCONST(string->string.chars), string->string.length + 1);
+			if (string->flags & STRING_ROPE)
+				FREE_OBJ(runCtx, ObjRope, object);
+			else
+				FREE_OBJ(runCtx, ObjString, object);
 			break;
 		}
 		case OBJ_STRINGPAIR:
-			FREE(runCtx, ObjStringPair, object);
+			FREE_OBJ(runCtx, ObjStringPair, object);
 			break;
 		case OBJ_UPVALUE:
-			FREE(runCtx, ObjUpvalue, object);
+			FREE_OBJ(runCtx, ObjUpvalue, object);
 			break;
 	}
 }
@@ -306,28 +499,62 @@ static void markRoots(RunCtx *runCtx) {
 	markValueTable(runCtx, &vm->globalNames);
 	markArray(runCtx, &vm->globalValues);
 	markCompilerRoots(runCtx);
+	markProgramCache(runCtx, &vm->patternCache);
+	markProgramCache(runCtx, &vm->fmtCache);
 
 	markHandleSet(&vm->handles);
 }
 
+static bool traceGrayObjects(RunCtx *runCtx, Obj *object) {
+	bool haveGray = false;
+	while (object != NULL) {
+		if (object->markers & MARKER_GRAY) {
+			haveGray = true;
+			object->markers &= ~MARKER_GRAY;
+			traceObject(runCtx, object);
+		}
+		object = object->next;
+	}
+	return haveGray;
+}
+
 static void slowTraceReferences(RunCtx *runCtx) {
 	VM *vm = runCtx->vm;
 
 	bool haveGray;
 	do {
-		haveGray = false;
-		Obj *object = vm->mainHeap.objects;
-		while (object != NULL) {
-			if (object->markers & MARKER_GRAY) {
-				haveGray = true;
-				object->markers &= ~MARKER_GRAY;
-				blackenObject(runCtx, object);
-			}
-			object = object->next;
-		}
+		haveGray = traceGrayObjects(runCtx, vm->mainHeap.objects);
+		if (vm->fullGC)
+			haveGray |= traceGrayObjects(runCtx, vm->oldHeap.objects);
 	} while (haveGray);
 }
 
+static void traceRemembered(RunCtx *runCtx) {
+	VM *vm = runCtx->vm;
+
+	// compact the set in place, keeping only the objects that still point
+	// into the nursery. Nothing is appended while this runs, blackening
+	// only pushes onto the gray stack
+	int kept = 0;
+	for (int i = 0; i < vm->rememberedCount; i++) {
+		Obj *object = vm->rememberedSet[i];
+		vm->youngRefSeen = false;
+		blackenObject(runCtx, object);
+		if (vm->youngRefSeen || isAlwaysRemembered(object->type))
+			vm->rememberedSet[kept++] = object;
+		else
+			object->markers &= ~MARKER_REMEMBERED;
+	}
+	vm->rememberedCount = kept;
+}
+
+static void resetRemembered(VM *vm) {
+	for (int i = 0; i < vm->rememberedCount; i++)
+		vm->rememberedSet[i]->markers &= ~MARKER_REMEMBERED;
+	vm->rememberedCount = 0;
+	vm->rememberedOverflow = false;
+}
+
 static void traceReferences(RunCtx *runCtx) {
 	VM *vm = runCtx->vm;
 
@@ -338,7 +565,7 @@ static void traceReferences(RunCtx *runCtx) {
 	while (vm->grayCount > 0) {
 		Obj *object = vm->grayStack[--vm->grayCount];
 		object->markers &= ~MARKER_GRAY;
-		blackenObject(runCtx, object);
+		traceObject(runCtx, object);
 		if (ELOX_UNLIKELY(vm->grayOverflow)) {
 			slowTraceReferences(runCtx);
 			goto cleanup;
@@ -350,43 +577,222 @@ cleanup:
 	vm->grayOverflow = 0;
 }
 
-static void sweep(RunCtx *runCtx) {
+static void sweepNursery(RunCtx *runCtx) {
 	VM *vm = runCtx->vm;
 
 	Obj *previous = NULL;
 	Obj *object = vm->mainHeap.objects;
 	while (object != NULL) {
-		if (object->markers != 0) {
-			object->markers &= ~(MARKER_BLACK | MARKER_GRAY);
-			previous = object;
-			object = object->next;
+		Obj *next = object->next;
+		uint8_t markers = object->markers;
+		if (markers & MARKER_BLACK) {
+			if (markers & MARKER_SURVIVOR) {
+				// second survival, promote to the old generation
+				if (previous != NULL)
+					previous->next = next;
+				else
+					vm->mainHeap.objects = next;
+				// promoted while marking: its old references were marked
+				// by this collection, its young ones are remembered
+				uint8_t black = (vm->gcPhase == GC_PHASE_MARK) ? MARKER_BLACK : 0;
+				object->markers = (markers & MARKER_REMEMBERED) | MARKER_OLD | black;
+				object->next = vm->oldHeap.objects;
+				vm->oldHeap.objects = object;
+				if (isAlwaysRemembered(object->type))
+					rememberObject(runCtx, object);
+			} else {
+				object->markers = MARKER_SURVIVOR;
+				previous = object;
+			}
 		} else {
-			Obj *unreached = object;
-			object = object->next;
 			if (previous != NULL)
-				previous->next = object;
+				previous->next = next;
 			else
-				vm->mainHeap.objects = object;
+				vm->mainHeap.objects = next;
 
-			freeObject(runCtx, unreached);
+			freeObject(runCtx, object);
 		}
+		object = next;
+	}
+}
+
+// Sweeps up to maxObjects from the list of old objects detached by the last
+// full collection, moving the live ones back to the old heap
+static void sweepOld(RunCtx *runCtx, size_t maxObjects) {
+	VM *vm = runCtx->vm;
+
+	Obj *object = vm->sweepList;
+	while ((object != NULL) && (maxObjects > 0)) {
+		Obj *next = object->next;
+		if (object->markers & MARKER_BLACK) {
+			object->markers &= ~(MARKER_BLACK | MARKER_GRAY);
+			object->next = vm->oldHeap.objects;
+			vm->oldHeap.objects = object;
+		} else
+			freeObject(runCtx, object);
+		object = next;
+		maxObjects--;
+	}
+	vm->sweepList = object;
+
+	if (object == NULL) {
+		vm->nextFullGC = ELOX_MAX(vm->bytesAllocated * GC_HEAP_GROW_FACTOR,
+								  (size_t)GC_MIN_FULL_THRESHOLD);
+	}
+}
+
+static void finishSweeping(RunCtx *runCtx) {
+	if (runCtx->vm->sweepList != NULL)
+		sweepOld(runCtx, SIZE_MAX);
+}
+
+static void finishCollection(RunCtx *runCtx) {
+	VM *vm = runCtx->vm;
+
+	tableRemoveWhite(&vm->strings, vm->fullGC ? MARKER_BLACK : (MARKER_BLACK | MARKER_OLD));
+	if (vm->fullGC) {
+		// the old generation is swept lazily, during allocation. Detach it
+		// first, so that it does not mix with the objects promoted below
+		vm->sweepList = vm->oldHeap.objects;
+		vm->oldHeap.objects = NULL;
+		// recomputed once sweeping is complete
+		vm->nextFullGC = SIZE_MAX;
+	}
+	sweepNursery(runCtx);
+
+	vm->nextMinorGC = vm->bytesAllocated +
+					  ELOX_MAX(vm->bytesAllocated / GC_NURSERY_RATIO, (size_t)GC_MIN_NURSERY_SIZE);
+	vm->nextGC = vm->nextMinorGC;
+
+	vm->fullGC = false;
+}
+
+static uint64_t gcClockUs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Drops the old objects that were not marked, they are about to be swept
+static void pruneRemembered(VM *vm) {
+	int kept = 0;
+	for (int i = 0; i < vm->rememberedCount; i++) {
+		Obj *object = vm->rememberedSet[i];
+		if (object->markers & MARKER_BLACK)
+			vm->rememberedSet[kept++] = object;
+		else
+			object->markers &= ~MARKER_REMEMBERED;
+	}
+	vm->rememberedCount = kept;
+}
+
+// Minor collection while marking incrementally. The old objects it reaches
+// are handed to incremental marking; if there are none left, marking is
+// complete and the collection is finished as a full one
+static void collectWhileMarking(RunCtx *runCtx) {
+	VM *vm = runCtx->vm;
+
+	markRoots(runCtx);
+	traceRemembered(runCtx);
+	traceReferences(runCtx);
+
+	if ((vm->markCount == 0) && !vm->markOverflow) {
+		vm->gcPhase = GC_PHASE_IDLE;
+		vm->fullGC = true;
+		pruneRemembered(vm);
 	}
+	finishCollection(runCtx);
+}
+
+static void markIncrementally(RunCtx *runCtx) {
+	VM *vm = runCtx->vm;
+	VMEnv *env = runCtx->vmEnv;
+
+	uint32_t maxPauseUs = env->gc.maxPauseUs;
+	uint64_t deadline = (maxPauseUs > 0) ? gcClockUs() + maxPauseUs : 0;
+	uint32_t traced = 0;
+
+	vm->markingOld = true;
+	while ((vm->markCount > 0) && (traced < env->gc.markBudget)) {
+		Obj *object = vm->markStack[--vm->markCount];
+		object->markers &= ~MARKER_GRAY;
+		traceObject(runCtx, object);
+		traced++;
+		if ((deadline != 0) && (traced % GC_CLOCK_CHECK_INTERVAL == 0) && (gcClockUs() >= deadline))
+			break;
+	}
+	vm->markingOld = false;
+
+	// the minor collection also checks whether marking is complete
+	if ((vm->markCount == 0) || (vm->bytesAllocated > vm->nextMinorGC))
+		collectWhileMarking(runCtx);
+	if (vm->gcPhase == GC_PHASE_MARK)
+		vm->nextGC = ELOX_MIN(vm->bytesAllocated + GC_INCREMENTAL_STEP_SIZE, vm->nextMinorGC);
+}
+
+static void startIncrementalGC(RunCtx *runCtx) {
+	VM *vm = runCtx->vm;
+
+	// the remembered set is kept, minor collections go on during marking
+	vm->fullGC = false;
+	vm->gcPhase = GC_PHASE_MARK;
+	collectWhileMarking(runCtx);
+	if (vm->gcPhase == GC_PHASE_MARK)
+		vm->nextGC = ELOX_MIN(vm->bytesAllocated + GC_INCREMENTAL_STEP_SIZE, vm->nextMinorGC);
+}
+
+// Clears the marks of an incremental collection that lost track of some of
+// its gray objects, so that it can be redone as a regular full collection
+static void abortIncrementalGC(RunCtx *runCtx) {
+	VM *vm = runCtx->vm;
+
+	for (Obj *object = vm->oldHeap.objects; object != NULL; object = object->next)
+		object->markers &= ~(MARKER_BLACK | MARKER_GRAY);
+	for (Obj *object = vm->permHeap.objects; object != NULL; object = object->next)
+		object->markers &= ~MARKER_GRAY;
+	vm->markCount = 0;
+	vm->markOverflow = false;
+	vm->gcPhase = GC_PHASE_IDLE;
 }
 
 void collectGarbage(RunCtx *runCtx) {
 	VM *vm = runCtx->vm;
 
+	bool aborted = false;
+	if (vm->gcPhase == GC_PHASE_MARK) {
+		if (ELOX_LIKELY(!vm->markOverflow && !vm->rememberedOverflow)) {
+			markIncrementally(runCtx);
+			return;
+		}
+		abortIncrementalGC(runCtx);
+		aborted = true;
+	}
+
+	vm->fullGC = aborted || (vm->bytesAllocated > vm->nextFullGC) || vm->rememberedOverflow;
+
+	// marking relies on the mark bits cleared by sweeping
+	if (vm->fullGC)
+		finishSweeping(runCtx);
+
+	// minor collections during marking need a complete remembered set
+	if (vm->fullGC && runCtx->vmEnv->gc.incremental && !aborted && !vm->rememberedOverflow) {
+		startIncrementalGC(runCtx);
+		return;
+	}
+
 #ifdef ELOX_DEBUG_LOG_GC
-	ELOX_WRITE(vmCtx, ELOX_IO_DEBUG, "-- gc begin\n");
+	ELOX_WRITE(vmCtx, ELOX_IO_DEBUG, vm->fullGC ? "-- full gc begin\n" : "-- minor gc begin\n");
 	size_t before = vm->bytesAllocated;
 #endif
 
+	if (vm->fullGC)
+		resetRemembered(vm);
+
 	markRoots(runCtx);
+	if (!vm->fullGC)
+		traceRemembered(runCtx);
 	traceReferences(runCtx);
-	tableRemoveWhite(&vm->strings);
-	sweep(runCtx);
-
-	vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+	finishCollection(runCtx);
 
 #ifdef ELOX_DEBUG_LOG_GC
 	ELOX_WRITE(vmCtx, ELOX_IO_DEBUG, "-- gc end\n");
@@ -406,6 +812,20 @@ void freeObjects(RunCtx *runCtx) {
 		object = next;
 	}
 
+	object = vm->oldHeap.objects;
+	while (object != NULL) {
+		Obj *next = object->next;
+		freeObject(runCtx, object);
+		object = next;
+	}
+
+	object = vm->sweepList;
+	while (object != NULL) {
+		Obj *next = object->next;
+		freeObject(runCtx, object);
+		object = next;
+	}
+
 	object = vm->permHeap.objects;
 	while (object != NULL) {
 		Obj *next = object->next;
@@ -414,4 +834,8 @@ void freeObjects(RunCtx *runCtx) {
 	}
 
 	env->free(vm->grayStack, env->allocatorUserData);
+	env->free(vm->rememberedSet, env->allocatorUserData);
+	env->free(vm->markStack, env->allocatorUserData);
+
+	freeSlabAllocator(env, &vm->objectSlab);
 }
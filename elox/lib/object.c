@@ -16,11 +16,12 @@ Obj *allocateObject(RunCtx *runCtx, size_t size, ObjType type) {
 	VM *vm = runCtx->vm;
 	VMHeap *heap = vm->heap;
 
-	Obj *object = (Obj *)reallocate(runCtx, NULL, 0, size);
+	Obj *object = (Obj *)allocateObjectMemory(runCtx, size);
 	if (ELOX_UNLIKELY(object == NULL))
 		return NULL;
 	object->type = type;
 	object->markers = heap->initialMarkers;
+	object->identityHash = 0;
 	object->next = heap->objects;
 	heap->objects = object;
 
@@ -31,6 +32,17 @@ Obj *allocateObject(RunCtx *runCtx, size_t size, ObjType type) {
 	return object;
 }
 
+uint32_t assignIdentityHash(RunCtx *runCtx, Obj *object) {
+	VM *vm = runCtx->vm;
+
+	uint32_t hash;
+	do {
+		hash = stc64_rand(&vm->prng) & 0xFFFFFFFF;
+	} while (ELOX_UNLIKELY(hash == 0));
+	object->identityHash = hash;
+	return hash;
+}
+
 ObjBoundMethod *newBoundMethod(RunCtx *runCtx,Value receiver, ObjMethod *method) {
 	ObjBoundMethod *bound = ALLOCATE_OBJ(runCtx, ObjBoundMethod, OBJ_BOUND_METHOD);
 	if (ELOX_UNLIKELY(bound == NULL))
@@ -86,9 +98,14 @@ ObjClass *newClass(RunCtx *runCtx, ObjString *name, bool abstract) {
 		push(fiber, OBJ_VAL(className));
 	}
 
+	Shape *shape = newShape(runCtx);
+	if (ELOX_UNLIKELY(shape == NULL))
+		return NULL;
 	ObjClass *clazz = ALLOCATE_OBJ(runCtx, ObjClass, OBJ_CLASS);
-	if (ELOX_UNLIKELY(clazz == NULL))
+	if (ELOX_UNLIKELY(clazz == NULL)) {
+		releaseShape(runCtx, shape);
 		return NULL;
+	}
 	memset(&clazz->typeInfo, 0, sizeof(TypeInfo));
 	clazz->name = className;
 	if (name->string.length == 0)
@@ -97,7 +114,7 @@ ObjClass *newClass(RunCtx *runCtx, ObjString *name, bool abstract) {
 	clazz->hashCode = NULL;
 	clazz->equals = NULL;
 	clazz->super = NIL_VAL;
-	initTable(&clazz->fields);
+	clazz->shape = shape;
 	initTable(&clazz->methods);
 	initTable(&clazz->statics);
 	initValueArray(&clazz->staticValues);
@@ -169,40 +186,33 @@ ObjFunction *newFunction(RunCtx *runCtx, ObjString *fileName) {
 	function->maxArgs = 0;
 	function->defaultArgs = NULL;
 	function->upvalueCount = 0;
+	function->slotCount = 0;
 	function->name = NULL;
 	function->parentClass = NULL;
+#ifdef ELOX_ENABLE_JIT
+	function->hotness = 0;
+	function->jitCode = NULL;
+#endif
 	initChunk(&function->chunk, fileName);
 	return function;
 }
 
 ObjInstance *newInstance(RunCtx *runCtx, ObjClass *clazz) {
-	VM *vm = runCtx->vm;
-	FiberCtx *fiber = runCtx->activeFiber;
-
-	ObjInstance *ret = NULL;
-	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
-	VMTemp protectedInstance = TEMP_INITIALIZER;
-
-	ObjInstance *instance = ALLOCATE_OBJ(runCtx, ObjInstance, OBJ_INSTANCE);
+	uint32_t fieldCount = clazz->shape->count;
+	ObjInstance *instance = (ObjInstance *)allocateObject(runCtx, instanceSize(fieldCount),
+														  OBJ_INSTANCE);
 	if (ELOX_UNLIKELY(instance == NULL))
 		return NULL;
-	pushTempVal(temps, &protectedInstance, OBJ_VAL(instance));
 	instance->clazz = clazz;
-	bool init = initEmptyValueArray(runCtx, &instance->fields, clazz->fields.count);
-	if (ELOX_UNLIKELY(!init))
-		goto cleanup;
+	instance->fieldCount = fieldCount;
+	for (uint32_t i = 0; i < fieldCount; i++)
+		instance->fields[i] = NIL_VAL;
 
-	instance->identityHash = stc64_rand(&vm->prng) & 0xFFFFFFFF;
 	instance->flags =
 			INST_HAS_HASHCODE * (clazz->hashCode != NULL) |
 			INST_HAS_EQUALS * (clazz->equals != NULL);
 
-	ret = instance;
-
-cleanup:
-	releaseTemps(&temps);
-
-	return ret;
+	return instance;
 }
 
 ObjNative *newNative(RunCtx *runCtx, NativeFn function, uint16_t arity) {
@@ -325,31 +335,63 @@ int addClassField(RunCtx *runCtx, ObjClass *clazz, ObjString *fieldName, EloxErr
 	if (ELOX_UNLIKELY(error->raised))
 		return -1;
 
-	int index = clazz->fields.count;
-	EloxError tableError = ELOX_ERROR_INITIALIZER;
-	tableSet(runCtx, &clazz->fields, fieldName, NUMBER_VAL(index), &tableError);
-	if (ELOX_UNLIKELY(tableError.raised)) {
+	EloxError shapeError = ELOX_ERROR_INITIALIZER;
+	int index = shapeAddField(runCtx, &clazz->shape, fieldName, &shapeError);
+	if (ELOX_UNLIKELY(shapeError.raised)) {
 		pop(fiber); // discard error
 		ELOX_RAISE(error, "Out of memory");
 		return -1;
 	}
+	if (ELOX_UNLIKELY(index < 0)) {
+		ELOX_RAISE(error, "Duplicate field");
+		return -1;
+	}
 
 	return index;
 }
 
-static ObjString *allocateString(RunCtx *runCtx, uint8_t *chars, int length, uint32_t hash) {
-	VM *vm = runCtx->vm;
-	FiberCtx *fiber = runCtx->activeFiber;
+// Bytes are left for the caller to fill in
+static ObjInlineString *allocateInlineString(RunCtx *runCtx, int length) {
+	ObjInlineString *string = (ObjInlineString *)allocateObject(runCtx, inlineStringSize(length),
+																 OBJ_STRING);
+	if (ELOX_UNLIKELY(string == NULL))
+		return NULL;
+	string->chars[length] = '\0';
+	string->str.string.length = length;
+	string->str.string.chars = string->chars;
+	string->str.hash = 0;
+	string->str.flags = STRING_INLINE;
+	return string;
+}
 
-	ObjString *ret = NULL;
-	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
+static ObjString *copyInlineString(RunCtx *runCtx, const uint8_t *chars, int length) {
+	ObjInlineString *string = allocateInlineString(runCtx, length);
+	if (ELOX_UNLIKELY(string == NULL))
+		return NULL;
+	memcpy(string->chars, chars, length);
+	return &string->str;
+}
 
+static ObjString *allocateHeapString(RunCtx *runCtx, uint8_t *chars, int length) {
 	ObjString *string = ALLOCATE_OBJ(runCtx, ObjString, OBJ_STRING);
 	if (ELOX_UNLIKELY(string == NULL))
 		return NULL;
 	string->string.length = length;
 	string->string.chars = chars;
+	string->hash = 0;
+	string->flags = 0;
+	return string;
+}
+
+static ObjString *addInterned(RunCtx *runCtx, ObjString *string, uint32_t hash) {
+	VM *vm = runCtx->vm;
+	FiberCtx *fiber = runCtx->activeFiber;
+
+	ObjString *ret = NULL;
+	TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
+
 	string->hash = hash;
+	string->flags |= STRING_INTERNED | STRING_HASHED;
 
 	PUSH_TEMP(temps, protectedString, OBJ_VAL(string));
 	EloxError error = ELOX_ERROR_INITIALIZER;
@@ -370,28 +412,246 @@ cleanup:
 ObjString *takeString(RunCtx *runCtx, uint8_t *chars, int length, int capacity) {
 	VM *vm = runCtx->vm;
 
-	uint32_t hash = hashString(chars, length);
+	uint32_t hash = hashString(vm->hashSeed, chars, length);
 	ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
 	if (interned != NULL) {
 		FREE_ARRAY(runCtx, char, chars, capacity);
 		return interned;
 	}
-	return allocateString(runCtx, chars, length, hash);
+	ObjString *string;
+	if (length <= ELOX_INLINE_STRING_MAX) {
+		string = copyInlineString(runCtx, chars, length);
+		FREE_ARRAY(runCtx, char, chars, capacity);
+	} else
+		string = allocateHeapString(runCtx, chars, length);
+	if (ELOX_UNLIKELY(string == NULL))
+		return NULL;
+	return addInterned(runCtx, string, hash);
 }
 
 ObjString *copyString(RunCtx *runCtx, const uint8_t *chars, int32_t length) {
 	VM *vm = runCtx->vm;
 
-	uint32_t hash = hashString(chars, length);
+	uint32_t hash = hashString(vm->hashSeed, chars, length);
 	ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
 	if (interned != NULL)
 		return interned;
+	ObjString *string = copyTransientString(runCtx, chars, length);
+	if (ELOX_UNLIKELY(string == NULL))
+		return NULL;
+	return addInterned(runCtx, string, hash);
+}
+
+ObjString *takeTransientString(RunCtx *runCtx, uint8_t *chars, int length, int capacity) {
+	if (length <= ELOX_INLINE_STRING_MAX) {
+		ObjString *string = copyInlineString(runCtx, chars, length);
+		FREE_ARRAY(runCtx, char, chars, capacity);
+		return string;
+	}
+	return allocateHeapString(runCtx, chars, length);
+}
+
+ObjString *copyTransientString(RunCtx *runCtx, const uint8_t *chars, int32_t length) {
+	if (length <= ELOX_INLINE_STRING_MAX)
+		return copyInlineString(runCtx, chars, length);
+
 	uint8_t *heapChars = ALLOCATE(runCtx, uint8_t, length + 1);
 	if (ELOX_UNLIKELY(heapChars == NULL))
 		return NULL;
 	memcpy(heapChars, chars, length);
 	heapChars[length] = '\0';
-	return allocateString(runCtx, heapChars, length, hash);
+	ObjString *string = allocateHeapString(runCtx, heapChars, length);
+	if (ELOX_UNLIKELY(string == NULL))
+		FREE_ARRAY(runCtx, uint8_t, heapChars, length + 1);
+	return string;
+}
+
+static ObjString *concatFlat(RunCtx *runCtx, ObjString *a, ObjString *b) {
+	int length = a->string.length + b->string.length;
+	if (length <= ELOX_INLINE_STRING_MAX) {
+		ObjInlineString *result = allocateInlineString(runCtx, length);
+		if (ELOX_UNLIKELY(result == NULL))
+			return NULL;
+		memcpy(result->chars, a->string.chars, a->string.length);
+		memcpy(result->chars + a->string.length, b->string.chars, b->string.length);
+		return &result->str;
+	}
+
+	uint8_t *chars = ALLOCATE(runCtx, uint8_t, length + 1);
+	if (ELOX_UNLIKELY(chars == NULL))
+		return NULL;
+	memcpy(chars, a->string.chars, a->string.length);
+	memcpy(chars + a->string.length, b->string.chars, b->string.length);
+	chars[length] = '\0';
+
+	ObjString *result = allocateHeapString(runCtx, chars, length);
+	if (ELOX_UNLIKELY(result == NULL))
+		FREE_ARRAY(runCtx, uint8_t, chars, length + 1);
+	return result;
+}
+
+static ObjString *newRope(RunCtx *runCtx, ObjString *left, ObjString *right) {
+	ObjRope *rope = ALLOCATE_OBJ(runCtx, ObjRope, OBJ_STRING);
+	if (ELOX_UNLIKELY(rope == NULL))
+		return NULL;
+	rope->str.string.chars = NULL;
+	rope->str.string.length = left->string.length + right->string.length;
+	rope->str.hash = 0;
+	rope->str.flags = STRING_ROPE;
+	rope->left = left;
+	rope->right = right;
+	return (ObjString *)rope;
+}
+
+// Both operands must be reachable, returns NULL if out of memory
+ObjString *concatStrings(RunCtx *runCtx, ObjString *a, ObjString *b) {
+	FiberCtx *fiber = runCtx->activeFiber;
+
+	if (b->string.length == 0)
+		return a;
+	if (a->string.length == 0)
+		return b;
+
+	bool aFlat = (a->string.chars != NULL);
+	bool bFlat = (b->string.chars != NULL);
+	if (aFlat && bFlat && (a->string.length + b->string.length < ELOX_ROPE_MIN_LENGTH))
+		return concatFlat(runCtx, a, b);
+
+	if (!aFlat && bFlat) {
+		// appending to a rope, keep extending its last piece while it is short
+		ObjRope *rope = (ObjRope *)a;
+		ObjString *last = rope->right;
+		if ((last->string.chars != NULL) &&
+			(last->string.length + b->string.length < ELOX_ROPE_MIN_LENGTH)) {
+			ObjString *ret = NULL;
+			TmpScope temps = TMP_SCOPE_INITIALIZER(fiber);
+			ObjString *piece = concatFlat(runCtx, last, b);
+			if (ELOX_UNLIKELY(piece == NULL))
+				goto cleanup;
+			PUSH_TEMP(temps, protectedPiece, OBJ_VAL(piece));
+			ret = newRope(runCtx, rope->left, piece);
+cleanup:
+			releaseTemps(&temps);
+			return ret;
+		}
+	}
+
+	return newRope(runCtx, a, b);
+}
+
+#define ROPE_FLATTEN_STACK 32
+
+void flattenRope(RunCtx *runCtx, ObjString *string, EloxError *error) {
+	ObjRope *rope = (ObjRope *)string;
+	int32_t length = string->string.length;
+
+	ObjString *localStack[ROPE_FLATTEN_STACK];
+	ObjString **stack = localStack;
+	int stackCapacity = ROPE_FLATTEN_STACK;
+	int stackSize = 0;
+
+	uint8_t *chars = ALLOCATE(runCtx, uint8_t, length + 1);
+	ELOX_CHECK_THROW_RET(chars != NULL, error, OOM(runCtx));
+
+	// fill from the end, so the left leaning ropes built by appending
+	// only ever have a couple of nodes pending
+	stack[stackSize++] = rope->left;
+	stack[stackSize++] = rope->right;
+	int32_t end = length;
+	while (stackSize > 0) {
+		ObjString *node = stack[--stackSize];
+		if (node->string.chars != NULL) {
+			end -= node->string.length;
+			memcpy(chars + end, node->string.chars, node->string.length);
+			continue;
+		}
+		if (stackSize + 2 > stackCapacity) {
+			int newCapacity = GROW_CAPACITY(stackCapacity);
+			ObjString **newStack;
+			if (stack == localStack) {
+				newStack = ALLOCATE(runCtx, ObjString *, newCapacity);
+				if (newStack != NULL)
+					memcpy(newStack, localStack, sizeof(localStack));
+			} else
+				newStack = GROW_ARRAY(runCtx, ObjString *, stack, stackCapacity, newCapacity);
+			if (ELOX_UNLIKELY(newStack == NULL)) {
+				FREE_ARRAY(runCtx, uint8_t, chars, length + 1);
+				if (stack != localStack)
+					FREE_ARRAY(runCtx, ObjString *, stack, stackCapacity);
+				ELOX_THROW_RET(error, OOM(runCtx));
+			}
+			stack = newStack;
+			stackCapacity = newCapacity;
+		}
+		ObjRope *child = (ObjRope *)node;
+		stack[stackSize++] = child->left;
+		stack[stackSize++] = child->right;
+	}
+	chars[length] = '\0';
+
+	if (stack != localStack)
+		FREE_ARRAY(runCtx, ObjString *, stack, stackCapacity);
+
+	string->string.chars = chars;
+	rope->left = NULL;
+	rope->right = NULL;
+}
+
+// Parent must be reachable, returns NULL if out of memory
+ObjString *newStringView(RunCtx *runCtx, ObjString *parent, int32_t start, int32_t length) {
+	if ((start == 0) && (length == parent->string.length))
+		return parent;
+	if (length <= ELOX_INLINE_STRING_MAX)
+		return copyInlineString(runCtx, parent->string.chars + start, length);
+
+	// never chain views, share the bytes of the outermost parent
+	ObjString *base = parent;
+	if ((parent->flags & STRING_VIEW) && (((ObjStringView *)parent)->parent != NULL))
+		base = ((ObjStringView *)parent)->parent;
+
+	ObjStringView *view = ALLOCATE_OBJ(runCtx, ObjStringView, OBJ_STRING);
+	if (ELOX_UNLIKELY(view == NULL))
+		return NULL;
+	view->str.string.chars = parent->string.chars + start;
+	view->str.string.length = length;
+	view->str.hash = 0;
+	view->str.flags = STRING_VIEW;
+	view->parent = base;
+	return &view->str;
+}
+
+void terminateView(RunCtx *runCtx, ObjString *string, EloxError *error) {
+	ObjStringView *view = (ObjStringView *)string;
+	int32_t length = string->string.length;
+
+	// the parent is still referenced, so it survives a collection here
+	uint8_t *chars = ALLOCATE(runCtx, uint8_t, length + 1);
+	ELOX_CHECK_THROW_RET(chars != NULL, error, OOM(runCtx));
+	memcpy(chars, string->string.chars, length);
+	chars[length] = '\0';
+
+	string->string.chars = chars;
+	view->parent = NULL;
+}
+
+bool stringsEqual(RunCtx *runCtx, ObjString *a, ObjString *b, EloxError *error) {
+	if (a == b)
+		return true;
+	if (a->flags & b->flags & STRING_INTERNED)
+		return false;
+	if (a->string.length != b->string.length)
+		return false;
+
+	flattenString(runCtx, a, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return false;
+	flattenString(runCtx, b, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return false;
+
+	if ((a->flags & b->flags & STRING_HASHED) && (a->hash != b->hash))
+		return false;
+	return memcmp(a->string.chars, b->string.chars, a->string.length) == 0;
 }
 
 ObjStringPair *copyStrings(RunCtx *runCtx,
@@ -408,9 +668,12 @@ ObjStringPair *copyStrings(RunCtx *runCtx,
 	// TODO: fix error handling
 	if (ELOX_UNLIKELY(pair->str1 == NULL))
 		return NULL;
+	// copying allocates, so the pair may already have been promoted
+	gcWriteBarrier(runCtx, (Obj *)pair);
 	pair->str2 = copyString(runCtx, chars2, len2);
 	if (ELOX_UNLIKELY(pair->str2 == NULL))
 		return NULL;
+	gcWriteBarrier(runCtx, (Obj *)pair);
 	pair->hash = pair->str1->hash + pair->str2->hash;
 	pop(fiber);
 	return pair;
@@ -554,7 +817,7 @@ bool appendToArray(RunCtx *runCtx, ObjArray *array, Value value) {
 		int oldCapacity = array->capacity;
 		int newCapacity = GROW_CAPACITY(oldCapacity);
 		Value *oldItems = array->items;
-		array->items = GROW_ARRAY(runCtx, Value, array->items, oldCapacity, array->capacity);
+		array->items = GROW_ARRAY(runCtx, Value, array->items, oldCapacity, newCapacity);
 		if (ELOX_UNLIKELY(array->items == NULL)) {
 			array->items = oldItems;
 			return false;
@@ -563,6 +826,7 @@ bool appendToArray(RunCtx *runCtx, ObjArray *array, Value value) {
 	}
 	array->items[array->size] = value;
 	array->size++;
+	gcWriteBarrier(runCtx, (Obj *)array);
 	return true;
 }
 
@@ -583,8 +847,9 @@ Value arrayAtSafe(RunCtx *runCtx, ObjArray *array, int32_t index) {
 	return array->items[realIndex];
 }
 
-void arraySet(ObjArray *array, int index, Value value) {
+void arraySet(RunCtx *runCtx, ObjArray *array, int index, Value value) {
 	array->items[index] = value;
+	gcWriteBarrier(runCtx, (Obj *)array);
 }
 
 ObjHashMap *newHashMap(RunCtx *runCtx) {
@@ -698,9 +963,18 @@ void printObject(RunCtx *runCtx, EloxIOStream stream, Obj *obj) {
 		case OBJ_NATIVE:
 			eloxPrintf(runCtx, stream, "<native fn %p>", OBJ_AS_NATIVE(obj)->function);
 			break;
-		case OBJ_STRING:
-			eloxPrintf(runCtx, stream, "'%s'", OBJ_AS_CSTRING(obj));
+		case OBJ_STRING: {
+			EloxError error = ELOX_ERROR_INITIALIZER;
+			flattenString(runCtx, OBJ_AS_STRING(obj), &error);
+			if (ELOX_UNLIKELY(error.raised)) {
+				pop(runCtx->activeFiber); // discard error
+				ELOX_WRITE(runCtx, stream, "<string>");
+				break;
+			}
+			const String *str = &OBJ_AS_STRING(obj)->string;
+			eloxPrintf(runCtx, stream, "'%.*s'", str->length, (const char *)str->chars);
 			break;
+		}
 		case OBJ_STRINGPAIR: {
 			ObjStringPair *pair = OBJ_AS_STRINGPAIR(obj);
 			eloxPrintf(runCtx, stream, "'%s', '%s'",
@@ -0,0 +1,66 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "elox/memory.h"
+#include "elox/state.h"
+#include "elox/programCache.h"
+
+#include <string.h>
+
+void releaseProgram(RunCtx *runCtx, CachedProgram *program) {
+	if (--program->refCount == 0)
+		GENERIC_FREE(runCtx, program->size, program);
+}
+
+CachedProgram *getCachedProgram(RunCtx *runCtx, ProgramCache *cache, ObjString *source,
+								uint8_t variant, ProgramCompiler compile, EloxError *error) {
+	VM *vm = runCtx->vm;
+
+	uint32_t hash = stringHash(vm->hashSeed, source);
+	ProgramCacheEntry *entry = &cache->entries[(hash ^ variant) & (ELOX_PROGRAM_CACHE_SIZE - 1)];
+
+	if ((entry->source != NULL) && (entry->variant == variant)) {
+		if (entry->source == source)
+			return entry->program;
+		ObjString *key = entry->source;
+		if ((key->hash == hash) && (key->string.length == source->string.length) &&
+			(memcmp(key->string.chars, source->string.chars, source->string.length) == 0)) {
+			entry->source = source;
+			return entry->program;
+		}
+	}
+
+	CachedProgram *program = compile(runCtx, source, variant, error);
+	if (ELOX_UNLIKELY(program == NULL))
+		return NULL;
+	if (entry->program != NULL)
+		releaseProgram(runCtx, entry->program);
+	entry->source = source;
+	entry->variant = variant;
+	entry->program = program;
+	return program;
+}
+
+void initProgramCache(ProgramCache *cache) {
+	for (int i = 0; i < ELOX_PROGRAM_CACHE_SIZE; i++) {
+		cache->entries[i].source = NULL;
+		cache->entries[i].variant = 0;
+		cache->entries[i].program = NULL;
+	}
+}
+
+void markProgramCache(RunCtx *runCtx, ProgramCache *cache) {
+	for (int i = 0; i < ELOX_PROGRAM_CACHE_SIZE; i++)
+		markObject(runCtx, (Obj *)cache->entries[i].source);
+}
+
+void freeProgramCache(RunCtx *runCtx, ProgramCache *cache) {
+	for (int i = 0; i < ELOX_PROGRAM_CACHE_SIZE; i++) {
+		ProgramCacheEntry *entry = &cache->entries[i];
+		if (entry->program != NULL)
+			releaseProgram(runCtx, entry->program);
+		entry->source = NULL;
+		entry->program = NULL;
+	}
+}
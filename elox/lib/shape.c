@@ -0,0 +1,118 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <elox/shape.h>
+#include <elox/memory.h>
+#include <elox/state.h>
+
+#include <string.h>
+
+static inline uint32_t indexCapacity(const Shape *shape) {
+	return shape->index == NULL ? 0 : 1u << (32 - shape->indexShift);
+}
+
+static void indexName(uint16_t *index, uint32_t shift, ObjString *name, uint32_t slot) {
+	uint32_t mask = (1u << (32 - shift)) - 1;
+	uint32_t i = indexFor(name->hash, shift);
+	while (index[i] != 0)
+		i = (i + 1) & mask;
+	index[i] = slot + 1;
+}
+
+Shape *newShape(RunCtx *runCtx) {
+	Shape *shape = ALLOCATE(runCtx, Shape, 1);
+	if (ELOX_UNLIKELY(shape == NULL))
+		return NULL;
+	shape->refCount = 1;
+	shape->count = shape->capacity = 0;
+	shape->indexShift = 0;
+	shape->names = NULL;
+	shape->index = NULL;
+	return shape;
+}
+
+static void freeShape(RunCtx *runCtx, Shape *shape) {
+	FREE_ARRAY(runCtx, ObjString *, shape->names, shape->capacity);
+	if (shape->index != NULL)
+		FREE_ARRAY(runCtx, uint16_t, shape->index, indexCapacity(shape));
+	FREE(runCtx, Shape, shape);
+}
+
+void releaseShape(RunCtx *runCtx, Shape *shape) {
+	if ((shape != NULL) && (--shape->refCount == 0))
+		freeShape(runCtx, shape);
+}
+
+// Gives dest room for capacity fields, holding the fields of src.
+// The old storage of dest stays in place until the new one is complete,
+// in case allocating triggers a collection
+static bool resizeShape(RunCtx *runCtx, Shape *dest, const Shape *src, uint32_t capacity) {
+	ObjString **names = ALLOCATE(runCtx, ObjString *, capacity);
+	if (ELOX_UNLIKELY(names == NULL))
+		return false;
+	if (src->count > 0)
+		memcpy(names, src->names, src->count * sizeof(ObjString *));
+
+	uint16_t *index = NULL;
+	uint32_t indexShift = 0;
+	if (capacity > ELOX_SHAPE_LINEAR_MAX) {
+		uint32_t indexCap = 16;
+		while (indexCap < 2 * capacity)
+			indexCap *= 2;
+		index = ALLOCATE(runCtx, uint16_t, indexCap);
+		if (ELOX_UNLIKELY(index == NULL)) {
+			FREE_ARRAY(runCtx, ObjString *, names, capacity);
+			return false;
+		}
+		memset(index, 0, indexCap * sizeof(uint16_t));
+		indexShift = 32 - ELOX_CTZ(indexCap);
+		for (uint32_t i = 0; i < src->count; i++)
+			indexName(index, indexShift, names[i], i);
+	}
+
+	FREE_ARRAY(runCtx, ObjString *, dest->names, dest->capacity);
+	if (dest->index != NULL)
+		FREE_ARRAY(runCtx, uint16_t, dest->index, indexCapacity(dest));
+	dest->names = names;
+	dest->index = index;
+	dest->indexShift = indexShift;
+	dest->capacity = capacity;
+	dest->count = src->count;
+	return true;
+}
+
+int32_t shapeAddField(RunCtx *runCtx, Shape **shapeRef, ObjString *name, EloxError *error) {
+	Shape *shape = *shapeRef;
+
+	if (shapeLookup(shape, name) >= 0)
+		return -1;
+	ELOX_CHECK_THROW_RET_VAL(shape->count < UINT16_MAX - 1, error,
+							 RTERR(runCtx, "Too many fields"), -1);
+
+	if (shape->refCount > 1) {
+		// shared with other classes, extend a private copy
+		Shape *copy = newShape(runCtx);
+		ELOX_CHECK_THROW_RET_VAL(copy != NULL, error, OOM(runCtx), -1);
+		if (ELOX_UNLIKELY(!resizeShape(runCtx, copy, shape, GROW_CAPACITY(shape->count)))) {
+			freeShape(runCtx, copy);
+			ELOX_THROW_RET_VAL(error, OOM(runCtx), -1);
+		}
+		shape->refCount--;
+		*shapeRef = shape = copy;
+	} else if (shape->count == shape->capacity) {
+		bool resized = resizeShape(runCtx, shape, shape, GROW_CAPACITY(shape->capacity));
+		ELOX_CHECK_THROW_RET_VAL(resized, error, OOM(runCtx), -1);
+	}
+
+	uint32_t slot = shape->count++;
+	shape->names[slot] = name;
+	if (shape->index != NULL)
+		indexName(shape->index, shape->indexShift, name, slot);
+	return slot;
+}
+
+void markShape(RunCtx *runCtx, Shape *shape) {
+	for (uint32_t i = 0; i < shape->count; i++)
+		markObject(runCtx, (Obj *)shape->names[i]);
+}
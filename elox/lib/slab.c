@@ -0,0 +1,106 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "elox/slab.h"
+#include "elox/state.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define ELOX_SLAB_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define ELOX_SLAB_ASAN
+#endif
+#endif
+
+#ifdef ELOX_SLAB_ASAN
+#include <sanitizer/asan_interface.h>
+#define SLAB_POISON(addr, size) ASAN_POISON_MEMORY_REGION(addr, size)
+#define SLAB_UNPOISON(addr, size) ASAN_UNPOISON_MEMORY_REGION(addr, size)
+#else
+#define SLAB_POISON(addr, size) ((void)(addr), (void)(size))
+#define SLAB_UNPOISON(addr, size) ((void)(addr), (void)(size))
+#endif
+
+// keep slots aligned to the granule
+#define SLAB_PAGE_HEADER_SIZE \
+	((sizeof(SlabPage) + SLAB_GRANULE - 1) & ~(size_t)(SLAB_GRANULE - 1))
+
+static inline int slabClassIndex(size_t size) {
+	return (size - 1) / SLAB_GRANULE;
+}
+
+void initSlabAllocator(SlabAllocator *slab) {
+	for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+		SlabClass *sc = &slab->classes[i];
+		sc->freeList = NULL;
+		sc->bump = NULL;
+		sc->limit = NULL;
+	}
+	slab->pages = NULL;
+}
+
+static bool slabRefill(VMEnv *env, SlabAllocator *slab, SlabClass *sc) {
+	SlabPage *page = env->realloc(NULL, SLAB_PAGE_SIZE, env->allocatorUserData);
+	if (ELOX_UNLIKELY(page == NULL))
+		return false;
+	page->next = slab->pages;
+	slab->pages = page;
+
+	// the unused tail of the previous page is abandoned
+	sc->bump = (uint8_t *)page + SLAB_PAGE_HEADER_SIZE;
+	sc->limit = (uint8_t *)page + SLAB_PAGE_SIZE;
+	SLAB_POISON(sc->bump, sc->limit - sc->bump);
+	return true;
+}
+
+void *slabAlloc(VMEnv *env, SlabAllocator *slab, size_t size) {
+	int classIndex = slabClassIndex(size);
+	SlabClass *sc = &slab->classes[classIndex];
+	size_t slotSize = (size_t)(classIndex + 1) * SLAB_GRANULE;
+
+	SlabSlot *slot = sc->freeList;
+	if (slot != NULL) {
+		SLAB_UNPOISON(slot, slotSize);
+		sc->freeList = slot->next;
+		return slot;
+	}
+
+	if (ELOX_UNLIKELY(sc->bump + slotSize > sc->limit)) {
+		if (!slabRefill(env, slab, sc))
+			return NULL;
+	}
+
+	void *ret = sc->bump;
+	sc->bump += slotSize;
+	SLAB_UNPOISON(ret, slotSize);
+	return ret;
+}
+
+void slabFree(SlabAllocator *slab, void *pointer, size_t size) {
+	int classIndex = slabClassIndex(size);
+	size_t slotSize = (size_t)(classIndex + 1) * SLAB_GRANULE;
+
+#ifdef ELOX_SLAB_ASAN
+	// never reuse freed slots, so that stale accesses are always reported
+	(void)slab;
+	SLAB_POISON(pointer, slotSize);
+#else
+	(void)slotSize;
+	SlabClass *sc = &slab->classes[classIndex];
+	SlabSlot *slot = (SlabSlot *)pointer;
+	slot->next = sc->freeList;
+	sc->freeList = slot;
+#endif
+}
+
+void freeSlabAllocator(VMEnv *env, SlabAllocator *slab) {
+	SlabPage *page = slab->pages;
+	while (page != NULL) {
+		SlabPage *next = page->next;
+		SLAB_UNPOISON(page, SLAB_PAGE_SIZE);
+		env->free(page, env->allocatorUserData);
+		page = next;
+	}
+	initSlabAllocator(slab);
+}
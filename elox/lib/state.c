@@ -6,6 +6,7 @@
 #include <elox/builtins.h>
 
 #include <string.h>
+#include <time.h>
 
 static bool initVM(VMCtx *vmCtx) {
 	VM *vm = &vmCtx->vmInstance;
@@ -19,16 +20,41 @@ static bool initVM(VMCtx *vmCtx) {
 	vm->grayCount = 0;
 	vm->grayCapacity = 0;
 	vm->grayStack = NULL;
+	vm->fullGC = false;
+	vm->youngRefSeen = false;
+	vm->rememberedOverflow = false;
+	vm->rememberedCount = 0;
+	vm->rememberedCapacity = 0;
+	vm->rememberedSet = NULL;
+	vm->gcPhase = GC_PHASE_IDLE;
+	vm->markingOld = false;
+	vm->markOverflow = false;
+	vm->markCount = 0;
+	vm->markCapacity = 0;
+	vm->markStack = NULL;
+
+	stc64_init(&vm->prng, 64);
+	// Mixed with the VM address and start time so colliding keys cannot be
+	// precomputed, must be set before the first string is hashed
+	vm->hashSeed = stc64_rand(&vm->prng) ^ (uint64_t)(uintptr_t)vm ^ (uint64_t)time(NULL);
 
 	initTable(&vm->strings);
+	initProgramCache(&vm->patternCache);
+	initProgramCache(&vm->fmtCache);
 
 	vm->mainHeap.objects = NULL;
 	vm->mainHeap.initialMarkers = 0;
+	vm->oldHeap.objects = NULL;
+	vm->oldHeap.initialMarkers = MARKER_OLD;
+	vm->sweepList = NULL;
 	vm->permHeap.objects = NULL;
-	vm->permHeap.initialMarkers = MARKER_BLACK;
+	vm->permHeap.initialMarkers = MARKER_BLACK | MARKER_OLD;
 	vm->heap = &vm->mainHeap;
+	initSlabAllocator(&vm->objectSlab);
 	vm->bytesAllocated = 0;
 	vm->nextGC = 1024 * 1024;
+	vm->nextMinorGC = vm->nextGC;
+	vm->nextFullGC = 4 * 1024 * 1024;
 
 	vm->initFiber = NULL;
 	initValueTable(&vm->globalNames);
@@ -54,7 +80,6 @@ static bool initVM(VMCtx *vmCtx) {
 	}
 
 	vm->handlingException = 0;
-	stc64_init(&vm->prng, 64);
 
 	initValueArray(&vm->builtinValues);
 
@@ -103,6 +128,11 @@ EloxVMCtx *eloxNewVMCtx(const EloxConfig *config) {
 
 	vmCtx->env.write = config->writeCallback;
 	vmCtx->env.loaders = config->moduleLoaders;
+	vmCtx->env.moduleCacheDir = config->moduleCacheDir;
+	vmCtx->env.gc = config->gc;
+	// a step has to trace something for marking to progress between allocations
+	if (vmCtx->env.gc.markBudget == 0)
+		vmCtx->env.gc.markBudget = 1;
 
 	if (!initVM(vmCtx)) {
 		eloxDestroyVMCtx(vmCtx);
@@ -130,6 +160,8 @@ void eloxDestroyVMCtx(EloxVMCtx *vmCtx) {
 	freeTable(&runCtx, &vm->modules);
 	freeHandleSet(&runCtx, &vm->handles);
 	freeTable(&runCtx, &vm->strings);
+	freeProgramCache(&runCtx, &vm->patternCache);
+	freeProgramCache(&runCtx, &vm->fmtCache);
 
 	freeValueArray(&runCtx, &vm->builtinValues);
 
@@ -5,6 +5,7 @@
 #include <elox/vm.h>
 #include <elox/state.h>
 #include <elox/builtins/string.h>
+#include <elox/builtins/number.h>
 
 #include <limits.h>
 #include <math.h>
@@ -14,12 +15,8 @@
 
 typedef struct FmtState {
 	RunCtx *runCtx;
-	const uint8_t *ptr;
-	const uint8_t *end;
-	int autoIdx;
 	Args *args;
 	int maxArg;
-	Value arg;
 	char zeroPadding;
 	HeapCString *output;
 } FmtState;
@@ -36,264 +33,450 @@ typedef struct FmtSpec {
 	char type;
 } FmtSpec;
 
-static int getAutoIdx(FmtState *state, EloxError *error) {
-	ELOX_CHECK_THROW_RET_VAL(state->autoIdx != -1, error,
-							 RTERR(state->runCtx, "Cannot mix auto and specific field numbering"), -1);
-	ELOX_CHECK_THROW_RET_VAL(state->autoIdx < state->maxArg, error,
-							 RTERR(state->runCtx, "Auto index out of range"), -1);
-	state->autoIdx++;
-	return state->autoIdx;
+typedef enum {
+	FMT_ARG_AUTO,
+	FMT_ARG_INDEX,
+	FMT_ARG_NAME,        // property of the first argument
+	FMT_ACCESS_PROPERTY, // .name or [name]
+	FMT_ACCESS_INDEX     // [n]
+} FmtAccessKind;
+
+typedef struct {
+	uint8_t kind;
+	int32_t index;
+	// name, in the template text
+	int32_t nameOffset;
+	int32_t nameLength;
+} FmtAccess;
+
+typedef struct {
+	FmtAccess root;
+	// chain of FMT_ACCESS_* applied to the root
+	int32_t accessStart;
+	int32_t accessCount;
+} FmtArgRef;
+
+typedef struct {
+	// literal text before the field
+	int32_t textOffset;
+	int32_t textLength;
+	FmtArgRef arg;
+	FmtSpec spec;
+	// width or precision given as {arg}
+	bool argWidth;
+	bool argPrecision;
+	FmtArgRef width;
+	FmtArgRef precision;
+} FmtField;
+
+typedef struct FmtTemplate {
+	CachedProgram program;
+	int32_t numFields;
+	// literal text after the last field
+	int32_t tailOffset;
+	int32_t tailLength;
+	FmtField *fields;
+	FmtAccess *accesses;
+	// unescaped literal text and field names
+	uint8_t *text;
+} FmtTemplate;
+
+typedef struct FmtParser {
+	RunCtx *runCtx;
+	const uint8_t *ptr;
+	const uint8_t *end;
+	int autoIdx;
+	FmtTemplate *tmpl;
+	int32_t numAccesses;
+	int32_t textLength;
+} FmtParser;
+
+static inline uint8_t peekChar(FmtParser *parser) {
+	return (parser->ptr < parser->end) ? *parser->ptr : '\0';
+}
+
+static int32_t addText(FmtParser *parser, const uint8_t *chars, int32_t length) {
+	int32_t offset = parser->textLength;
+	memcpy(parser->tmpl->text + offset, chars, length);
+	parser->textLength += length;
+	return offset;
 }
 
-static int getSpecificIdx(int idx, FmtState *state, EloxError *error) {
-	ELOX_CHECK_THROW_RET_VAL(state->autoIdx <= 0, error,
-							 RTERR(state->runCtx, "Cannot mix auto and specific field numbering"), -1);
-	state->autoIdx = -1;
+static int getAutoIdx(FmtParser *parser, EloxError *error) {
+	ELOX_CHECK_THROW_RET_VAL(parser->autoIdx != -1, error,
+							 RTERR(parser->runCtx, "Cannot mix auto and specific field numbering"), -1);
+	parser->autoIdx++;
+	return parser->autoIdx;
+}
+
+static int getSpecificIdx(int idx, FmtParser *parser, EloxError *error) {
+	ELOX_CHECK_THROW_RET_VAL(parser->autoIdx <= 0, error,
+							 RTERR(parser->runCtx, "Cannot mix auto and specific field numbering"), -1);
+	parser->autoIdx = -1;
 	return idx;
 }
 
-static bool parseUInt(int *val, FmtState *state, EloxError *error) {
-	const uint8_t *ptr = state->ptr;
+static bool parseUInt(int *val, FmtParser *parser, EloxError *error) {
+	const uint8_t *ptr = parser->ptr;
 	unsigned int base = 0;
-	while ((ptr < state->end) && isDigit(*ptr)) {
+	while ((ptr < parser->end) && isDigit(*ptr)) {
 		int digit = *ptr++ - '0';
 		bool validDigit = (base < INT_MAX / 10) ||
 						  (base == INT_MAX / 10 && digit <= INT_MAX % 10);
 		ELOX_CHECK_THROW_RET_VAL(validDigit,
-								 error, RTERR(state->runCtx, "Too many decimal digits"), false);
+								 error, RTERR(parser->runCtx, "Too many decimal digits"), false);
 		base = base * 10 + digit;
 	}
-	if (ptr == state->ptr)
+	if (ptr == parser->ptr)
 		return false;
 	if (val)
 		*val = base;
-	state->ptr = ptr;
+	parser->ptr = ptr;
 	return true;
 }
 
-static Value getProperty(Value object, String *key, FmtState *state, EloxError *error) {
-	RunCtx *runCtx = state->runCtx;
-	FiberCtx *fiber = runCtx->activeFiber;
-
-	ELOX_CHECK_THROW_RET_VAL(IS_HASHMAP(object), error, RTERR(runCtx, "Argument is not a map"), NIL_VAL);
-	ObjHashMap *map = AS_HASHMAP(object);
+static bool getIdentifier(FmtParser *parser, FmtAccess *access) {
+	const uint8_t *ptr = parser->ptr;
 
-	ObjString *keyString = copyString(runCtx, key->chars, key->length);
-	ELOX_CHECK_THROW_RET_VAL(keyString != NULL, error, OOM(runCtx), NIL_VAL);
-	push(fiber, OBJ_VAL(keyString));
+	if ((ptr < parser->end) && isAlpha(*ptr))
+		while (++ptr < parser->end && isAlnum(*ptr));
 
-	Value val;
-	bool found = valueTableGet(runCtx, &map->items, OBJ_VAL(keyString), &val, error);
-	if (ELOX_UNLIKELY(error->raised))
-		return EXCEPTION_VAL;
-
-	ELOX_CHECK_THROW_RET_VAL(found, error,
-							 RTERR(runCtx, "Undefined property %.*s", key->length, key->chars), EXCEPTION_VAL);
-
-	pop(fiber); // key
-	return val;
-}
-
-static Value getIndex(RunCtx *runCtx, Value object, int index, EloxError *error) {
-	ELOX_CHECK_THROW_RET_VAL(IS_ARRAY(object), error,
-							 RTERR(runCtx, "Argument is not an array"), NIL_VAL);
-	ObjArray *array = AS_ARRAY(object);
-	return arrayAt(array, index);
-}
-
-static bool getIdentifier(FmtState *state, String *str) {
-	const uint8_t *ptr = state->ptr;
-
-	if (isAlpha(*ptr))
-		while (++ptr < state->end && isAlnum(*ptr));
-
-	if (ptr == state->ptr)
+	if (ptr == parser->ptr)
 		return false;
 
-	str->chars = state->ptr;
-	str->length = ptr - state->ptr;
-	state->ptr = ptr;
+	access->nameLength = ptr - parser->ptr;
+	access->nameOffset = addText(parser, parser->ptr, access->nameLength);
+	parser->ptr = ptr;
 	return true;
 }
 
-static Value access(Value val, FmtState *state, EloxError *error) {
-	RunCtx *runCtx = state->runCtx;
-
-	Value crtVal = val;
-	while ((*state->ptr == '.') || (*state->ptr == '[')) {
-		if (ELOX_UNLIKELY(error->raised))
-			return NIL_VAL;
-
-		int idx;
-
-		state->ptr++;
-		const uint8_t *ptr = state->ptr;
-		if (ptr[-1] == '.') {
-			String name;
-			if (getIdentifier(state, &name)) {
-				crtVal = getProperty(crtVal, &name, state, error);
-				if (ELOX_UNLIKELY(error->raised))
-					return NIL_VAL;
-			} else
-				ELOX_THROW_RET_VAL(error, RTERR(runCtx, "Invalid identifier after '.'"), NIL_VAL);
-		} else if (parseUInt(&idx, state, error)) {
-			if (*state->ptr != ']') {
-				ELOX_THROW_RET_VAL(error, RTERR(runCtx, "Unexpected '%c' in field name", *state->ptr), NIL_VAL);
-			}
-			state->ptr++;
-			crtVal = getIndex(runCtx, crtVal, idx, error);
+static void parseAccess(FmtParser *parser, FmtArgRef *ref, EloxError *error) {
+	RunCtx *runCtx = parser->runCtx;
+
+	ref->accessStart = parser->numAccesses;
+	while ((peekChar(parser) == '.') || (peekChar(parser) == '[')) {
+		FmtAccess *access = &parser->tmpl->accesses[parser->numAccesses++];
+		ref->accessCount++;
+
+		parser->ptr++;
+		if (parser->ptr[-1] == '.') {
+			access->kind = FMT_ACCESS_PROPERTY;
+			ELOX_CHECK_THROW_RET(getIdentifier(parser, access), error,
+								 RTERR(runCtx, "Invalid identifier after '.'"));
+		} else if (parseUInt(&access->index, parser, error)) {
+			access->kind = FMT_ACCESS_INDEX;
+			ELOX_CHECK_THROW_RET(peekChar(parser) == ']', error,
+								 RTERR(runCtx, "Unexpected '%c' in field name", peekChar(parser)));
+			parser->ptr++;
 		} else {
 			if (ELOX_UNLIKELY(error->raised))
-				return NIL_VAL;
-			String name;
-			if (getIdentifier(state, &name)) {
-				ELOX_CHECK_THROW_RET_VAL(*state->ptr == ']', error,
-										 RTERR(runCtx, "Unexpected '%c' in field name", *state->ptr), NIL_VAL);
-				state->ptr++;
-				crtVal = getProperty(crtVal, &name, state, error);
-				if (ELOX_UNLIKELY(error->raised))
-					return NIL_VAL;
-			} else
-				ELOX_THROW_RET_VAL(error, RTERR(runCtx, "Invalid identifier in '[]'"), NIL_VAL);
+				return;
+			access->kind = FMT_ACCESS_PROPERTY;
+			ELOX_CHECK_THROW_RET(getIdentifier(parser, access), error,
+								 RTERR(runCtx, "Invalid identifier in '[]'"));
+			ELOX_CHECK_THROW_RET(peekChar(parser) == ']', error,
+								 RTERR(runCtx, "Unexpected '%c' in field name", peekChar(parser)));
+			parser->ptr++;
 		}
 	}
-	return crtVal;
 }
 
-static Value getArg(FmtState *state, EloxError *error) {
-	RunCtx *runCtx = state->runCtx;
+static void parseArg(FmtParser *parser, FmtArgRef *ref, EloxError *error) {
+	RunCtx *runCtx = parser->runCtx;
 
-	ELOX_CHECK_THROW_RET_VAL(state->ptr < state->end, error, RTERR(runCtx, "'}' expected"), NIL_VAL);
+	ELOX_CHECK_THROW_RET(parser->ptr < parser->end, error, RTERR(runCtx, "'}' expected"));
 
 	int idx = 0;
-	Value val;
 
-	if ((*state->ptr == ':') || (*state->ptr == '}')) {
-		int argIdx = getAutoIdx(state, error);
-		val = getValueArg(state->args, argIdx);
-	}
-	else if (parseUInt(&idx, state, error)) {
-		int argIdx = getSpecificIdx(idx, state, error);
-		ELOX_CHECK_THROW_RET_VAL((argIdx >= 1) && (argIdx < state->maxArg), error,
-								 RTERR(runCtx, "Argument index out of range: %d", argIdx), NIL_VAL);
-		val = getValueArg(state->args, argIdx);
+	if ((*parser->ptr == ':') || (*parser->ptr == '}')) {
+		ref->root.kind = FMT_ARG_AUTO;
+		ref->root.index = getAutoIdx(parser, error);
+	} else if (parseUInt(&idx, parser, error)) {
+		ref->root.kind = FMT_ARG_INDEX;
+		ref->root.index = getSpecificIdx(idx, parser, error);
 	} else {
-		getSpecificIdx(0, state, error);
-		String name;
-		ELOX_CHECK_THROW_RET_VAL(getIdentifier(state, &name), error,
-								 RTERR(runCtx, "Unexpected '%c' in field name", *state->ptr), NIL_VAL);
-		val = getProperty(getValueArg(state->args,1), &name, state, error);
+		if (ELOX_UNLIKELY(error->raised))
+			return;
+		getSpecificIdx(0, parser, error);
+		if (ELOX_UNLIKELY(error->raised))
+			return;
+		ref->root.kind = FMT_ARG_NAME;
+		ELOX_CHECK_THROW_RET(getIdentifier(parser, &ref->root), error,
+							 RTERR(runCtx, "Unexpected '%c' in field name", peekChar(parser)));
 	}
 
 	if (ELOX_UNLIKELY(error->raised))
-		return NIL_VAL;
+		return;
 
-	return access(val, state, error);
+	parseAccess(parser, ref, error);
 }
 
-static char readChar(FmtState *state, EloxError *error) {
-	char ch = *state->ptr;
-	state->ptr++;
-	ELOX_CHECK_THROW_RET_VAL(state->ptr < state->end, error,
-							 RTERR(state->runCtx, "Unterminated format spec"), -1);
+static char readChar(FmtParser *parser, EloxError *error) {
+	char ch = *parser->ptr;
+	parser->ptr++;
+	ELOX_CHECK_THROW_RET_VAL(parser->ptr < parser->end, error,
+							 RTERR(parser->runCtx, "Unterminated format spec"), -1);
 	return ch;
 }
 
-static int toInteger(RunCtx *runCtx, const Value val, EloxError *error) {
-	ELOX_CHECK_THROW_RET_VAL(IS_NUMBER(val), error, RTERR(runCtx, "Integer expected"), 0);
-	double dVal = AS_NUMBER(val);
-	double iVal = trunc(dVal);
-	if (iVal == dVal)
-		return (int)iVal;
-	ELOX_THROW_RET_VAL(error, RTERR(runCtx, "Integer expected, got double"), 0);
-}
-
-static int readUInt(FmtState *state, bool required, const char *label, EloxError *error) {
-	RunCtx *runCtx = state->runCtx;
+static int readUInt(FmtParser *parser, bool *isArg, FmtArgRef *ref, bool required, const char *label,
+					EloxError *error) {
+	RunCtx *runCtx = parser->runCtx;
 
 	int val = 0;
 
-	if (*state->ptr != '{') {
-		bool isInt = parseUInt(&val, state, error);
+	if (peekChar(parser) != '{') {
+		bool isInt = parseUInt(&val, parser, error);
 		if (ELOX_UNLIKELY(error->raised))
 			return 0;
 		ELOX_CHECK_THROW_RET_VAL(isInt || (!required), error,
 								 RTERR(runCtx, "Missing %s in format specifier", label), 0);
-		ELOX_CHECK_THROW_RET_VAL(state->ptr < state->end, error,
+		ELOX_CHECK_THROW_RET_VAL(parser->ptr < parser->end, error,
 								 RTERR(runCtx, "Unterminated format spec"), 0);
 	} else {
-		state->ptr++;
-		Value arg = getArg(state, error);
-		if (ELOX_UNLIKELY(error->raised))
-			return 0;
-		ELOX_CHECK_THROW_RET_VAL(*state->ptr == '}', error,
-								 RTERR(runCtx, "Unexpected character '%c' in format spec", *state->ptr), 0);
-		state->ptr++;
-		val = toInteger(runCtx, arg, error);
+		parser->ptr++;
+		parseArg(parser, ref, error);
 		if (ELOX_UNLIKELY(error->raised))
 			return 0;
+		ELOX_CHECK_THROW_RET_VAL(peekChar(parser) == '}', error,
+								 RTERR(runCtx, "Unexpected character '%c' in format spec", peekChar(parser)), 0);
+		parser->ptr++;
+		*isArg = true;
 	}
 
 	return val;
 }
 
-static void parseSpec(FmtState *state, FmtSpec *spec, EloxError *error) {
-	if ((state->ptr[1] == '<') || (state->ptr[1] == '>') || (state->ptr[1] == '^')) {
-		spec->fill  = readChar(state, error);
-		spec->align = readChar(state, error);
-	} else if ((*state->ptr == '<') || (*state->ptr == '>') || (*state->ptr == '^'))
-		spec->align = readChar(state, error);
-	if (*state->ptr == ' ' || *state->ptr == '+' || *state->ptr == '-')
-		spec->sign = readChar(state, error);
-	if (*state->ptr == '#')
-		spec->alternate = readChar(state, error);
-	if (*state->ptr == '0')
-		spec->zero  = readChar(state, error);
+static void parseSpec(FmtParser *parser, FmtField *field, EloxError *error) {
+	FmtSpec *spec = &field->spec;
+
+	uint8_t next = (parser->ptr + 1 < parser->end) ? parser->ptr[1] : '\0';
+	if ((next == '<') || (next == '>') || (next == '^')) {
+		spec->fill  = readChar(parser, error);
+		if (ELOX_UNLIKELY(error->raised))
+			return;
+		spec->align = readChar(parser, error);
+	} else if ((*parser->ptr == '<') || (*parser->ptr == '>') || (*parser->ptr == '^'))
+		spec->align = readChar(parser, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return;
+	if (peekChar(parser) == ' ' || peekChar(parser) == '+' || peekChar(parser) == '-') {
+		spec->sign = readChar(parser, error);
+		if (ELOX_UNLIKELY(error->raised))
+			return;
+	}
+	if (peekChar(parser) == '#') {
+		spec->alternate = readChar(parser, error);
+		if (ELOX_UNLIKELY(error->raised))
+			return;
+	}
+	if (peekChar(parser) == '0')
+		spec->zero  = readChar(parser, error);
 	if (ELOX_UNLIKELY(error->raised))
 		return;
 
-	spec->width = readUInt(state, false, "width", error);
+	spec->width = readUInt(parser, &field->argWidth, &field->width, false, "width", error);
 	if (ELOX_UNLIKELY(error->raised))
 		return;
 
-	if (*state->ptr == ',')
-		spec->grouping = readChar(state, error);
+	if (peekChar(parser) == ',')
+		spec->grouping = readChar(parser, error);
 	if (ELOX_UNLIKELY(error->raised))
 		return;
 
-	if (*state->ptr == '.') {
-		state->ptr++;
-		spec->precision = readUInt(state, true, "precision", error);
+	if (peekChar(parser) == '.') {
+		parser->ptr++;
+		spec->precision = readUInt(parser, &field->argPrecision, &field->precision,
+								   true, "precision", error);
 		if (ELOX_UNLIKELY(error->raised))
 			return;
 	}
 
-	if (*state->ptr != '}') {
-		const uint8_t *ptr = state->ptr++;
+	if (peekChar(parser) != '}') {
+		const uint8_t *ptr = parser->ptr++;
 		spec->type = *ptr;
-		if (*state->ptr != '}') {
-			while ((state->ptr < state->end) && (*state->ptr != '}'))
-				state->ptr++;
-			ELOX_CHECK_THROW_RET(state->ptr < state->end, error,
-								 RTERR(state->runCtx, "Unterminated format spec"));
-			ELOX_THROW_RET(error, RTERR(state->runCtx, "Invalid format specifier: '%s'", ptr));
+		if (peekChar(parser) != '}') {
+			while ((parser->ptr < parser->end) && (*parser->ptr != '}'))
+				parser->ptr++;
+			ELOX_CHECK_THROW_RET(parser->ptr < parser->end, error,
+								 RTERR(parser->runCtx, "Unterminated format spec"));
+			ELOX_THROW_RET(error, RTERR(parser->runCtx, "Invalid format specifier: '%.*s'",
+										(int)(parser->end - ptr), ptr));
 		}
 	}
 }
 
-static void parse(FmtState *state, FmtSpec *spec, EloxError *error) {
-	state->arg = getArg(state, error);
+static void parseField(FmtParser *parser, FmtField *field, EloxError *error) {
+	parseArg(parser, &field->arg, error);
 	if (error->raised)
 		return;
-	if ((*state->ptr == ':') && (state->ptr + 1 < state->end)) {
-		state->ptr++;
-		parseSpec(state, spec, error);
+	if ((peekChar(parser) == ':') && (parser->ptr + 1 < parser->end)) {
+		parser->ptr++;
+		parseSpec(parser, field, error);
 		if (error->raised)
 			return;
 	}
-	ELOX_CHECK_THROW_RET((state->ptr < state->end) && (*state->ptr == '}'),
-						 error, RTERR(state->runCtx, "'}' expected"));
-	state->ptr++;
+	ELOX_CHECK_THROW_RET((parser->ptr < parser->end) && (*parser->ptr == '}'),
+						 error, RTERR(parser->runCtx, "'}' expected"));
+	parser->ptr++;
+}
+
+static CachedProgram *compileTemplate(RunCtx *runCtx, ObjString *fmt, uint8_t variant ELOX_UNUSED,
+									  EloxError *error) {
+	const uint8_t *chars = fmt->string.chars;
+	int32_t length = fmt->string.length;
+
+	// every field starts with {, every access with . or [
+	int32_t maxFields = 0;
+	int32_t maxAccesses = 0;
+	for (int32_t i = 0; i < length; i++) {
+		if (chars[i] == '{')
+			maxFields++;
+		else if ((chars[i] == '.') || (chars[i] == '['))
+			maxAccesses++;
+	}
+	size_t size = sizeof(FmtTemplate) + maxFields * sizeof(FmtField) +
+				  maxAccesses * sizeof(FmtAccess) + length;
+	FmtTemplate *tmpl = (FmtTemplate *)ALLOCATE(runCtx, uint8_t, size);
+	ELOX_CHECK_THROW_RET_VAL(tmpl != NULL, error, OOM(runCtx), NULL);
+	tmpl->program.refCount = 1;
+	tmpl->program.size = size;
+	tmpl->fields = (FmtField *)(tmpl + 1);
+	tmpl->accesses = (FmtAccess *)(tmpl->fields + maxFields);
+	tmpl->text = (uint8_t *)(tmpl->accesses + maxAccesses);
+
+	FmtParser parser = {
+		.runCtx = runCtx,
+		.ptr = chars,
+		.end = chars + length,
+		.autoIdx = 0,
+		.tmpl = tmpl,
+		.numAccesses = 0,
+		.textLength = 0
+	};
+
+	int32_t numFields = 0;
+	int32_t textStart = 0;
+	while (parser.ptr < parser.end) {
+		const uint8_t *ptr = parser.ptr;
+
+		while ((ptr < parser.end) && (*ptr != '{') && (*ptr != '}'))
+			ptr++;
+		addText(&parser, parser.ptr, ptr - parser.ptr);
+		parser.ptr = ptr;
+
+		if (parser.ptr >= parser.end)
+			break;
+		if ((parser.ptr + 1 < parser.end) && (parser.ptr[0] == parser.ptr[1])) {
+			// escaped bracket
+			addText(&parser, parser.ptr, 1);
+			parser.ptr += 2;
+		} else {
+			ELOX_CHECK_THROW_GOTO((*parser.ptr++ != '}') && (parser.ptr < parser.end), error,
+								  RTERR(runCtx, "Single '%c' in format string", *(parser.ptr - 1)),
+								  cleanup);
+
+			FmtField *field = &tmpl->fields[numFields++];
+			*field = (FmtField){ .textOffset = textStart, .textLength = parser.textLength - textStart };
+			parseField(&parser, field, error);
+			if (ELOX_UNLIKELY(error->raised))
+				goto cleanup;
+			textStart = parser.textLength;
+		}
+	}
+	tmpl->numFields = numFields;
+	tmpl->tailOffset = textStart;
+	tmpl->tailLength = parser.textLength - textStart;
+
+	return &tmpl->program;
+
+cleanup:
+	releaseProgram(runCtx, &tmpl->program);
+	return NULL;
+}
+
+// Parsed format string, cached as described at getCachedProgram
+static FmtTemplate *getTemplate(RunCtx *runCtx, ObjString *fmt, EloxError *error) {
+	return (FmtTemplate *)getCachedProgram(runCtx, &runCtx->vm->fmtCache, fmt, 0,
+										   compileTemplate, error);
+}
+
+static Value getProperty(Value object, String *key, FmtState *state, EloxError *error) {
+	RunCtx *runCtx = state->runCtx;
+	FiberCtx *fiber = runCtx->activeFiber;
+
+	ELOX_CHECK_THROW_RET_VAL(IS_HASHMAP(object), error, RTERR(runCtx, "Argument is not a map"), NIL_VAL);
+	ObjHashMap *map = AS_HASHMAP(object);
+
+	ObjString *keyString = copyTransientString(runCtx, key->chars, key->length);
+	ELOX_CHECK_THROW_RET_VAL(keyString != NULL, error, OOM(runCtx), NIL_VAL);
+	push(fiber, OBJ_VAL(keyString));
+
+	Value val;
+	bool found = valueTableGet(runCtx, &map->items, OBJ_VAL(keyString), &val, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return EXCEPTION_VAL;
+
+	ELOX_CHECK_THROW_RET_VAL(found, error,
+							 RTERR(runCtx, "Undefined property %.*s", key->length, key->chars), EXCEPTION_VAL);
+
+	pop(fiber); // key
+	return val;
+}
+
+static Value getIndex(RunCtx *runCtx, Value object, int index, EloxError *error) {
+	ELOX_CHECK_THROW_RET_VAL(IS_ARRAY(object), error,
+							 RTERR(runCtx, "Argument is not an array"), NIL_VAL);
+	ObjArray *array = AS_ARRAY(object);
+	return arrayAt(array, index);
+}
+
+static Value getArg(FmtState *state, const FmtTemplate *tmpl, const FmtArgRef *ref, EloxError *error) {
+	RunCtx *runCtx = state->runCtx;
+
+	Value val;
+	const FmtAccess *root = &ref->root;
+	switch (root->kind) {
+		case FMT_ARG_AUTO:
+			ELOX_CHECK_THROW_RET_VAL(root->index <= state->maxArg, error,
+									 RTERR(runCtx, "Auto index out of range"), NIL_VAL);
+			val = getValueArg(state->args, root->index);
+			break;
+		case FMT_ARG_INDEX:
+			ELOX_CHECK_THROW_RET_VAL((root->index >= 1) && (root->index < state->maxArg), error,
+									 RTERR(runCtx, "Argument index out of range: %d", root->index), NIL_VAL);
+			val = getValueArg(state->args, root->index);
+			break;
+		default: {
+			String name = { .chars = tmpl->text + root->nameOffset, .length = root->nameLength };
+			val = getProperty(getValueArg(state->args, 1), &name, state, error);
+			if (ELOX_UNLIKELY(error->raised))
+				return NIL_VAL;
+			break;
+		}
+	}
+
+	for (int32_t i = 0; i < ref->accessCount; i++) {
+		const FmtAccess *access = &tmpl->accesses[ref->accessStart + i];
+		if (access->kind == FMT_ACCESS_INDEX)
+			val = getIndex(runCtx, val, access->index, error);
+		else {
+			String name = { .chars = tmpl->text + access->nameOffset, .length = access->nameLength };
+			val = getProperty(val, &name, state, error);
+		}
+		if (ELOX_UNLIKELY(error->raised))
+			return NIL_VAL;
+	}
+	return val;
+}
+
+static int toInteger(RunCtx *runCtx, const Value val, EloxError *error) {
+	ELOX_CHECK_THROW_RET_VAL(IS_NUMBER(val), error, RTERR(runCtx, "Integer expected"), 0);
+	double dVal = AS_NUMBER(val);
+	double iVal = trunc(dVal);
+	if (iVal == dVal)
+		return (int)iVal;
+	ELOX_THROW_RET_VAL(error, RTERR(runCtx, "Integer expected, got double"), 0);
 }
 
 static void addPadding(FmtState *state, char ch, int len) {
@@ -369,9 +552,10 @@ static void addString(String *str, FmtState *state, FmtSpec *spec, bool shrink,
 static const char *lowerHex = "0123456789abcdef";
 static const char *upperHex = "0123456789ABCDEF";
 
-#define INT_FMT_BUFFER_SIZE 10
+// 64 binary digits, 21 group separators, sign and radix prefix
+#define INT_FMT_BUFFER_SIZE 96
 
-static char writeInt(uint8_t **pPtr, int64_t val, FmtSpec *spec) {
+static char writeInt(uint8_t **pPtr, uint64_t val, FmtSpec *spec) {
 	int radix = 10;
 	char zeroPadding;
 	uint8_t *ptr = *pPtr;
@@ -473,9 +657,9 @@ static void dumpInt(int64_t val, FmtState *state, FmtSpec *spec) {
 
 	bool positive = (val >= 0);
 	int width = spec->width;
-	if (!positive)
-		val = -val;
-	state->zeroPadding = writeInt(&ptr, val, spec);
+	// negated as unsigned, INT64_MIN has no positive counterpart
+	uint64_t magnitude = positive ? (uint64_t)val : -(uint64_t)val;
+	state->zeroPadding = writeInt(&ptr, magnitude, spec);
 	uint8_t *dp = ptr;
 	if (spec->alternate && (spec->type != 0) && (spec->type != 'd')) {
 		*--ptr = spec->type;
@@ -497,6 +681,9 @@ static void dumpInt(int64_t val, FmtState *state, FmtSpec *spec) {
 #define DBL_FMT_LEN 20
 
 static int writeDouble(double val, uint8_t *buffer, int size, FmtSpec *spec) {
+	if ((spec->type == 0) && !spec->precision && !spec->alternate)
+		return numberToChars(val, (char *)buffer);
+
 	char fmt[DBL_FMT_LEN];
 	int type = spec->type ? spec->type : 'g';
 	const char *percent = "";
@@ -539,7 +726,7 @@ static void dumpDouble(double val, FmtState *state, FmtSpec *spec, EloxError *er
 	ELOX_CHECK_THROW_RET(spec->grouping == 0, error,
 						 RTERR(runCtx, "Grouping not allowed for floating point formats"));
 
-	bool positive = (val >= 0);
+	bool positive = (val >= 0) || isnan(val);
 	int width = spec->width;
 
 	if (!positive)
@@ -554,14 +741,14 @@ static void dumpDouble(double val, FmtState *state, FmtSpec *spec, EloxError *er
 		width -= (dp - ptr);
 		ptr = dp;
 	}
-	String str = { .chars = ptr, .length = len };
+	String str = { .chars = ptr, .length = len + (dp - ptr) };
 	addString(&str, state, spec, false, width);
 }
 
 static void dumpNumber(double val, FmtState *state, FmtSpec *spec, EloxError *error) {
 	char type = spec->type;
 	if (type == 0)
-		type = (trunc(val) == val) ? 'd' : 'g';
+		type = isIntegralNumber(val) ? 'd' : 'g';
 	switch (type) {
 		case 'c':
 			dumpChar((int64_t)val, state, spec, error);
@@ -573,6 +760,8 @@ static void dumpNumber(double val, FmtState *state, FmtSpec *spec, EloxError *er
 		case 'O':
 		case 'x':
 		case 'X':
+			ELOX_CHECK_THROW_RET((val >= -9223372036854775808.0) && (val < 9223372036854775808.0),
+								 error, RTERR(state->runCtx, "Number out of range for integer format"));
 			dumpInt((int64_t)val, state, spec);
 			break;
 		case 'e':
@@ -596,11 +785,10 @@ static void dumpString(ObjString *str, FmtState *state, FmtSpec *spec, EloxError
 	addString(&str->string, state, spec, true, spec->width);
 }
 
-static void dump(FmtState *state, FmtSpec *spec, EloxError *error) {
+static void dump(FmtState *state, FmtSpec *spec, Value arg, EloxError *error) {
 	RunCtx *runCtx = state->runCtx;
 	FiberCtx *fiber = runCtx->activeFiber;
 
-	Value arg = state->arg;
 	if (IS_NUMBER(arg)) {
 		dumpNumber(AS_NUMBER(arg), state, spec, error);
 		return;
@@ -621,56 +809,67 @@ static void dump(FmtState *state, FmtSpec *spec, EloxError *error) {
 	pop(fiber);
 }
 
+static bool formatFields(FmtState *state, FmtTemplate *tmpl, EloxError *error) {
+	RunCtx *runCtx = state->runCtx;
+
+	for (int32_t i = 0; i < tmpl->numFields; i++) {
+		FmtField *field = &tmpl->fields[i];
+
+		if (field->textLength > 0)
+			heapStringAddString(runCtx, state->output, tmpl->text + field->textOffset, field->textLength);
+
+		Value arg = getArg(state, tmpl, &field->arg, error);
+		if (ELOX_UNLIKELY(error->raised))
+			return false;
+
+		FmtSpec spec = field->spec;
+		if (field->argWidth) {
+			spec.width = toInteger(runCtx, getArg(state, tmpl, &field->width, error), error);
+			if (ELOX_UNLIKELY(error->raised))
+				return false;
+		}
+		if (field->argPrecision) {
+			spec.precision = toInteger(runCtx, getArg(state, tmpl, &field->precision, error), error);
+			if (ELOX_UNLIKELY(error->raised))
+				return false;
+		}
+
+		dump(state, &spec, arg, error);
+		if (ELOX_UNLIKELY(error->raised))
+			return false;
+	}
+
+	if (tmpl->tailLength > 0)
+		heapStringAddString(runCtx, state->output, tmpl->text + tmpl->tailOffset, tmpl->tailLength);
+	return true;
+}
+
 static bool format(Args *args, HeapCString *output) {
 	RunCtx *runCtx = args->runCtx;
 
 	ObjString *str = AS_STRING(getValueArg(args, 0));
 
+	initHeapStringWithSize(runCtx, output, str->string.length + 1);
+
+	EloxError error = ELOX_ERROR_INITIALIZER;
+
+	FmtTemplate *tmpl = getTemplate(runCtx, str, &error);
+	if (ELOX_UNLIKELY(error.raised))
+		return false;
+
 	FmtState state = {
 		.runCtx = runCtx,
-		.ptr = str->string.chars,
-		.end = str->string.chars + str->string.length,
 		.args = args,
 		.maxArg = args->count - 1,
-		.autoIdx = 0,
 		.output = output
 	};
 
-	initHeapStringWithSize(runCtx, output, str->string.length + 1);
-
-	while (state.ptr < state.end) {
-		const uint8_t *ptr = state.ptr;
-
-		while ((ptr < state.end) && (*ptr != '{') && (*ptr != '}'))
-			ptr++;
-		heapStringAddString(runCtx, output, state.ptr, ptr - state.ptr);
-		state.ptr = ptr;
+	// toString() may run other formats and evict the template
+	retainProgram(&tmpl->program);
+	bool ret = formatFields(&state, tmpl, &error);
+	releaseProgram(runCtx, &tmpl->program);
 
-		if (state.ptr >= state.end)
-			break;
-		if (state.ptr[0] == state.ptr[1]) {
-			// escaped bracket
-			heapStringAddChar(runCtx, output, state.ptr[0]);
-			state.ptr += 2;
-		} else {
-			if ((*state.ptr++ == '}') || (state.ptr >= state.end)) {
-				runtimeError(runCtx, "Single '%c' in format string", *(state.ptr - 1));
-				return false;
-			}
-
-			EloxError error = ELOX_ERROR_INITIALIZER;
-
-			FmtSpec spec = { 0 };
-			parse(&state, &spec, &error);
-			if (ELOX_UNLIKELY(error.raised))
-				return false;
-			dump(&state, &spec, &error);
-			if (ELOX_UNLIKELY(error.raised))
-				return false;
-		}
-	}
-
-	return true;
+	return ret;
 }
 
 Value stringFmt(Args *args) {
@@ -683,7 +882,7 @@ Value stringFmt(Args *args) {
 		return EXCEPTION_VAL;
 	}
 
-	ObjString *str = takeString(runCtx, output.chars, output.length, output.capacity);
+	ObjString *str = takeTransientString(runCtx, output.chars, output.length, output.capacity);
 	if (ELOX_UNLIKELY(str == NULL))
 		return oomError(runCtx);
 	return OBJ_VAL(str);
@@ -0,0 +1,261 @@
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+// with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <elox/builtins/simd.h>
+#include <elox/builtins/string.h>
+
+#include <string.h>
+
+#ifdef ELOX_ENABLE_SIMD
+#include <immintrin.h>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+static inline bool hasAVX2(void) {
+	return __builtin_cpu_supports("avx2");
+}
+#endif // ELOX_ENABLE_SIMD
+
+/*
+ * Based on the "Not So Naive" algorithm from
+ * http://www-igm.univ-mlv.fr/~lecroq/string/
+ */
+static const uint8_t *memFindScalar(const uint8_t *haystack, size_t haystackLen,
+									const uint8_t *needle, size_t needleLen) {
+	if (needleLen > haystackLen)
+		return NULL;
+
+	const uint8_t *y = haystack;
+	const uint8_t *x = needle;
+	size_t j = 0;
+	size_t k = 1;
+	size_t ell = 2;
+	if (x[0] == x[1]) {
+		k = 2;
+		ell = 1;
+	}
+	while (j <= haystackLen - needleLen) {
+		if (x[1] != y[j + 1])
+			j += k;
+		else {
+			if (!memcmp(x + 2, y + j + 2, needleLen - 2) && x[0] == y[j])
+				return &y[j];
+			j += ell;
+		}
+	}
+	return NULL;
+}
+
+#ifdef ELOX_ENABLE_SIMD
+
+// Compare the first and last needle bytes at every position of a block,
+// only candidates matching both are checked with memcmp
+
+static const uint8_t *memFindSSE2(const uint8_t *haystack, size_t haystackLen,
+								  const uint8_t *needle, size_t needleLen) {
+	const __m128i first = _mm_set1_epi8((char)needle[0]);
+	const __m128i last = _mm_set1_epi8((char)needle[needleLen - 1]);
+	size_t i = 0;
+	for (; i + needleLen - 1 + 16 <= haystackLen; i += 16) {
+		__m128i blockFirst = _mm_loadu_si128((const __m128i *)(haystack + i));
+		__m128i blockLast = _mm_loadu_si128((const __m128i *)(haystack + i + needleLen - 1));
+		uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst),
+														_mm_cmpeq_epi8(last, blockLast)));
+		while (mask != 0) {
+			unsigned int pos = __builtin_ctz(mask);
+			if (memcmp(haystack + i + pos + 1, needle + 1, needleLen - 2) == 0)
+				return haystack + i + pos;
+			mask &= mask - 1;
+		}
+	}
+	return memFindScalar(haystack + i, haystackLen - i, needle, needleLen);
+}
+
+AVX2_TARGET
+static const uint8_t *memFindAVX2(const uint8_t *haystack, size_t haystackLen,
+								  const uint8_t *needle, size_t needleLen) {
+	const __m256i first = _mm256_set1_epi8((char)needle[0]);
+	const __m256i last = _mm256_set1_epi8((char)needle[needleLen - 1]);
+	size_t i = 0;
+	for (; i + needleLen - 1 + 32 <= haystackLen; i += 32) {
+		__m256i blockFirst = _mm256_loadu_si256((const __m256i *)(haystack + i));
+		__m256i blockLast = _mm256_loadu_si256((const __m256i *)(haystack + i + needleLen - 1));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst),
+															  _mm256_cmpeq_epi8(last, blockLast)));
+		while (mask != 0) {
+			unsigned int pos = __builtin_ctz(mask);
+			if (memcmp(haystack + i + pos + 1, needle + 1, needleLen - 2) == 0)
+				return haystack + i + pos;
+			mask &= mask - 1;
+		}
+	}
+	return memFindSSE2(haystack + i, haystackLen - i, needle, needleLen);
+}
+
+#endif // ELOX_ENABLE_SIMD
+
+const uint8_t *memFind(const uint8_t *haystack, size_t haystackLen,
+					   const uint8_t *needle, size_t needleLen) {
+	if (needleLen == 0)
+		return haystack;
+	if (needleLen > haystackLen)
+		return NULL;
+	if (needleLen == 1)
+		return memchr(haystack, needle[0], haystackLen);
+#ifdef ELOX_ENABLE_SIMD
+	if (hasAVX2())
+		return memFindAVX2(haystack, haystackLen, needle, needleLen);
+	return memFindSSE2(haystack, haystackLen, needle, needleLen);
+#else
+	return memFindScalar(haystack, haystackLen, needle, needleLen);
+#endif
+}
+
+#ifdef ELOX_ENABLE_SIMD
+
+// 0x20 is subtracted from (upper) or added to (lower) every byte in
+// [from, from + 25], using a signed compare on the biased value as an
+// unsigned range check
+
+static size_t caseMapSSE2(uint8_t *dst, const uint8_t *src, size_t len, char from, bool upper) {
+	const __m128i bias = _mm_set1_epi8((char)(0x80 - from));
+	const __m128i limit = _mm_set1_epi8((char)(0x80 + 26));
+	const __m128i delta = _mm_set1_epi8(0x20);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i inRange = _mm_cmplt_epi8(_mm_add_epi8(v, bias), limit);
+		__m128i d = _mm_and_si128(inRange, delta);
+		v = upper ? _mm_sub_epi8(v, d) : _mm_add_epi8(v, d);
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+	return i;
+}
+
+AVX2_TARGET
+static size_t caseMapAVX2(uint8_t *dst, const uint8_t *src, size_t len, char from, bool upper) {
+	const __m256i bias = _mm256_set1_epi8((char)(0x80 - from));
+	const __m256i limit = _mm256_set1_epi8((char)(0x80 + 26));
+	const __m256i delta = _mm256_set1_epi8(0x20);
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i inRange = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, bias));
+		__m256i d = _mm256_and_si256(inRange, delta);
+		v = upper ? _mm256_sub_epi8(v, d) : _mm256_add_epi8(v, d);
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+	return i;
+}
+
+static size_t caseMap(uint8_t *dst, const uint8_t *src, size_t len, char from, bool upper) {
+	if (hasAVX2())
+		return caseMapAVX2(dst, src, len, from, upper);
+	return caseMapSSE2(dst, src, len, from, upper);
+}
+
+#endif // ELOX_ENABLE_SIMD
+
+void asciiUpper(uint8_t *dst, const uint8_t *src, size_t len) {
+	size_t i = 0;
+#ifdef ELOX_ENABLE_SIMD
+	i = caseMap(dst, src, len, 'a', true);
+#endif
+	for (; i < len; i++)
+		dst[i] = upperLookup[src[i]];
+}
+
+void asciiLower(uint8_t *dst, const uint8_t *src, size_t len) {
+	size_t i = 0;
+#ifdef ELOX_ENABLE_SIMD
+	i = caseMap(dst, src, len, 'A', false);
+#endif
+	for (; i < len; i++)
+		dst[i] = lowerLookup[src[i]];
+}
+
+#ifdef ELOX_ENABLE_SIMD
+
+// Same set as the W entries of eloxCTable: \t \n \r and space
+
+static inline uint32_t whitespaceMaskSSE2(__m128i v) {
+	__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+										   _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+							  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+										   _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+	return (uint32_t)_mm_movemask_epi8(ws);
+}
+
+AVX2_TARGET
+static inline uint32_t whitespaceMaskAVX2(__m256i v) {
+	__m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+												 _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+								 _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+												 _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+	return (uint32_t)_mm256_movemask_epi8(ws);
+}
+
+// Both return the offset where scalar scanning has to continue
+
+static size_t skipLeadingSSE2(const uint8_t *str, size_t len) {
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		uint32_t mask = whitespaceMaskSSE2(_mm_loadu_si128((const __m128i *)(str + i)));
+		if (mask != 0xFFFF)
+			return i + __builtin_ctz(~mask);
+	}
+	return i;
+}
+
+AVX2_TARGET
+static size_t skipLeadingAVX2(const uint8_t *str, size_t len) {
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		uint32_t mask = whitespaceMaskAVX2(_mm256_loadu_si256((const __m256i *)(str + i)));
+		if (mask != 0xFFFFFFFF)
+			return i + __builtin_ctz(~mask);
+	}
+	return i;
+}
+
+static size_t trimTrailingSSE2(const uint8_t *str, size_t len) {
+	size_t end = len;
+	for (; end >= 16; end -= 16) {
+		uint32_t mask = whitespaceMaskSSE2(_mm_loadu_si128((const __m128i *)(str + end - 16)));
+		if (mask != 0xFFFF)
+			return end - 16 + (32 - __builtin_clz(~mask & 0xFFFF));
+	}
+	return end;
+}
+
+AVX2_TARGET
+static size_t trimTrailingAVX2(const uint8_t *str, size_t len) {
+	size_t end = len;
+	for (; end >= 32; end -= 32) {
+		uint32_t mask = whitespaceMaskAVX2(_mm256_loadu_si256((const __m256i *)(str + end - 32)));
+		if (mask != 0xFFFFFFFF)
+			return end - 32 + (32 - __builtin_clz(~mask));
+	}
+	return end;
+}
+
+#endif // ELOX_ENABLE_SIMD
+
+size_t skipLeadingWhitespace(const uint8_t *str, size_t len) {
+	size_t i = 0;
+#ifdef ELOX_ENABLE_SIMD
+	i = hasAVX2() ? skipLeadingAVX2(str, len) : skipLeadingSSE2(str, len);
+#endif
+	for (; (i < len) && isWhitespace(str[i]); i++);
+	return i;
+}
+
+size_t trimTrailingWhitespace(const uint8_t *str, size_t len) {
+	size_t end = len;
+#ifdef ELOX_ENABLE_SIMD
+	end = hasAVX2() ? trimTrailingAVX2(str, len) : trimTrailingSSE2(str, len);
+#endif
+	for (; (end > 0) && isWhitespace(str[end - 1]); end--);
+	return end;
+}
@@ -3,6 +3,7 @@
 // with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <elox/builtins/string.h>
+#include <elox/builtins/simd.h>
 #include <elox/state.h>
 
 #include <string.h>
@@ -52,7 +53,7 @@ Value stringAtSafe(RunCtx *runCtx, ObjString *str, int32_t index) {
 	if (ELOX_UNLIKELY((realIndex < 0) || (realIndex > str->string.length - 1)))
 		return runtimeError(runCtx, "String index out of range");
 
-	ObjString *ret = copyString(runCtx, str->string.chars + realIndex, 1);
+	ObjString *ret = copyTransientString(runCtx, str->string.chars + realIndex, 1);
 	if (ELOX_UNLIKELY(ret == NULL))
 		return oomError(runCtx);
 	return OBJ_VAL(ret);
@@ -141,11 +142,10 @@ Value stringUpper(Args *args) {
 
 	const uint8_t *src = (const uint8_t *)inst->string.chars;
 	uint8_t *dst = result.chars;
-	for (int i = 0; i < inst->string.length; i++)
-		dst[i] = upperLookup[src[i]];
+	asciiUpper(dst, src, inst->string.length);
 	dst[inst->string.length] = '\0';
 	result.length = inst->string.length;
-	ObjString *str = takeString(runCtx, result.chars, result.length, result.capacity);
+	ObjString *str = takeTransientString(runCtx, result.chars, result.length, result.capacity);
 	if (ELOX_UNLIKELY(str == NULL))
 		return oomError(runCtx);
 	return OBJ_VAL(str);
@@ -161,11 +161,10 @@ Value stringLower(Args *args) {
 
 	const uint8_t *src = (const uint8_t *)inst->string.chars;
 	uint8_t *dst = result.chars;
-	for (int i = 0; i < inst->string.length; i++)
-		dst[i] = lowerLookup[src[i]];
+	asciiLower(dst, src, inst->string.length);
 	dst[inst->string.length] = '\0';
 	result.length = inst->string.length;
-	ObjString *str = takeString(runCtx, result.chars, result.length, result.capacity);
+	ObjString *str = takeTransientString(runCtx, result.chars, result.length, result.capacity);
 	if (ELOX_UNLIKELY(str == NULL))
 		return oomError(runCtx);
 	return OBJ_VAL(str);
@@ -178,15 +177,12 @@ Value stringTrim(Args *args) {
 
 	const uint8_t *str = (const uint8_t *)inst->string.chars;
 	int32_t len = inst->string.length;
-	int32_t a;
-	int32_t b;
-
-	for (a = 0; (a < len) && isWhitespace(str[a]); a++);
-	for (b = len; (b > 0) && isWhitespace(str[b - 1]); b--);
+	int32_t a = skipLeadingWhitespace(str, len);
+	int32_t b = trimTrailingWhitespace(str, len);
 
 	ObjString *ret;
 	if (b > a)
-		ret = copyString(runCtx, str + a, b - a);
+		ret = newStringView(runCtx, inst, a, b - a);
 	else
 		ret = copyString(runCtx, ELOX_USTR_AND_LEN(""));
 	if (ELOX_UNLIKELY(ret == NULL))
@@ -194,51 +190,9 @@ Value stringTrim(Args *args) {
 	return OBJ_VAL(ret);
 }
 
-#if defined(__GNUC__)
-void *memmem(const void *haystack, size_t haystackLen, const void *needle, size_t needleLen);
-#else
-
-#include <string.h>
-
-/*
- * Based on the "Not So Naive" algorithm from
- * http://www-igm.univ-mlv.fr/~lecroq/string/
- */
-static void *memmem(const void *haystack, size_t haystackLen, const void *needle, size_t needleLen) {
-	if (needleLen > haystackLen || !needleLen || !haystackLen)
-		return NULL;
-
-	if (ELOX_LIKELY(needleLen > 1)) {
-		const uint8_t* y = (const uint8_t *) haystack;
-		const uint8_t* x = (const uint8_t *) needle;
-		size_t j = 0;
-		size_t k = 1;
-		size_t ell = 2;
-		if (x[0] == x[1]) {
-			k = 2;
-			ell = 1;
-		}
-		while (j <= haystackLen - needleLen) {
-			if (x[1] != y[j+1])
-				j += k;
-			else {
-				if (!memcmp(x + 2, y + j + 2, needleLen - 2) && x[0] == y[j])
-					return (void *) &y[j];
-				j += ell;
-			}
-		}
-	} else {
-		// single char needle
-		return memchr(haystack, ((unsigned char*)needle)[0], haystackLen);
-	}
-	return NULL;
-}
-
-#endif // __GNUC__
-
 bool stringContains(const ObjString *seq, const ObjString *needle) {
-	return memmem(seq->string.chars, seq->string.length,
-				  needle->string.chars, needle->string.length) != NULL;
+	return memFind(seq->string.chars, seq->string.length,
+				   needle->string.chars, needle->string.length) != NULL;
 }
 
 Value stringSlice(RunCtx *runCtx, ObjString *str, Value start, Value end) {
@@ -251,7 +205,7 @@ Value stringSlice(RunCtx *runCtx, ObjString *str, Value start, Value end) {
 
 	ObjString *ret;
 	if (sliceSize > 0)
-		ret = copyString(runCtx, str->string.chars + sliceStart, sliceSize);
+		ret = newStringView(runCtx, str, sliceStart, sliceSize);
 	else
 		ret = copyString(runCtx, ELOX_USTR_AND_LEN(""));
 	if (ELOX_UNLIKELY(ret == NULL))
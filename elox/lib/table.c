@@ -199,11 +199,14 @@ bool tableGetString(Table *table, const uint8_t *chars, int length, uint32_t has
 	}
 }
 
-void tableRemoveWhite(Table *table) {
+void tableRemoveWhite(Table *table, uint8_t liveMask) {
 	for (int i = 0; i < table->capacity; i++) {
 		Entry *entry = &table->entries[i];
-		if (entry->key != NULL && (entry->key->obj.markers == 0))
+		if (entry->key != NULL && !(entry->key->obj.markers & liveMask)) {
 			tableDelete(table, entry->key);
+			// deletion may have shifted another entry into this slot
+			i--;
+		}
 	}
 }
 
@@ -25,6 +25,7 @@
 
 #include "elox/vm.h"
 #include "elox/state.h"
+#include "elox/builtins/simd.h"
 
 #include <ctype.h>
 #include <string.h>
@@ -32,8 +33,6 @@
 // Maximum of captures we can return.
 #define MAX_CAPTURES 32
 
-#define MAXDEPTH 200
-
 // Pattern escape"character
 #define PATTERN_ESC		'%'
 
@@ -49,12 +48,78 @@ typedef enum {
 	REPL_CALLABLE
 } ReplType;
 
+typedef enum {
+	PAT_CHAR,     // single byte
+	PAT_ANY,      // .
+	PAT_SET,      // class (%a) or set ([...]), as a bitmap
+	PAT_OPEN,     // (
+	PAT_POSITION, // ()
+	PAT_CLOSE,    // )
+	PAT_BALANCE,  // %bxy
+	PAT_FRONTIER, // %f[set]
+	PAT_BACKREF,  // %1-%9
+	PAT_END       // $ at the end of the pattern
+} PatternOp;
+
+typedef struct {
+	uint8_t op;
+	// repetition suffix (* + - ?) of single char items, 0 if none
+	uint8_t rep;
+	// PAT_CHAR byte, PAT_BALANCE delimiters or PAT_BACKREF digit
+	uint8_t a;
+	uint8_t b;
+	// bitmap index for PAT_SET and PAT_FRONTIER
+	uint16_t set;
+} PatternInst;
+
+#define SET_WORDS (256 / 32)
+
+typedef enum {
+	BT_SKIP,    // ? item, retry without it
+	BT_SHORTER, // * or + item, retry with one repetition less
+	BT_LONGER   // - item, retry with one repetition more
+} BacktrackKind;
+
+typedef struct {
+	uint8_t kind;
+	int16_t level;
+	// trail length when the alternative was pushed
+	int32_t trail;
+	const PatternInst *p;
+	const char *s;
+	// repetitions left to give back (BT_SHORTER)
+	ptrdiff_t count;
+} Backtrack;
+
+typedef struct CompiledPattern {
+	CachedProgram program;
+	bool anchor;
+	// only plain bytes, matches are found by searching for the prefix
+	bool literal;
+	// bitmap index of the first item, if it has to match at least once
+	int32_t firstSet;
+	int32_t codeLen;
+	// every match starts with these bytes
+	int32_t prefixLen;
+	uint32_t *sets;
+	PatternInst *code;
+	uint8_t *prefix;
+	// matcher scratch space. Every item is visited at most once along a
+	// match path, so both are bounded by the program length. Matching
+	// never reenters, the program owns them
+	Backtrack *stack;
+	int16_t *trail;
+} CompiledPattern;
+
 typedef struct MatchState {
 	RunCtx *runCtx;
-	int matchdepth;
+	ObjString *src; // captures are views of it
 	const char *src_init;
 	const char *src_end;
-	const char *p_end;
+	const uint32_t *sets;
+	const PatternInst *code_end;
+	Backtrack *stack;
+	int16_t *trail; // closed captures, in order
 	int16_t level; // total number of captures (finished or unfinished)
 	struct {
 		const char *init;
@@ -79,24 +144,22 @@ static int capture_to_close(MatchState *ms, EloxError *error) {
 	ELOX_THROW_RET_VAL(error, RTERR(ms->runCtx, "invalid pattern capture"), -1);
 }
 
-static const char *classend(MatchState *ms, const char *p, EloxError *error) {
-	RunCtx *runCtx = ms->runCtx;
-
+static const char *classend(RunCtx *runCtx, const char *p, const char *p_end, EloxError *error) {
 	switch (*p++) {
 		case PATTERN_ESC: {
-			ELOX_CHECK_THROW_RET_VAL(p != ms->p_end, error,
+			ELOX_CHECK_THROW_RET_VAL(p != p_end, error,
 									 RTERR(runCtx, "malformed pattern (ends with " QL("%%") ")"), NULL);
 			return p+1;
 		}
 		case '[': {
-			if (*p == '^')
+			if ((p != p_end) && (*p == '^'))
 				p++;
 			do {  // look for a `]'
-				ELOX_CHECK_THROW_RET_VAL(p != ms->p_end, error,
+				ELOX_CHECK_THROW_RET_VAL(p != p_end, error,
 										 RTERR(runCtx, "malformed pattern (missing " QL("]") ")"), NULL);
-				if (*(p++) == PATTERN_ESC && p < ms->p_end)
+				if (*(p++) == PATTERN_ESC && p < p_end)
 					p++;  // skip escapes (e.g. `%]')
-			} while (*p != ']');
+			} while ((p == p_end) || (*p != ']'));
 			return p + 1;
 		}
 		default: {
@@ -156,107 +219,265 @@ static int matchbracketclass(int c, const char *p, const char *ec) {
 	return !sig;
 }
 
-static int singlematch(MatchState *ms, const char *s, const char *p, const char *ep) {
-	if (s >= ms->src_end)
-		return 0;
-	else {
-		int c = uchar(*s);
-		switch (*p) {
-			case '.':
-				return 1;  // matches any char
-			case PATTERN_ESC:
-				return match_class(c, uchar(*(p + 1)));
-			case '[':
-				return matchbracketclass(c, p, ep - 1);
-			default:
-				return (uchar(*p) == c);
-		}
+static int singlematch(int c, const char *p, const char *ep) {
+	switch (*p) {
+		case '.':
+			return 1;  // matches any char
+		case PATTERN_ESC:
+			return match_class(c, uchar(*(p + 1)));
+		case '[':
+			return matchbracketclass(c, p, ep - 1);
+		default:
+			return (uchar(*p) == c);
 	}
 }
 
-static const char *matchbalance(MatchState *ms, const char *s, const char *p, EloxError *error) {
-	ELOX_CHECK_THROW_RET_VAL(p < ms->p_end - 1, error,
-							 RTERR(ms->runCtx, "malformed pattern (missing arguments to " QL("%%b") ")"), NULL);
-	if (*s != *p)
-		return NULL;
-	else {
-		int b = *p;
-		int e = *(p+1);
-		int cont = 1;
-		while (++s < ms->src_end) {
-			if (*s == e) {
-				if (--cont == 0)
-					return s+1;
-			} else if (*s == b)
-				cont++;
+static inline bool inSet(const uint32_t *sets, uint16_t set, int c) {
+	return (sets[set * SET_WORDS + (c >> 5)] >> (c & 31)) & 1;
+}
+
+/// Evaluates a class item for every byte value, returns the number of bytes it matches
+static int buildSet(uint32_t *bits, const char *p, const char *ep) {
+	int count = 0;
+	memset(bits, 0, SET_WORDS * sizeof(uint32_t));
+	for (int c = 0; c < 256; c++) {
+		if (singlematch(c, p, ep)) {
+			bits[c >> 5] |= (uint32_t)1 << (c & 31);
+			count++;
 		}
 	}
-	return NULL;  /* string ends out of balance */
+	return count;
 }
 
-static const char *match(MatchState *ms, const char *s, const char *p, EloxError *error);
+static CachedProgram *compilePattern(RunCtx *runCtx, ObjString *pattern, uint8_t anchorable,
+									 EloxError *error) {
+	const char *p = (const char *)pattern->string.chars;
+	int32_t lp = pattern->string.length;
+	bool anchor = anchorable && (lp > 0) && (*p == '^');
+	if (anchor) {
+		p++;
+		lp--;
+	}
+	const char *p_end = p + lp;
 
-static const char *max_expand(MatchState *ms, const char *s, const char *p, const char *ep,
-							  EloxError *error) {
-	ptrdiff_t i = 0;  /* counts maximum expand for item */
-	while (singlematch(ms, s + i, p, ep))
-		i++;
-	/* keeps trying to match with the maximum repetitions */
-	while (i>=0) {
-		const char *res = match(ms, (s + i), ep + 1, error);
-		if (ELOX_UNLIKELY(error->raised))
-			return NULL;
-		if (res)
-			return res;
-		i--;  /* else didn't match; reduce 1 repetition to try again */
+	// every item takes at least one pattern byte and sets start with % or [
+	int32_t maxSets = 0;
+	for (const char *q = p; q < p_end; q++) {
+		if ((*q == PATTERN_ESC) || (*q == '['))
+			maxSets++;
 	}
-	return NULL;
-}
+	ELOX_CHECK_THROW_RET_VAL(maxSets <= UINT16_MAX, error, RTERR(runCtx, "pattern too complex"), NULL);
+	size_t size = sizeof(CompiledPattern) + lp * sizeof(Backtrack) +
+				  maxSets * SET_WORDS * sizeof(uint32_t) + lp * sizeof(PatternInst) +
+				  lp * sizeof(int16_t) + lp;
+	CompiledPattern *program = (CompiledPattern *)ALLOCATE(runCtx, uint8_t, size);
+	ELOX_CHECK_THROW_RET_VAL(program != NULL, error, OOM(runCtx), NULL);
+	program->program.refCount = 1;
+	program->anchor = anchor;
+	program->program.size = size;
+	program->stack = (Backtrack *)(program + 1);
+	program->sets = (uint32_t *)(program->stack + lp);
+	program->code = (PatternInst *)(program->sets + maxSets * SET_WORDS);
+	program->trail = (int16_t *)(program->code + lp);
+	program->prefix = (uint8_t *)(program->trail + lp);
+
+	int numSets = 0;
+	int numCaptures = 0;
+	int32_t codeLen = 0;
+	const char *q = p;
+	while (q < p_end) {
+		PatternInst *inst = &program->code[codeLen++];
+		*inst = (PatternInst){ 0 };
+		switch (*q) {
+			case '(':
+				ELOX_CHECK_THROW_GOTO(++numCaptures <= MAX_CAPTURES, error,
+									  RTERR(runCtx, "too many captures"), cleanup);
+				if ((q + 1 < p_end) && (*(q + 1) == ')')) {
+					inst->op = PAT_POSITION;
+					q += 2;
+				} else {
+					inst->op = PAT_OPEN;
+					q++;
+				}
+				continue;
+			case ')':
+				inst->op = PAT_CLOSE;
+				q++;
+				continue;
+			case '$':
+				if (q + 1 != p_end)  // is the `$' the last char in pattern?
+					break;
+				inst->op = PAT_END;
+				q++;
+				continue;
+			case PATTERN_ESC:
+				if (q + 1 == p_end)
+					break;
+				switch (*(q + 1)) {
+					case 'b':  // balanced string
+						ELOX_CHECK_THROW_GOTO(q + 3 < p_end, error,
+											  RTERR(runCtx, "malformed pattern (missing arguments to " QL("%%b") ")"),
+											  cleanup);
+						inst->op = PAT_BALANCE;
+						inst->a = uchar(*(q + 2));
+						inst->b = uchar(*(q + 3));
+						q += 4;
+						continue;
+					case 'f': {  // frontier
+						q += 2;
+						ELOX_CHECK_THROW_GOTO((q < p_end) && (*q == '['), error,
+											  RTERR(runCtx, "missing " QL("[") " after " QL("%%f") " in pattern"),
+											  cleanup);
+						const char *ep = classend(runCtx, q, p_end, error);
+						if (ELOX_UNLIKELY(error->raised))
+							goto cleanup;
+						buildSet(program->sets + numSets * SET_WORDS, q, ep);
+						inst->op = PAT_FRONTIER;
+						inst->set = numSets++;
+						q = ep;
+						continue;
+					}
+					case '0': case '1': case '2': case '3':
+					case '4': case '5': case '6': case '7':
+					case '8': case '9':  // capture results (%0-%9)
+						inst->op = PAT_BACKREF;
+						inst->a = uchar(*(q + 1));
+						q += 2;
+						continue;
+					default:
+						break;
+				}
+				break;
+			default:
+				break;
+		}
 
-static const char *min_expand(MatchState *ms, const char *s, const char *p, const char *ep,
-							  EloxError * error) {
-	for (;;) {
-		const char *res = match(ms, s, ep + 1, error);
+		// pattern class plus optional suffix
+		const char *ep = classend(runCtx, q, p_end, error);
 		if (ELOX_UNLIKELY(error->raised))
-			return NULL;
-		if (res != NULL)
-			return res;
-		else if (singlematch(ms, s, p, ep))
-			s++;  /* try with one more repetition */
-		else
-			return NULL;
+			goto cleanup;
+		uint32_t bits[SET_WORDS];
+		int count = buildSet(bits, q, ep);
+		if (count == 256)
+			inst->op = PAT_ANY;
+		else if (count == 1) {
+			inst->op = PAT_CHAR;
+			for (int c = 0; c < 256; c++) {
+				if (inSet(bits, 0, c)) {
+					inst->a = c;
+					break;
+				}
+			}
+		} else {
+			inst->op = PAT_SET;
+			inst->set = numSets;
+			memcpy(program->sets + numSets * SET_WORDS, bits, sizeof(bits));
+			numSets++;
+		}
+		q = ep;
+		if (q < p_end) {
+			switch (*q) {
+				case '*': case '+': case '-': case '?':
+					inst->rep = uchar(*q);
+					q++;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	program->codeLen = codeLen;
+
+	// Leading bytes shared by all matches. Captures are skipped, they do
+	// not consume input and only a valid close can be stepped over
+	int32_t prefixLen = 0;
+	int32_t first = 0;
+	int openCaptures = 0;
+	for (; first < codeLen; first++) {
+		PatternInst *inst = &program->code[first];
+		if (inst->op == PAT_OPEN)
+			openCaptures++;
+		else if ((inst->op == PAT_CLOSE) && (openCaptures > 0))
+			openCaptures--;
+		else if (inst->op == PAT_POSITION)
+			continue;
+		else if ((inst->op == PAT_CHAR) && ((inst->rep == 0) || (inst->rep == '+'))) {
+			program->prefix[prefixLen++] = inst->a;
+			if (inst->rep != 0)
+				break;
+		} else
+			break;
 	}
+	program->prefixLen = prefixLen;
+	program->literal = (prefixLen > 0) && (prefixLen == codeLen) &&
+					   (program->code[codeLen - 1].rep == 0);
+	program->firstSet = -1;
+	if ((prefixLen == 0) && (first < codeLen)) {
+		PatternInst *inst = &program->code[first];
+		if ((inst->op == PAT_SET) && ((inst->rep == 0) || (inst->rep == '+')))
+			program->firstSet = inst->set;
+	}
+
+	return &program->program;
+
+cleanup:
+	releaseProgram(runCtx, &program->program);
+	return NULL;
 }
 
-static const char *start_capture(MatchState *ms, const char *s, const char *p, int what,
-								 EloxError *error) {
-	const char *res;
-	int level = ms->level;
+// Compiled pattern, cached as described at getCachedProgram
+static CompiledPattern *getPattern(RunCtx *runCtx, ObjString *pattern, bool anchorable,
+								   EloxError *error) {
+	return (CompiledPattern *)getCachedProgram(runCtx, &runCtx->vm->patternCache, pattern,
+											   anchorable, compilePattern, error);
+}
 
-	ELOX_CHECK_THROW_RET_VAL(level < MAX_CAPTURES, error, RTERR(ms->runCtx, "too many captures"), NULL);
-	ms->capture[level].init = s;
-	ms->capture[level].len = what;
-	ms->level = level + 1;
-	res = match(ms, s, p, error);
-	if (ELOX_UNLIKELY(error->raised))
+/// First position at or after s where a match can start, NULL if there is none
+static const char *nextCandidate(const CompiledPattern *program, const char *s, const char *end) {
+	if (program->prefixLen > 0) {
+		return (const char *)memFind((const uint8_t *)s, end - s,
+									 program->prefix, program->prefixLen);
+	}
+	if (program->firstSet >= 0) {
+		for (; s < end; s++) {
+			if (inSet(program->sets, program->firstSet, uchar(*s)))
+				return s;
+		}
 		return NULL;
-	if (res == NULL)  // match failed?
-		ms->level--;  // undo capture
-	return res;
+	}
+	return s;
 }
 
-static const char *end_capture(MatchState *ms, const char *s, const char *p, EloxError *error) {
-	int l = capture_to_close(ms, error);
-	if (ELOX_UNLIKELY(error->raised))
-		return NULL;
-	const char *res;
-	ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
-	res = match(ms, s, p, error);
-	if (ELOX_UNLIKELY(error->raised))
+static inline bool singleMatch(MatchState *ms, const char *s, const PatternInst *inst) {
+	if (s >= ms->src_end)
+		return false;
+	int c = uchar(*s);
+	switch (inst->op) {
+		case PAT_CHAR:
+			return inst->a == c;
+		case PAT_ANY:
+			return true;
+		default:
+			return inSet(ms->sets, inst->set, c);
+	}
+}
+
+static const char *matchbalance(MatchState *ms, const char *s, const PatternInst *inst) {
+	if ((s >= ms->src_end) || (uchar(*s) != inst->a))
 		return NULL;
-	if (res == NULL)  /* match failed? */
-		ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
-	return res;
+	else {
+		int b = inst->a;
+		int e = inst->b;
+		int cont = 1;
+		while (++s < ms->src_end) {
+			if (uchar(*s) == e) {
+				if (--cont == 0)
+					return s+1;
+			} else if (uchar(*s) == b)
+				cont++;
+		}
+	}
+	return NULL;  /* string ends out of balance */
 }
 
 static const char *match_capture(MatchState *ms, const char *s, int l, EloxError *error) {
@@ -271,132 +492,135 @@ static const char *match_capture(MatchState *ms, const char *s, int l, EloxError
 		return NULL;
 }
 
-static const char *match(MatchState *ms, const char *s, const char *p, EloxError *error) {
-	RunCtx *runCtx = ms->runCtx;
+/// Matches the program from p at s, returns the end of the match or NULL.
+/// Alternatives are kept on the explicit backtrack stack of the program,
+/// tried most recent first, in the same order as Lua's recursive matcher
+static const char *match(MatchState *ms, const char *s, const PatternInst *p, EloxError *error) {
+	Backtrack *stack = ms->stack;
+	int16_t *trail = ms->trail;
+	int32_t sp = 0;
+	int32_t trailLen = 0;
 
-	ELOX_CHECK_THROW_RET_VAL(ms->matchdepth-- != 0, error, RTERR(runCtx, "pattern too complex"), NULL);
-init: /* using goto's to optimize tail recursion */
-	if (p != ms->p_end) {  /* end of pattern? */
-		switch (*p) {
-			case '(': {  /* start capture */
-				if (*(p + 1) == ')')  /* position capture? */
-					s = start_capture(ms, s, p + 2, CAP_POSITION, error);
-				else
-					s = start_capture(ms, s, p + 1, CAP_UNFINISHED, error);
-				if (ELOX_UNLIKELY(error->raised))
-					return NULL;
-				break;
+	for (;;) {
+		if (p == ms->code_end)
+			return s;
+
+		switch (p->op) {
+			case PAT_OPEN:
+			case PAT_POSITION: {
+				int16_t level = ms->level;
+				ms->capture[level].init = s;
+				ms->capture[level].len = (p->op == PAT_OPEN) ? CAP_UNFINISHED : CAP_POSITION;
+				ms->level = level + 1;
+				p++;
+				continue;
 			}
-			case ')': {  /* end capture */
-				s = end_capture(ms, s, p + 1, error);
+			case PAT_CLOSE: {
+				int l = capture_to_close(ms, error);
 				if (ELOX_UNLIKELY(error->raised))
 					return NULL;
-				break;
+				ms->capture[l].len = s - ms->capture[l].init;
+				// reopened if we backtrack past this point
+				trail[trailLen++] = l;
+				p++;
+				continue;
 			}
-			case '$': {
-				if ((p + 1) != ms->p_end)  /* is the `$' the last char in pattern? */
-					goto dflt;  /* no; go to default */
-				s = (s == ms->src_end) ? s : NULL;  /* check end of string */
-				break;
+			case PAT_END:
+				if (s != ms->src_end)
+					break;
+				p++;
+				continue;
+			case PAT_BALANCE:
+				s = matchbalance(ms, s, p);
+				if (s == NULL)
+					break;
+				p++;
+				continue;
+			case PAT_FRONTIER: {
+				int previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+				int current = (s < ms->src_end) ? uchar(*s) : '\0';
+				if (inSet(ms->sets, p->set, previous) || !inSet(ms->sets, p->set, current))
+					break;
+				p++;
+				continue;
 			}
-			case PATTERN_ESC: {  /* escaped sequences not in the format class[*+?-]? */
-				switch (*(p + 1)) {
-					case 'b': {  /* balanced string? */
-						s = matchbalance(ms, s, p + 2, error);
-						if (ELOX_UNLIKELY(error->raised))
-							return NULL;
-						if (s != NULL) {
-							p += 4;
-							goto init;  /* return match(ms, s, p + 4); */
-						}  /* else fail (s == NULL) */
+			case PAT_BACKREF:
+				s = match_capture(ms, s, p->a, error);
+				if (ELOX_UNLIKELY(error->raised))
+					return NULL;
+				if (s == NULL)
+					break;
+				p++;
+				continue;
+			default: {  // single char class plus optional suffix
+				if (!singleMatch(ms, s, p)) {
+					if ((p->rep != '*') && (p->rep != '?') && (p->rep != '-'))
 						break;
-					}
-					case 'f': {  /* frontier? */
-						const char *ep;
-						char previous;
-						p += 2;
-						ELOX_CHECK_THROW_RET_VAL(*p == '[', error,
-												 RTERR(runCtx, "missing " QL("[") " after " QL("%%f") " in pattern"), NULL);
-						ep = classend(ms, p, error);  /* points to what is next */
-						if (ELOX_UNLIKELY(error->raised))
-							return NULL;
-						previous = (s == ms->src_init) ? '\0' : *(s - 1);
-						if (!matchbracketclass(uchar(previous), p, ep - 1) && matchbracketclass(uchar(*s), p, ep - 1)) {
-							p = ep;
-							goto init;  /* return match(ms, s, ep); */
-						}
-						s = NULL;  /* match failed */
+					p++;  // accept empty
+					continue;
+				}
+				switch (p->rep) {
+					case '?':
+						stack[sp++] = (Backtrack){
+							.kind = BT_SKIP, .p = p, .s = s, .level = ms->level, .trail = trailLen
+						};
+						s++;
 						break;
-					}
-					case '0': case '1': case '2': case '3':
-					case '4': case '5': case '6': case '7':
-					case '8': case '9': {  /* capture results (%0-%9)? */
-						s = match_capture(ms, s, uchar(*(p + 1)), error);
-						if (ELOX_UNLIKELY(error->raised))
-							return NULL;
-						if (s != NULL) {
-							p += 2;
-							goto init;  /* return match(ms, s, p + 2) */
+					case '+':
+						s++;  // 1 match already done
+						// FALLTHROUGH
+					case '*': {  // longest run first, then give back one at a time
+						ptrdiff_t i = 0;
+						while (singleMatch(ms, s + i, p))
+							i++;
+						if (i > 0) {
+							stack[sp++] = (Backtrack){
+								.kind = BT_SHORTER, .p = p, .s = s, .count = i,
+								.level = ms->level, .trail = trailLen
+							};
 						}
+						s += i;
 						break;
 					}
+					case '-':  // no repetitions first, then one more at a time
+						stack[sp++] = (Backtrack){
+							.kind = BT_LONGER, .p = p, .s = s, .level = ms->level, .trail = trailLen
+						};
+						break;
 					default:
-						goto dflt;
+						s++;
+						break;
 				}
-				break;
+				p++;
+				continue;
 			}
-			default:
-dflt:		{  /* pattern class plus optional suffix */
-				const char *ep = classend(ms, p, error);  /* points to optional suffix */
-				if (ELOX_UNLIKELY(error->raised))
-					return NULL;
-				/* does not match at least once? */
-				if (!singlematch(ms, s, p, ep)) {
-					if (*ep == '*' || *ep == '?' || *ep == '-') {  /* accept empty? */
-						p = ep + 1;
-						goto init;  /* return match(ms, s, ep + 1); */
-					} else  /* '+' or no suffix */
-						s = NULL;  /* fail */
-				} else {  /* matched once */
-					switch (*ep) {  /* handle optional suffix */
-						case '?': {  /* optional */
-							const char *res;
-							res = match(ms, s + 1, ep + 1, error);
-							if (ELOX_UNLIKELY(error->raised))
-								return NULL;
-							if (res != NULL)
-								s = res;
-							else {
-								p = ep + 1;
-								goto init;  /* else return match(ms, s, ep + 1); */
-							}
-							break;
-						}
-						case '+':  /* 1 or more repetitions */
-							s++;  /* 1 match already done */
-							// FALLTHROUGH
-						case '*':  /* 0 or more repetitions */
-							s = max_expand(ms, s, p, ep, error);
-							if (ELOX_UNLIKELY(error->raised))
-								return NULL;
-							break;
-						case '-':  /* 0 or more repetitions (minimum) */
-							s = min_expand(ms, s, p, ep, error);
-							if (ELOX_UNLIKELY(error->raised))
-								return NULL;
-							break;
-						default:  /* no suffix */
-							s++;
-							p = ep;
-							goto init;  /* return match(ms, s + 1, ep); */
-					}
-				}
+		}
+
+		// failed, resume the most recent alternative
+		for (;;) {
+			if (sp == 0)
+				return NULL;
+			Backtrack *bt = &stack[sp - 1];
+			ms->level = bt->level;
+			while (trailLen > bt->trail)
+				ms->capture[trail[--trailLen]].len = CAP_UNFINISHED;
+			p = bt->p + 1;
+			if (bt->kind == BT_SKIP) {
+				s = bt->s;
+				sp--;
+				break;
+			} else if (bt->kind == BT_SHORTER) {
+				s = bt->s + (--bt->count);
+				if (bt->count == 0)
+					sp--;
+				break;
+			} else if (singleMatch(ms, bt->s, bt->p)) {
+				s = ++bt->s;
 				break;
 			}
+			sp--;
 		}
 	}
-	ms->matchdepth++;
-	return s;
 }
 
 /// Translates a relative string position: negative means back from end
@@ -414,7 +638,7 @@ static Value getCapture(MatchState *ms, int i, const char *s, const char *e, Elo
 
 	if (i >= ms->level) { // TODO ??? >=
 		if (i == 0) {  /* ms->level == 0, too */
-			ObjString *str = copyString(runCtx, (const uint8_t *)s, e - s); /* add whole match */
+			ObjString *str = newStringView(runCtx, ms->src, s - ms->src_init, e - s); /* add whole match */
 			ELOX_CHECK_THROW_RET_VAL(str != NULL, error, OOM(runCtx), NIL_VAL);
 			return OBJ_VAL(str);
 		} else
@@ -425,7 +649,7 @@ static Value getCapture(MatchState *ms, int i, const char *s, const char *e, Elo
 			if (l == CAP_POSITION)
 				return NUMBER_VAL(ms->capture[i].init - ms->src_init);
 			else {
-				ObjString *str = copyString(runCtx, (const uint8_t *)ms->capture[i].init, l);
+				ObjString *str = newStringView(runCtx, ms->src, ms->capture[i].init - ms->src_init, l);
 				ELOX_CHECK_THROW_RET_VAL(str != NULL, error, OOM(runCtx), NIL_VAL);
 				return OBJ_VAL(str);
 			}
@@ -453,28 +677,6 @@ static void addCapturesToTuple(MatchState *ms, ObjArray *tuple, const char *s, c
 	}
 }
 
-static const char *memFind (const char *s1, size_t l1, const char *s2, size_t l2) {
-	if (l2 == 0)
-		return s1;  /* empty strings are everywhere */
-	else if (l2 > l1)
-		return NULL;  /* avoids a negative `l1' */
-	else {
-		const char *init;  /* to search for a `*s2' inside `s1' */
-		l2--;  /* 1st char will be checked by `memchr' */
-		l1 = l1-l2;  /* `s2' cannot be found after that */
-		while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-			init++;   /* 1st char is already checked */
-			if (memcmp(init, s2 + 1, l2) == 0)
-				return init - 1;
-			else {  /* correct `l1' and `s1' to try again */
-				l1 -= init - s1;
-				s1 = init;
-			}
-		}
-		return NULL;
-	}
-}
-
 static Value doMatch(Args *args, bool plain, bool retPos) {
 	RunCtx *runCtx = args->runCtx;
 	FiberCtx *fiber = runCtx->activeFiber;
@@ -499,7 +701,8 @@ static Value doMatch(Args *args, bool plain, bool retPos) {
 	EloxError error = ELOX_ERROR_INITIALIZER;
 
 	if (plain) {
-		const char *s2 = memFind(s + init, ls - init + 1, p, lp);
+		const char *s2 = (const char *)memFind((const uint8_t *)s + init, ls - init,
+												(const uint8_t *)p, lp);
 		if (s2) {
 				ObjArray *ret = newArray(runCtx, 2, OBJ_TUPLE);
 				ELOX_CHECK_THROW_RET_VAL(ret != NULL, &error, OOM(runCtx), EXCEPTION_VAL);
@@ -513,29 +716,39 @@ static Value doMatch(Args *args, bool plain, bool retPos) {
 				return OBJ_VAL(ret);
 		}
 	} else {
+		CompiledPattern *program = getPattern(runCtx, pattern, true, &error);
+		if (ELOX_UNLIKELY(error.raised))
+			return EXCEPTION_VAL;
+
 		MatchState state = {
 			.runCtx = runCtx,
-			.matchdepth = MAXDEPTH,
+			.src = inst,
 			.src_init = s,
 			.src_end = s + ls,
-			.p_end = p + lp
+			.sets = program->sets,
+			.code_end = program->code + program->codeLen,
+			.stack = program->stack,
+			.trail = program->trail
 		};
 
 		const char *s1 = s + init;
-		bool anchor = (lp > 0) && (*p == '^');
-		if (anchor) {
-			p++;
-			lp--;
-		}
+		bool anchor = program->anchor;
 
-		do {
+		for (;;) {
 			const char *res;
+			if (!anchor) {
+				s1 = nextCandidate(program, s1, state.src_end);
+				if (s1 == NULL)
+					break;
+			}
 			state.level = 0;
-			ELOX_CHECK_THROW_RET_VAL(state.matchdepth == MAXDEPTH, &error,
-									 RTERR(runCtx, "state.matchdepth != MAXDEPTH"), EXCEPTION_VAL);
-			res = (match(&state, s1, p, &error));
-			if (ELOX_UNLIKELY(error.raised))
-				return EXCEPTION_VAL;
+			if (program->literal && !anchor)
+				res = s1 + program->prefixLen;
+			else {
+				res = match(&state, s1, program->code, &error);
+				if (ELOX_UNLIKELY(error.raised))
+					return EXCEPTION_VAL;
+			}
 			if (res != NULL) {
 				int16_t numCaptures = getNumCaptures(&state, s1);
 				ObjArray *ret = newArray(runCtx, numCaptures + 2 * (int)retPos, OBJ_TUPLE);
@@ -554,7 +767,9 @@ static Value doMatch(Args *args, bool plain, bool retPos) {
 				pop(fiber);
 				return OBJ_VAL(ret);
 			}
-		} while (s1++ < state.src_end && !anchor);
+			if (anchor || (s1++ >= state.src_end))
+				break;
+		}
 	}
 
 	return NIL_VAL;
@@ -629,8 +844,10 @@ static void add_value(MatchState *ms, HeapCString *b, const char *s, const char
 					return;
 			}
 			repl = runCall(runCtx, n);
-			if (ELOX_UNLIKELY(IS_EXCEPTION(repl)))
+			if (ELOX_UNLIKELY(IS_EXCEPTION(repl))) {
+				error->raised = true;
 				return;
+			}
 			pop(fiber);
 			break;
 		}
@@ -646,6 +863,9 @@ static void add_value(MatchState *ms, HeapCString *b, const char *s, const char
 		ELOX_THROW_RET(error, RTERR(runCtx, "invalid replacement value"));
 	push(fiber, repl);
 	ObjString *str = AS_STRING(repl);
+	flattenString(runCtx, str, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return;
 	heapStringAddString(runCtx, b, str->string.chars, str->string.length); // add result to accumulator
 	pop(fiber);
 }
@@ -672,21 +892,25 @@ Value stringGsub(Args *args) {
 
 	const char *src = (const char *)inst->string.chars;
 	int srcl = inst->string.length;
-	const char *p = (const char *)pattern->string.chars;
-	int lp = pattern->string.length;
 
-	bool anchor = (lp > 0) && (*p == '^');
-	if (anchor) { // skip anchor character
-		p++;
-		lp--;
-	}
+	EloxError error = ELOX_ERROR_INITIALIZER;
+
+	CompiledPattern *program = getPattern(runCtx, pattern, true, &error);
+	if (ELOX_UNLIKELY(error.raised))
+		return EXCEPTION_VAL;
+	// a callable replacement may run other patterns and evict this one
+	retainProgram(&program->program);
+	bool anchor = program->anchor;
 
 	MatchState state = {
 		.runCtx = runCtx,
-		.matchdepth = MAXDEPTH,
+		.src = inst,
 		.src_init = src,
 		.src_end = src + srcl,
-		.p_end = p + lp,
+		.sets = program->sets,
+		.code_end = program->code + program->codeLen,
+		.stack = program->stack,
+		.trail = program->trail,
 		.repl = repl,
 		.replType = replType
 	};
@@ -694,17 +918,25 @@ Value stringGsub(Args *args) {
 	HeapCString output;
 	initHeapStringWithSize(runCtx, &output, srcl + 1);
 
-	EloxError error = ELOX_ERROR_INITIALIZER;
-
 	size_t n = 0;
 	while (n < max_s) {
 		const char *e;
+		if (!anchor) {
+			// copy everything up to the next possible match start
+			const char *candidate = nextCandidate(program, src, state.src_end);
+			if (candidate == NULL)
+				break;
+			heapStringAddString(runCtx, &output, (const uint8_t *)src, candidate - src);
+			src = candidate;
+		}
 		state.level = 0;
-		ELOX_CHECK_THROW_GOTO(state.matchdepth == MAXDEPTH, &error,
-							  RTERR(runCtx, "state.matchdepth != MAXDEPTH"), error);
-		e = match(&state, src, p, &error);
-		if (ELOX_UNLIKELY(error.raised))
-			goto error;
+		if (program->literal && !anchor)
+			e = src + program->prefixLen;
+		else {
+			e = match(&state, src, program->code, &error);
+			if (ELOX_UNLIKELY(error.raised))
+				goto error;
+		}
 		if (e) {
 			n++;
 			add_value(&state, &output, src, e, &error);
@@ -722,16 +954,18 @@ Value stringGsub(Args *args) {
 	}
 
 	heapStringAddString(runCtx, &output, (const uint8_t *)src, state.src_end - src);
+	releaseProgram(runCtx, &program->program);
 
-	ObjString *str = takeString(runCtx, output.chars, output.length, output.capacity);
+	ObjString *str = takeTransientString(runCtx, output.chars, output.length, output.capacity);
 	if (ELOX_UNLIKELY(str == NULL)) {
 		oomError(runCtx);
-		error.raised = true;
-		goto error;
+		freeHeapString(runCtx, &output);
+		return EXCEPTION_VAL;
 	}
 	return OBJ_VAL(str);
 
 error:
+	releaseProgram(runCtx, &program->program);
 	freeHeapString(runCtx, &output);
 	return EXCEPTION_VAL;
 }
@@ -747,34 +981,45 @@ static Value gmatchGetNext(RunCtx *runCtx, ObjInstance *inst, int32_t offset, El
 
 	struct BIGmatchIterator *gi = &vm->builtins.biGmatchIterator;
 
-	ObjString *string = AS_STRING(inst->fields.values[gi->_string]);
-	ObjString *pattern = AS_STRING(inst->fields.values[gi->_pattern]);
+	ObjString *string = AS_STRING(inst->fields[gi->_string]);
+	ObjString *pattern = AS_STRING(inst->fields[gi->_pattern]);
 
 	const char *s = (const char *)string->string.chars;
 	size_t ls = string->string.length;
-	const char *p = (const char *)pattern->string.chars;
-	size_t lp = pattern->string.length;
+
+	CompiledPattern *program = getPattern(runCtx, pattern, false, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return EXCEPTION_VAL;
 
 	MatchState state = {
 		.runCtx = runCtx,
-		.matchdepth = MAXDEPTH,
+		.src = string,
 		.src_init = s,
 		.src_end = s + ls,
-		.p_end = p + lp
+		.sets = program->sets,
+		.code_end = program->code + program->codeLen,
+		.stack = program->stack,
+		.trail = program->trail
 	};
 
 	for (const char *src = s + offset; src <= state.src_end; src++) {
 		const char *e;
+		src = nextCandidate(program, src, state.src_end);
+		if (src == NULL)
+			break;
 		state.level = 0;
-		ELOX_CHECK_THROW_RET_VAL(state.matchdepth == MAXDEPTH, error,
-								 RTERR(runCtx, "state.matchdepth != MAXDEPTH"), EXCEPTION_VAL);
-		if ((e = match(&state, src, p, error)) != NULL) {
+		if (program->literal)
+			e = src + program->prefixLen;
+		else {
+			e = match(&state, src, program->code, error);
 			if (ELOX_UNLIKELY(error->raised))
 				return EXCEPTION_VAL;
+		}
+		if (e != NULL) {
 			int32_t newStart = e - s;
 			if (e == src)
 				newStart++;  // empty match? advance at least one position
-			inst->fields.values[gi->_offset] = NUMBER_VAL(newStart);
+			inst->fields[gi->_offset] = NUMBER_VAL(newStart);
 			int16_t numCaptures = getNumCaptures(&state, src);
 			ObjArray *ret = newArray(runCtx, numCaptures, OBJ_TUPLE);
 			ELOX_CHECK_THROW_RET_VAL(ret != NULL, error, OOM(runCtx), EXCEPTION_VAL);
@@ -787,7 +1032,7 @@ static Value gmatchGetNext(RunCtx *runCtx, ObjInstance *inst, int32_t offset, El
 		}
 	}
 
-	inst->fields.values[gi->_offset] = NUMBER_VAL(GMATCH_DONE);
+	inst->fields[gi->_offset] = NUMBER_VAL(GMATCH_DONE);
 	return NIL_VAL;
 }
 
@@ -799,22 +1044,23 @@ Value gmatchIteratorHasNext(Args *args) {
 
 	ObjInstance *inst = AS_INSTANCE(getValueArg(args, 0));
 
-	int32_t offset = AS_NUMBER(inst->fields.values[gi->_offset]);
+	int32_t offset = AS_NUMBER(inst->fields[gi->_offset]);
 	if (offset < 0)
 		return BOOL_VAL(false);
 
-	Value cachedNext = inst->fields.values[gi->_cachedNext];
+	Value cachedNext = inst->fields[gi->_cachedNext];
 	if (!IS_NIL(cachedNext))
 		return BOOL_VAL(true);
 
 	EloxError error = ELOX_ERROR_INITIALIZER;
-	inst->fields.values[gi->_cachedNext] = gmatchGetNext(runCtx, inst, offset, &error);
+	inst->fields[gi->_cachedNext] = gmatchGetNext(runCtx, inst, offset, &error);
+	gcWriteBarrier(runCtx, (Obj *)inst);
 	if (ELOX_UNLIKELY(error.raised)) {
-		inst->fields.values[gi->_offset] = NUMBER_VAL(GMATCH_ERROR);
+		inst->fields[gi->_offset] = NUMBER_VAL(GMATCH_ERROR);
 		return EXCEPTION_VAL;
 	}
 
-	offset = AS_NUMBER(inst->fields.values[gi->_offset]);
+	offset = AS_NUMBER(inst->fields[gi->_offset]);
 	return BOOL_VAL(offset >= 0);
 }
 
@@ -826,7 +1072,7 @@ Value gmatchIteratorNext(Args *args) {
 
 	ObjInstance *inst = AS_INSTANCE(getValueArg(args, 0));
 
-	int32_t offset = AS_NUMBER(inst->fields.values[gi->_offset]);
+	int32_t offset = AS_NUMBER(inst->fields[gi->_offset]);
 	if (offset < 0) {
 		switch(offset) {
 			case GMATCH_DONE:
@@ -836,20 +1082,20 @@ Value gmatchIteratorNext(Args *args) {
 		}
 	}
 
-	Value cachedNext = inst->fields.values[gi->_cachedNext];
+	Value cachedNext = inst->fields[gi->_cachedNext];
 	if (!IS_NIL(cachedNext)) {
-		inst->fields.values[gi->_cachedNext] = NIL_VAL;
+		inst->fields[gi->_cachedNext] = NIL_VAL;
 		return cachedNext;
 	}
 
 	EloxError error = ELOX_ERROR_INITIALIZER;
 	Value next = gmatchGetNext(runCtx, inst, offset, &error);
 	if (ELOX_UNLIKELY(error.raised)) {
-		inst->fields.values[gi->_offset] = NUMBER_VAL(GMATCH_ERROR);
+		inst->fields[gi->_offset] = NUMBER_VAL(GMATCH_ERROR);
 		return EXCEPTION_VAL;
 	}
 
-	offset = AS_NUMBER(inst->fields.values[gi->_offset]);
+	offset = AS_NUMBER(inst->fields[gi->_offset]);
 	if (offset < 0)
 		return runtimeError(runCtx, "Gmatch already completed");
 
@@ -868,9 +1114,9 @@ Value stringGmatch(Args *args) {
 	ObjInstance *iter = newInstance(runCtx, gi->_class);
 	if (ELOX_UNLIKELY(iter == NULL))
 		return oomError(runCtx);
-	iter->fields.values[gi->_string] = OBJ_VAL(inst);
-	iter->fields.values[gi->_pattern] = OBJ_VAL(pattern);
-	iter->fields.values[gi->_offset] = NUMBER_VAL(0);
-	iter->fields.values[gi->_cachedNext] = NIL_VAL;
+	iter->fields[gi->_string] = OBJ_VAL(inst);
+	iter->fields[gi->_pattern] = OBJ_VAL(pattern);
+	iter->fields[gi->_offset] = NUMBER_VAL(0);
+	iter->fields[gi->_cachedNext] = NIL_VAL;
 	return OBJ_VAL(iter);
 }
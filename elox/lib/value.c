@@ -5,15 +5,12 @@
 #include <elox/object.h>
 #include <elox/value.h>
 #include <elox/state.h>
-
-#include <math.h>
-#include <inttypes.h>
+#include <elox/builtins/number.h>
 
 static void printNumber(RunCtx *runCtx, EloxIOStream stream, double n) {
-	if (trunc(n) == n)
-		eloxPrintf(runCtx, stream, "%" PRId64, (int64_t)n);
-	else
-		eloxPrintf(runCtx, stream, "%g", n);
+	char buffer[ELOX_NUMBER_BUFFER_SIZE];
+	int len = numberToChars(n, buffer);
+	runCtx->vmEnv->write(stream, buffer, len);
 }
 
 void printValue(RunCtx *runCtx, EloxIOStream stream, Value value) {
@@ -73,7 +70,7 @@ static uint32_t instanceHash(RunCtx *runCtx, ObjInstance *instance, EloxError *e
 		pop(fiber);
 		return AS_NUMBER(hash);
 	}
-	return instance->identityHash;
+	return objIdentityHash(runCtx, (Obj *)instance);
 }
 
 static bool instanceEquals(RunCtx *runCtx, ObjInstance *ai, ObjInstance *bi, EloxError *error) {
@@ -104,6 +101,51 @@ static bool instanceEquals(RunCtx *runCtx, ObjInstance *ai, ObjInstance *bi, Elo
 	return ai == bi;
 }
 
+// Tuples are immutable, so they hash and compare by content, which makes
+// them usable as composite keys
+static uint32_t tupleHash(RunCtx *runCtx, ObjArray *tuple, EloxError *error) {
+	uint32_t hash = 1;
+	for (int32_t i = 0; i < tuple->size; i++) {
+		uint32_t itemHash = hashValue(runCtx, tuple->items[i], error);
+		if (ELOX_UNLIKELY(error->raised))
+			return 0;
+		hash = 31 * hash + itemHash;
+	}
+	return hash;
+}
+
+static bool tupleEquals(RunCtx *runCtx, ObjArray *at, ObjArray *bt, EloxError *error) {
+	if (at == bt)
+		return true;
+	if (at->size != bt->size)
+		return false;
+	for (int32_t i = 0; i < at->size; i++) {
+		if (!valuesEquals(runCtx, at->items[i], bt->items[i], error))
+			return false;
+	}
+	return true;
+}
+
+static uint32_t objectHash(RunCtx *runCtx, Obj *obj, EloxError *error) {
+	switch (obj->type) {
+		case OBJ_STRING: {
+			ObjString *string = (ObjString *)obj;
+			flattenString(runCtx, string, error);
+			if (ELOX_UNLIKELY(error->raised))
+				return 0;
+			return stringHash(runCtx->vm->hashSeed, string);
+		}
+		case OBJ_STRINGPAIR:
+			return ((ObjStringPair *)obj)->hash;
+		case OBJ_INSTANCE:
+			return instanceHash(runCtx, (ObjInstance *)obj, error);
+		case OBJ_TUPLE:
+			return tupleHash(runCtx, (ObjArray *)obj, error);
+		default:
+			return objIdentityHash(runCtx, obj);
+	}
+}
+
 bool valuesEqual(Value a, Value b) {
 #ifdef ELOX_ENABLE_NAN_BOXING
 	if (IS_NUMBER(a) && IS_NUMBER(b)) {
@@ -137,19 +179,9 @@ typedef union {
 #ifdef ELOX_ENABLE_NAN_BOXING
 
 uint32_t hashValue(RunCtx *runCtx, Value value, EloxError *error) {
-	if (IS_OBJ(value)) {
-		Obj *obj = AS_OBJ(value);
-		switch (obj->type) {
-			case OBJ_STRING:
-				return ((ObjString *)obj)->hash;
-			case OBJ_STRINGPAIR:
-				return ((ObjStringPair *)obj)->hash;
-			case OBJ_INSTANCE:
-				return instanceHash(runCtx, (ObjInstance *)obj, error);
-			default:
-				return 0;
-		}
-	} else if (IS_BOOL(value))
+	if (IS_OBJ(value))
+		return objectHash(runCtx, AS_OBJ(value), error);
+	else if (IS_BOOL(value))
 		return AS_BOOL(value);
 	else if (IS_NUMBER(value)) {
 		DoubleHash dh = { .d = AS_NUMBER(value) };
@@ -164,7 +196,7 @@ bool valuesEquals(RunCtx *runCtx, const Value a, const Value b, EloxError *error
 	if (IS_STRING(a) && IS_STRING(b)) {
 		ObjString *as = AS_STRING(a);
 		ObjString *bs = AS_STRING(b);
-		return as == bs;
+		return stringsEqual(runCtx, as, bs, error);
 	} else if (IS_NUMBER(a) && IS_NUMBER(b))
 		return AS_NUMBER(a) == AS_NUMBER(b);
 	else if (IS_OBJ(a) && IS_OBJ(b)) {
@@ -175,6 +207,8 @@ bool valuesEquals(RunCtx *runCtx, const Value a, const Value b, EloxError *error
 		switch (ao->type) {
 			case OBJ_INSTANCE:
 				return instanceEquals(runCtx, (ObjInstance *)ao, (ObjInstance *)bo, error);
+			case OBJ_TUPLE:
+				return tupleEquals(runCtx, (ObjArray *)ao, (ObjArray *)bo, error);
 			case OBJ_STRINGPAIR: {
 				ObjStringPair *pair1 = (ObjStringPair *)ao;
 				ObjStringPair *pair2 = (ObjStringPair *)bo;
@@ -191,20 +225,8 @@ bool valuesEquals(RunCtx *runCtx, const Value a, const Value b, EloxError *error
 
 uint32_t hashValue(RunCtx *runCtx, Value value, EloxError *error) {
 	switch (value.type) {
-		case VAL_OBJ: {
-			Obj *obj = AS_OBJ(value);
-			switch (obj->type) {
-				case OBJ_STRING:
-					return ((ObjString *)obj)->hash;
-				case OBJ_STRINGPAIR:
-					return ((ObjStringPair *)obj)->hash;
-				case OBJ_INSTANCE:
-					return instanceHash(runCtx, (ObjInstance *)obj, error);
-				default:
-					return 0;
-			}
-			break;
-		}
+		case VAL_OBJ:
+			return objectHash(runCtx, AS_OBJ(value), error);
 		case VAL_BOOL:
 			return AS_BOOL(value);
 		case VAL_NUMBER: {
@@ -235,8 +257,12 @@ bool valuesEquals(RunCtx *runCtx, const Value a, const Value b, EloxError *error
 			if (ao->type != bo->type)
 				return false;
 			switch (ao->type) {
+				case OBJ_STRING:
+					return stringsEqual(runCtx, (ObjString *)ao, (ObjString *)bo, error);
 				case OBJ_INSTANCE:
 					return instanceEquals(runCtx, (ObjInstance *)ao, (ObjInstance *)bo, error);
+				case OBJ_TUPLE:
+					return tupleEquals(runCtx, (ObjArray *)ao, (ObjArray *)bo, error);
 				case OBJ_STRINGPAIR: {
 					ObjStringPair *pair1 = (ObjStringPair *)ao;
 					ObjStringPair *pair2 = (ObjStringPair *)bo;
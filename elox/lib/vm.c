@@ -123,6 +123,27 @@ static CallFrame *setupNativeStackFrame(RunCtx *runCtx, FiberCtx *fiberCtx, Valu
 	return frame;
 }
 
+// Natives read string bytes directly, so ropes are flattened before the call
+static bool flattenNativeArgs(RunCtx *runCtx, CallFrame *frame) {
+	EloxError error = ELOX_ERROR_INITIALIZER;
+	for (int i = 0; i < frame->stackArgs; i++) {
+		Value arg = frame->slots[i];
+		if (IS_STRING(arg)) {
+			flattenString(runCtx, AS_STRING(arg), &error);
+			if (ELOX_UNLIKELY(error.raised))
+				return false;
+		}
+	}
+	return true;
+}
+
+#ifdef ELOX_ENABLE_JIT
+static inline void countHotness(RunCtx *runCtx, ObjFunction *function) {
+	if ((function->jitCode == NULL) && (++function->hotness == ELOX_JIT_HOTNESS_THRESHOLD))
+		jitCompile(runCtx, function);
+}
+#endif
+
 static bool call(RunCtx *runCtx, ObjClosure *closure, ObjFunction *function,
 				 int argCount, uint8_t argOffset) {
 	FiberCtx *fiber = runCtx->activeFiber;
@@ -141,6 +162,9 @@ DBG_PRINT_STACK("asstk", runCtx);
 	frame->function = function;
 	frame->ip = function->chunk.code;
 	frame->handlerCount = 0;
+#ifdef ELOX_ENABLE_JIT
+	countHotness(runCtx, function);
+#endif
 
 	return true;
 }
@@ -168,6 +192,10 @@ static bool callNative(RunCtx *runCtx, ObjNative *native,
 	frame->type = ELOX_FT_INTER;
 	frame->closure = NULL;
 	frame->function = NULL;
+	if (ELOX_UNLIKELY(!flattenNativeArgs(runCtx, frame))) {
+		releaseCallFrame(runCtx, fiber);
+		return false;
+	}
 
 #ifdef ELOX_DEBUG_TRACE_EXECUTION
 	eloxPrintf(runCtx, ELOX_IO_DEBUG, "<native>( %p --->", native);
@@ -215,6 +243,10 @@ static bool callNativeClosure(RunCtx *runCtx, ObjNativeClosure *closure,
 		return false;
 	}
 	frame->type = ELOX_FT_INTER;
+	if (ELOX_UNLIKELY(!flattenNativeArgs(runCtx, frame))) {
+		releaseCallFrame(runCtx, fiber);
+		return false;
+	}
 
 #ifdef ELOX_DEBUG_TRACE_EXECUTION
 	ELOX_WRITE(runCtx, ELOX_IO_DEBUG, "#native#--->");
@@ -271,6 +303,9 @@ static void printStackTrace(RunCtx *runCtx, EloxIOStream stream) {
 	int frameNo = 0;
 	for (CallFrame *frame = fiber->activeFrame; frame != NULL; frame = frame->prev) {
 		ObjFunction *function = frame->function;
+		// native frames have no code
+		if (function == NULL)
+			continue;
 		// -1 because the IP is sitting on the next instruction to be executed.
 		size_t instruction = frame->ip - function->chunk.code - 1;
 		uint32_t lineno = getLine(&function->chunk, instruction);
@@ -317,7 +352,7 @@ Value runtimeError(RunCtx *runCtx, const char *format, ...) {
 	ObjInstance *errorInst = newInstance(runCtx, vm->builtins.biRuntimeException._class);
 	// TODO: check
 	push(fiber, OBJ_VAL(errorInst));
-	ObjString *msgObj = takeString(runCtx, msg.chars, msg.length, msg.capacity);
+	ObjString *msgObj = takeTransientString(runCtx, msg.chars, msg.length, msg.capacity);
 	// TODO: check
 	push(fiber, OBJ_VAL(msgObj));
 	bool wasNative;
@@ -450,17 +485,9 @@ static unsigned int inherit(RunCtx *runCtx, uint8_t *ip, EloxError *error) {
 	if (superRefCount > 0)
 		memcpy(clazz->memberRefs, super->memberRefs, superRefCount * sizeof(MemberRef));
 
-	for (int i = 0; i < super->fields.capacity; i++) {
-		Entry *entry = &super->fields.entries[i];
-		if (entry->key != NULL) {
-			bool isNewKey = tableSet(runCtx, &clazz->fields, entry->key, entry->value, error);
-			if (ELOX_UNLIKELY(error->raised))
-				return (ptr - ip);
-			ELOX_CHECK_THROW_RET_VAL(isNewKey, error,
-									 RTERR(runCtx, "Field '%s' shadows field from superclass", entry->key->string.chars),
-									 ptr - ip);
-		}
-	}
+	// fields are defined after inheriting, the shape stays shared until then
+	releaseShape(runCtx, clazz->shape);
+	clazz->shape = retainShape(super->shape);
 	tableAddAll(runCtx, &super->methods, &clazz->methods, error);
 	if (ELOX_UNLIKELY(error->raised))
 		return (ptr - ip);
@@ -653,9 +680,16 @@ static void defineField(RunCtx *runCtx, ObjString *name, EloxError *error) {
 	FiberCtx *fiber = runCtx->activeFiber;
 
 	ObjClass *clazz = AS_CLASS(peek(fiber, 1));
-	int index = clazz->fields.count;
-	// TODO: check
-	tableSet(runCtx, &clazz->fields, name, NUMBER_VAL(index), error);
+	int32_t slot = shapeAddField(runCtx, &clazz->shape, name, error);
+	if (ELOX_UNLIKELY(error->raised))
+		return;
+	if (ELOX_UNLIKELY(slot < 0)) {
+		ObjClass *super = AS_CLASS(clazz->super);
+		if (shapeLookup(super->shape, name) >= 0)
+			ELOX_THROW_RET(error, RTERR(runCtx, "Field '%s' shadows field from superclass",
+										name->string.chars));
+		ELOX_THROW_RET(error, RTERR(runCtx, "Duplicate field '%s'", name->string.chars));
+	}
 }
 
 static void defineStatic(RunCtx *runCtx, ObjString *name, EloxError *error) {
@@ -785,6 +819,9 @@ static Value getStackTrace(RunCtx *runCtx) {
 
 	for (CallFrame *frame = fiber->activeFrame; frame != NULL; frame = frame->prev) {
 		ObjFunction *function = frame->function;
+		// native frames have no code
+		if (function == NULL)
+			continue;
 		// -1 because the IP is sitting on the next instruction to be executed
 		size_t instruction = frame->ip - function->chunk.code - 1;
 		uint32_t lineNo = getLine(&function->chunk, instruction);
@@ -792,12 +829,12 @@ static Value getStackTrace(RunCtx *runCtx) {
 		ObjInstance *elem = newInstance(runCtx, ste->_class);
 		if (ELOX_UNLIKELY(elem == NULL))
 			goto cleanup;
-		elem->fields.values[ste->_fileName] = OBJ_VAL(function->chunk.fileName);
-		elem->fields.values[ste->_lineNumber] = NUMBER_VAL(lineNo);
+		elem->fields[ste->_fileName] = OBJ_VAL(function->chunk.fileName);
+		elem->fields[ste->_lineNumber] = NUMBER_VAL(lineNo);
 		if (function->name == NULL)
-			elem->fields.values[ste->_functionName] = OBJ_VAL(vm->builtins.scriptString);
+			elem->fields[ste->_functionName] = OBJ_VAL(vm->builtins.scriptString);
 		else
-			elem->fields.values[ste->_functionName] = OBJ_VAL(function->name);
+			elem->fields[ste->_functionName] = OBJ_VAL(function->name);
 
 		appendToArray(runCtx, arr, OBJ_VAL(elem));
 	}
@@ -808,15 +845,14 @@ cleanup:
 	return ret;
 }
 
-bool setInstanceField(ObjInstance *instance, ObjString *name, Value value) {
-	ObjClass *clazz = instance->clazz;
-	Value valueIndex;
-	if (tableGet(&clazz->fields, name, &valueIndex)) {
-		int valueOffset = AS_NUMBER(valueIndex);
-		instance->fields.values[valueOffset] = value;
-		return false;
+bool setInstanceField(RunCtx *runCtx, ObjInstance *instance, ObjString *name, Value value) {
+	int32_t slot = shapeLookup(instance->clazz->shape, name);
+	if (slot >= 0) {
+		instance->fields[slot] = value;
+		gcWriteBarrier(runCtx, (Obj *)instance);
+		return true;
 	}
-	return true;
+	return false;
 }
 
 static bool instanceOf(ObjKlass *T, ObjClass *S) {
@@ -1073,13 +1109,65 @@ static bool callValue(RunCtx *runCtx, Value callee, int argCount, bool *wasNativ
 	return false;
 }
 
-static bool invoke(RunCtx *runCtx, ObjString *name, int argCount) {
+static ICEntry *icLookup(InlineCache *cache, ObjClass *clazz) {
+	for (int i = 0; i < ELOX_IC_WAYS; i++) {
+		if (cache->entries[i].clazz == clazz)
+			return &cache->entries[i];
+	}
+	return NULL;
+}
+
+// Field entries also hit for other classes with the same shape
+static ICEntry *icLookupField(InlineCache *cache, Shape *shape) {
+	for (int i = 0; i < ELOX_IC_WAYS; i++) {
+		if (cache->entries[i].shape == shape)
+			return &cache->entries[i];
+	}
+	return NULL;
+}
+
+static ICEntry *icFill(RunCtx *runCtx, ObjFunction *function, InlineCache *cache,
+					   ObjClass *clazz, ICKind kind) {
+	ICEntry *entry = &cache->entries[cache->next++ % ELOX_IC_WAYS];
+	entry->clazz = clazz;
+	entry->shape = (kind == IC_FIELD) ? clazz->shape : NULL;
+	entry->kind = kind;
+	// the cache keeps the class alive
+	gcWriteBarrier(runCtx, (Obj *)function);
+	return entry;
+}
+
+static bool invoke(RunCtx *runCtx, ObjString *name, int argCount,
+				   ObjFunction *function, InlineCache *cache) {
 	VM *vm = runCtx->vm;
 	FiberCtx *fiber = runCtx->activeFiber;
 
 	Value receiver = peek(fiber, argCount);
 
-	ObjClass *clazz = classOf(vm, receiver);
+	ObjClass *clazz = classOfFollowInstance(vm, receiver);
+	if (ELOX_LIKELY(clazz != NULL)) {
+		ICEntry *entry = icLookup(cache, clazz);
+		if (ELOX_LIKELY(entry != NULL)) {
+			bool wasNative;
+			if (entry->kind == IC_METHOD)
+				return callMethod(runCtx, entry->callable, argCount, 0, &wasNative);
+			if (IS_INSTANCE(receiver)) {
+				Value value = AS_INSTANCE(receiver)->fields[entry->fieldIndex];
+				fiber->stackTop[-argCount - 1] = value;
+				return callValue(runCtx, value, argCount, &wasNative);
+			}
+		} else if (IS_INSTANCE(receiver)) {
+			entry = icLookupField(cache, clazz->shape);
+			if (entry != NULL) {
+				Value value = AS_INSTANCE(receiver)->fields[entry->fieldIndex];
+				fiber->stackTop[-argCount - 1] = value;
+				bool wasNative;
+				return callValue(runCtx, value, argCount, &wasNative);
+			}
+		}
+	}
+
+	clazz = classOf(vm, receiver);
 	if (ELOX_UNLIKELY(clazz == NULL)) {
 		runtimeError(runCtx, "This value has no methods");
 		return false;
@@ -1102,8 +1190,10 @@ static bool invoke(RunCtx *runCtx, ObjString *name, int argCount) {
 		clazz = ((ObjInstance *)AS_OBJ(receiver))->clazz;
 
 		ObjInstance *instance = AS_INSTANCE(receiver);
-		Value value;
-		if (getInstanceValue(instance, name, &value)) {
+		int32_t fieldIndex = shapeLookup(clazz->shape, name);
+		if (fieldIndex >= 0) {
+			icFill(runCtx, function, cache, clazz, IC_FIELD)->fieldIndex = fieldIndex;
+			Value value = instance->fields[fieldIndex];
 			fiber->stackTop[-argCount - 1] = value;
 			bool wasNative;
 			return callValue(runCtx, value, argCount, &wasNative);
@@ -1115,8 +1205,10 @@ static bool invoke(RunCtx *runCtx, ObjString *name, int argCount) {
 		runtimeError(runCtx, "Undefined property '%s'", name->string.chars);
 		return false;
 	}
+	Obj *callable = AS_METHOD(method)->callable;
+	icFill(runCtx, function, cache, clazz, IC_METHOD)->callable = callable;
 	bool wasNative;
-	return callMethod(runCtx, AS_METHOD(method)->callable, argCount, 0, &wasNative);
+	return callMethod(runCtx, callable, argCount, 0, &wasNative);
 }
 
 static bool invokeMember(RunCtx *runCtx, Value *member, bool isMember, int argCount) {
@@ -1177,6 +1269,7 @@ static void closeUpvalues(RunCtx *runCtx, Value *last) {
 	while ((fiber->openUpvalues != NULL) && (fiber->openUpvalues->location >= last)) {
 		ObjUpvalue *upvalue = fiber->openUpvalues;
 		upvalue->closed = *upvalue->location;
+		gcWriteBarrier(runCtx, (Obj *)upvalue);
 #ifdef ELOX_DEBUG_TRACE_EXECUTION
 	eloxPrintf(runCtx, ELOX_IO_DEBUG, "%p >>>  (", upvalue);
 	printValue(runCtx, ELOX_IO_DEBUG, upvalue->closed);
@@ -1232,6 +1325,12 @@ Value toString(RunCtx *runCtx, Value value, EloxError *error) {
 		return EXCEPTION_VAL;
 	}
 
+	if (IS_STRING(strVal)) {
+		flattenString(runCtx, AS_STRING(strVal), error);
+		if (ELOX_UNLIKELY(error->raised))
+			return EXCEPTION_VAL;
+	}
+
 	pop(fiber);
 	return strVal;
 }
@@ -1239,7 +1338,7 @@ Value toString(RunCtx *runCtx, Value value, EloxError *error) {
 static Value *resolveRef(MemberRef *ref, ObjInstance *inst) {
 	if (ref->refType == REFTYPE_CLASS_MEMBER)
 		return &ref->data.value;
-	return &inst->fields.values[ref->data.propIndex];
+	return &inst->fields[ref->data.propIndex];
 }
 
 static bool buildMap(RunCtx *runCtx, uint16_t itemCount) {
@@ -1262,6 +1361,7 @@ static bool buildMap(RunCtx *runCtx, uint16_t itemCount) {
 		if (ELOX_UNLIKELY(error.raised))
 			return false;
 	}
+	gcWriteBarrier(runCtx, (Obj *)map);
 	pop(fiber);
 
 	// pop constructor arguments from the stack
@@ -1311,6 +1411,10 @@ static bool indexValue(RunCtx *runCtx) {
 				runtimeError(runCtx, "String index is not a number");
 				return false;
 			}
+			EloxError error = ELOX_ERROR_INITIALIZER;
+			flattenString(runCtx, str, &error);
+			if (ELOX_UNLIKELY(error.raised))
+				return false;
 			int32_t index = AS_NUMBER(indexVal);
 			result = stringAtSafe(runCtx, str, index);
 			if (ELOX_UNLIKELY(IS_EXCEPTION(result)))
@@ -1352,7 +1456,7 @@ static bool indexStore(RunCtx *runCtx) {
 				return false;
 			}
 
-			arraySet(array, index, item);
+			arraySet(runCtx, array, index, item);
 			break;
 		}
 		case VTYPE_OBJ_HASHMAP: {
@@ -1362,6 +1466,7 @@ static bool indexStore(RunCtx *runCtx) {
 			valueTableSet(runCtx, &map->items, indexVal, item, &error);
 			if (ELOX_UNLIKELY(error.raised))
 				return false;
+			gcWriteBarrier(runCtx, (Obj *)map);
 			break;
 		}
 		default:
@@ -1396,6 +1501,10 @@ static bool sliceValue(RunCtx *runCtx) {
 		}
 		case VTYPE_OBJ_STRING: {
 			ObjString *str = AS_STRING(sliceable);
+			EloxError error = ELOX_ERROR_INITIALIZER;
+			flattenString(runCtx, str, &error);
+			if (ELOX_UNLIKELY(error.raised))
+				return false;
 			result = stringSlice(runCtx, str, sliceStart, sliceEnd);
 			if (ELOX_UNLIKELY(IS_EXCEPTION(result)))
 				return false;
@@ -1462,6 +1571,13 @@ static void *INDispatchTable[] = {
 
 	OP_DISPATCH_START(op)
 		OP_DISPATCH_CASE(STRING_STRING): {
+			EloxError error = ELOX_ERROR_INITIALIZER;
+			flattenString(runCtx, AS_STRING(peek(fiber, 0)), &error);
+			if (ELOX_UNLIKELY(error.raised))
+				return false;
+			flattenString(runCtx, AS_STRING(peek(fiber, 1)), &error);
+			if (ELOX_UNLIKELY(error.raised))
+				return false;
 			ObjString *seq = AS_STRING(pop(fiber));
 			ObjString *val = AS_STRING(pop(fiber));
 			push(fiber, BOOL_VAL(stringContains(seq, val)));
@@ -1518,11 +1634,8 @@ static void resolveMember(RunCtx *runCtx, ObjClass *clazz, uint8_t slotType,
 		bool isField = false;
 
 		if (propType & MEMBER_FIELD) {
-			Value index;
-			if (tableGet(&clazz->fields, propName, &index)) {
-				propIndex = AS_NUMBER(index);
-				isField = true;
-			}
+			propIndex = shapeLookup(clazz->shape, propName);
+			isField = (propIndex >= 0);
 		}
 		if ((propIndex < 0) && (propType & MEMBER_METHOD))
 			propIndex = tableGetIndex(&clazz->methods, propName);
@@ -1872,7 +1985,8 @@ cleanup:
 	releaseTemps(&temps);
 }
 
-static void getProperty(RunCtx * runCtx, ObjString *name, EloxError *error) {
+static void getProperty(RunCtx * runCtx, ObjString *name,
+						ObjFunction *function, InlineCache *cache, EloxError *error) {
 	VM *vm = runCtx->vm;
 	FiberCtx *fiber = runCtx->activeFiber;
 
@@ -1880,11 +1994,20 @@ static void getProperty(RunCtx * runCtx, ObjString *name, EloxError *error) {
 
 	if (IS_INSTANCE(targetVal)) {
 		ObjInstance *instance = AS_INSTANCE(targetVal);
+		ObjClass *clazz = instance->clazz;
 
-		Value value;
-		if (getInstanceValue(instance, name, &value)) {
+		ICEntry *entry = icLookupField(cache, clazz->shape);
+		if (ELOX_LIKELY(entry != NULL)) {
 			pop(fiber); // Instance
-			push(fiber, value);
+			push(fiber, instance->fields[entry->fieldIndex]);
+			return;
+		}
+
+		int32_t fieldIndex = shapeLookup(clazz->shape, name);
+		if (fieldIndex >= 0) {
+			icFill(runCtx, function, cache, clazz, IC_FIELD)->fieldIndex = fieldIndex;
+			pop(fiber); // Instance
+			push(fiber, instance->fields[fieldIndex]);
 		} else {
 			bindMethod(runCtx, instance->clazz, name, error);
 			if (ELOX_UNLIKELY(error->raised))
@@ -2012,7 +2135,9 @@ static unsigned int doUnpack(RunCtx *runCtx, CallFrame *frame, EloxError *error)
 			}
 			case VAR_UPVALUE: {
 				uint8_t slot = CHUNK_READ_BYTE(ptr);
-				*frame->closure->upvalues[slot]->location = crtVal;
+				ObjUpvalue *upvalue = frame->closure->upvalues[slot];
+				*upvalue->location = crtVal;
+				gcWriteBarrier(runCtx, (Obj *)upvalue);
 				break;
 			}
 			case VAR_GLOBAL: {
@@ -2143,19 +2268,8 @@ static bool concatenate(RunCtx *runCtx) {
 	ObjString *b = AS_STRING(peek(fiber, 0));
 	ObjString *a = AS_STRING(peek(fiber, 1));
 
-	int length = a->string.length + b->string.length;
-	uint8_t *chars = ALLOCATE(runCtx, uint8_t, length + 1);
-	if (ELOX_UNLIKELY(chars == NULL)) {
-		oomError(runCtx);
-		return false;
-	}
-	memcpy(chars, a->string.chars, a->string.length);
-	memcpy(chars + a->string.length, b->string.chars, b->string.length);
-	chars[length] = '\0';
-
-	ObjString *result = takeString(runCtx, chars, length, length + 1);
+	ObjString *result = concatStrings(runCtx, a, b);
 	if (ELOX_UNLIKELY(result == NULL)) {
-		FREE(runCtx, uint8_t, chars);
 		oomError(runCtx);
 		return false;
 	}
@@ -2165,6 +2279,28 @@ static bool concatenate(RunCtx *runCtx) {
 	return true;
 }
 
+// Fuse GET_LOCAL with the instructions following it once the local is known
+// to hold a number. Only the leading opcode byte is rewritten, so jumps into
+// the middle of the sequence still execute the original instructions
+static void quickenGetLocal(CallFrame *frame, uint8_t *ip) {
+	switch (ip[0]) {
+		case OP_GET_LOCAL:
+			if ((ip[3] == OP_ADD) && IS_NUMBER(frame->slots[ip[1] + (ip[2] * frame->varArgs)]))
+				ip[-3] = OP_ADD_LOCAL_LOCAL;
+			break;
+		case OP_CONST8:
+			if ((ip[2] == OP_LESS) && IS_NUMBER(frame->function->chunk.constants.values[ip[1]]))
+				ip[-3] = OP_LESS_LOCAL_CONST;
+			break;
+		case OP_IMMI:
+			if (ip[5] == OP_LESS)
+				ip[-3] = OP_LESS_LOCAL_IMMI;
+			break;
+		default:
+			break;
+	}
+}
+
 #ifdef ELOX_ENABLE_COMPUTED_GOTO
 
 #define DISPATCH_START(instruction)      goto *dispatchTable[instruction];
@@ -2232,6 +2368,62 @@ EloxInterpretResult run(RunCtx *runCtx) {
 		push(fiber, valueType(a op b)); \
 	} while (false)
 
+// Register operands are slot, postArgs pairs, as for GET_LOCAL
+#define REG_SLOT(slot, postArgs) frame->slots[(slot) + ((postArgs) * frame->varArgs)]
+#define REG_RESULT(dst, dstPost, value) \
+	do { \
+		if ((dst) == REG_STACK) \
+			push(fiber, (value)); \
+		else \
+			REG_SLOT(dst, dstPost) = (value); \
+	} while (false)
+#define REG_BINARY_OP(op) \
+	do { \
+		uint8_t dst = ip[0]; \
+		uint8_t dstPost = ip[1]; \
+		Value aVal = REG_SLOT(ip[2], ip[3]); \
+		Value bVal = REG_SLOT(ip[4], ip[5]); \
+		ip += 6; \
+		if (ELOX_UNLIKELY(!IS_NUMBER(aVal) || !IS_NUMBER(bVal))) { \
+			frame->ip = ip; \
+			runtimeError(runCtx, "Operands must be numbers"); \
+			goto throwException; \
+		} \
+		REG_RESULT(dst, dstPost, NUMBER_VAL(AS_NUMBER(aVal) op AS_NUMBER(bVal))); \
+	} while (false)
+#define REG_BINARY_IMM_OP(op) \
+	do { \
+		uint8_t dst = ip[0]; \
+		uint8_t dstPost = ip[1]; \
+		Value aVal = REG_SLOT(ip[2], ip[3]); \
+		ip += 4; \
+		int32_t imm = READ_INT(); \
+		if (ELOX_UNLIKELY(!IS_NUMBER(aVal))) { \
+			frame->ip = ip; \
+			runtimeError(runCtx, "Operands must be numbers"); \
+			goto throwException; \
+		} \
+		REG_RESULT(dst, dstPost, NUMBER_VAL(AS_NUMBER(aVal) op imm)); \
+	} while (false)
+// Rewrite a quickened instruction back to its generic form and re-dispatch it
+#define DEOPTIMIZE(genericOp, operandOffset) \
+	do { \
+		ip -= (operandOffset); \
+		*ip = (genericOp); \
+	} while (false)
+// Push a comparison result, folding in a directly following JUMP_IF_FALSE
+#define CONDITION_RESULT(cond) \
+	do { \
+		bool _res = (cond); \
+		push(fiber, BOOL_VAL(_res)); \
+		if (*ip == OP_JUMP_IF_FALSE) { \
+			ip++; \
+			uint16_t _offset = READ_USHORT(); \
+			if (!_res) \
+				ip += _offset; \
+		} \
+	} while (false)
+
 	ELOX_ALIGN(32);
 	for (;;) {
 #ifdef ELOX_ENABLE_COMPUTED_GOTO
@@ -2243,6 +2435,11 @@ dispatchLoop: ;
 
 		disassembleInstruction(runCtx, &frame->function->chunk,
 							   (int)(ip - frame->function->chunk.code));
+#endif
+#ifdef ELOX_ENABLE_JIT
+		if ((frame->function->jitCode != NULL) &&
+			(frame->function->jitCode->entries[ip - frame->function->chunk.code] != 0))
+			ip = jitExecute(runCtx, frame, ip);
 #endif
 		uint8_t instruction = READ_BYTE();
 		DISPATCH_START(instruction)
@@ -2309,7 +2506,10 @@ dispatchLoop: ;
 			DISPATCH_CASE(GET_LOCAL): {
 				uint8_t slot = READ_BYTE();
 				uint8_t postArgs = READ_BYTE();
-				push(fiber, frame->slots[slot + (postArgs * frame->varArgs)]);
+				Value local = frame->slots[slot + (postArgs * frame->varArgs)];
+				push(fiber, local);
+				if (IS_NUMBER(local))
+					quickenGetLocal(frame, ip);
 				DISPATCH_BREAK;
 			}
 			DISPATCH_CASE(GET_VARARG): {
@@ -2379,13 +2579,18 @@ dispatchLoop: ;
 			}
 			DISPATCH_CASE(SET_UPVALUE): {
 				uint8_t slot = READ_BYTE();
-				*frame->closure->upvalues[slot]->location = peek(fiber, 0);
+				ObjUpvalue *upvalue = frame->closure->upvalues[slot];
+				*upvalue->location = peek(fiber, 0);
+				gcWriteBarrier(runCtx, (Obj *)upvalue);
 				DISPATCH_BREAK;
 			}
 			DISPATCH_CASE(GET_PROP): {
 				ObjString *name = READ_STRING16();
+				uint16_t cacheIndex = READ_USHORT();
+				ObjFunction *frameFunction = frame->function;
 				frame->ip = ip;
-				getProperty(runCtx, name, &error);
+				getProperty(runCtx, name, frameFunction,
+							&frameFunction->chunk.inlineCaches[cacheIndex], &error);
 				if (ELOX_UNLIKELY(error.raised))
 					goto throwException;
 				DISPATCH_BREAK;
@@ -2399,6 +2604,8 @@ dispatchLoop: ;
 				Value *prop = resolveRef(ref, instance);
 				pop(fiber); // Instance
 				push(fiber, *prop);
+				if (*ip == OP_RETURN)
+					ip[-3] = OP_GET_MEMBER_PROP_RETURN;
 				DISPATCH_BREAK;
 			}
 			DISPATCH_CASE(MAP_GET): {
@@ -2431,7 +2638,7 @@ dispatchLoop: ;
 				if (ELOX_LIKELY(IS_INSTANCE(instanceVal))) {
 					ObjInstance *instance = AS_INSTANCE(instanceVal);
 					ObjString *fieldName = READ_STRING16();
-					if (ELOX_UNLIKELY(!setInstanceField(instance, fieldName, peek(fiber, 0)))) {
+					if (ELOX_UNLIKELY(!setInstanceField(runCtx, instance, fieldName, peek(fiber, 0)))) {
 						frame->ip = ip;
 						runtimeError(runCtx, "Undefined field '%s'", fieldName->string.chars);
 						goto throwException;
@@ -2454,6 +2661,7 @@ dispatchLoop: ;
 				MemberRef *ref = &parentClass->memberRefs[propRef + frameFunction->refOffset];
 				Value *prop = resolveRef(ref, instance);
 				*prop = peek(fiber, 0);
+				gcWriteBarrier(runCtx, (Obj *)instance);
 				Value value = pop(fiber);
 				pop(fiber);
 				push(fiber, value);
@@ -2469,6 +2677,7 @@ dispatchLoop: ;
 					valueTableSet(runCtx, &map->items, OBJ_VAL(index), value, &error);
 					if (ELOX_UNLIKELY(error.raised))
 						goto throwException;
+					gcWriteBarrier(runCtx, (Obj *)map);
 					value = pop(fiber);
 					pop(fiber);
 					push(fiber, value);
@@ -2494,11 +2703,13 @@ dispatchLoop: ;
 				DISPATCH_BREAK;
 			}
 			DISPATCH_CASE(EQUAL): {
-				Value b = pop(fiber);
-				Value a = pop(fiber);
+				// comparing may allocate, keep the operands reachable
+				Value b = peek(fiber, 0);
+				Value a = peek(fiber, 1);
 				bool eq = valuesEquals(runCtx, a, b, &error);
 				if (ELOX_UNLIKELY(error.raised))
 					goto throwException;
+				popn(fiber, 2);
 				push(fiber, BOOL_VAL(eq));
 				DISPATCH_BREAK;
 			}
@@ -2527,6 +2738,7 @@ dispatchLoop: ;
 						double b = AS_NUMBER(pop(fiber));
 						double a = AS_NUMBER(pop(fiber));
 						push(fiber, NUMBER_VAL(a + b));
+						ip[-1] = OP_ADD_NUM_NUM;
 						OP_DISPATCH_BREAK;
 					}
 					OP_DISPATCH_CASE(STRING_STRING):
@@ -2606,6 +2818,9 @@ dispatchLoop: ;
 			DISPATCH_CASE(LOOP): {
 				uint16_t offset = READ_USHORT();
 				ip -= offset;
+#ifdef ELOX_ENABLE_JIT
+				countHotness(runCtx, frame->function);
+#endif
 				DISPATCH_BREAK;
 			}
 			DISPATCH_CASE(CALL): {
@@ -2625,10 +2840,13 @@ dispatchLoop: ;
 				ObjString *method = READ_STRING16();
 				int argCount = READ_BYTE();
 				bool hasExpansions = READ_BYTE();
+				uint16_t cacheIndex = READ_USHORT();
 				if (hasExpansions)
 					argCount += AS_NUMBER(pop(fiber));
+				ObjFunction *frameFunction = frame->function;
 				frame->ip = ip;
-				if (ELOX_UNLIKELY(!invoke(runCtx, method, argCount)))
+				if (ELOX_UNLIKELY(!invoke(runCtx, method, argCount, frameFunction,
+										  &frameFunction->chunk.inlineCaches[cacheIndex])))
 					goto throwException;
 				frame = fiber->activeFrame;
 				ip = frame->ip;
@@ -2716,6 +2934,8 @@ dispatchLoop: ;
 #endif
 					} else
 						closure->upvalues[i] = frame->closure->upvalues[index];
+					// capturing allocates, the closure may have been promoted meanwhile
+					gcWriteBarrier(runCtx, (Obj *)closure);
 				}
 				DISPATCH_BREAK;
 			}
@@ -2724,6 +2944,7 @@ dispatchLoop: ;
 				pop(fiber);
 				DISPATCH_BREAK;
 			DISPATCH_CASE(RETURN): {
+returnFromFrame: ;
 				Value result = peek(fiber, 0);
 				closeUpvalues(runCtx, frame->slots);
 				CallFrame *activeFrame = fiber->activeFrame;
@@ -2845,7 +3066,7 @@ throwException:
 				// TODO: check copyString
 				ObjString *stacktraceName = copyString(runCtx, ELOX_USTR_AND_LEN("stacktrace"));
 				push(fiber, OBJ_VAL(stacktraceName));
-				setInstanceField(instance, stacktraceName, stacktrace);
+				setInstanceField(runCtx, instance, stacktraceName, stacktrace);
 				popn(fiber, 2);
 				vm->handlingException++;
 				CallFrame *startFrame = propagateException(runCtx);
@@ -2923,9 +3144,110 @@ throwException:
 				runtimeError(runCtx, "Attempted to execute data section");
 				goto throwException;
 			}
+			DISPATCH_CASE(REG_ADD): {
+				uint8_t dst = ip[0];
+				uint8_t dstPost = ip[1];
+				Value aVal = REG_SLOT(ip[2], ip[3]);
+				Value bVal = REG_SLOT(ip[4], ip[5]);
+				ip += 6;
+				if (ELOX_LIKELY(IS_NUMBER(aVal) && IS_NUMBER(bVal))) {
+					REG_RESULT(dst, dstPost, NUMBER_VAL(AS_NUMBER(aVal) + AS_NUMBER(bVal)));
+				} else if (IS_STRING(aVal) && IS_STRING(bVal)) {
+					frame->ip = ip;
+					push(fiber, aVal);
+					push(fiber, bVal);
+					if (ELOX_UNLIKELY(!concatenate(runCtx)))
+						goto throwException;
+					if (dst != REG_STACK)
+						REG_SLOT(dst, dstPost) = pop(fiber);
+				} else {
+					frame->ip = ip;
+					runtimeError(runCtx, "Operands must be two numbers or two strings");
+					goto throwException;
+				}
+				DISPATCH_BREAK;
+			}
+			DISPATCH_CASE(REG_ADDI):
+				REG_BINARY_IMM_OP(+);
+				DISPATCH_BREAK;
+			DISPATCH_CASE(REG_SUB):
+				REG_BINARY_OP(-);
+				DISPATCH_BREAK;
+			DISPATCH_CASE(REG_SUBI):
+				REG_BINARY_IMM_OP(-);
+				DISPATCH_BREAK;
+			DISPATCH_CASE(REG_MUL):
+				REG_BINARY_OP(*);
+				DISPATCH_BREAK;
+			DISPATCH_CASE(REG_MULI):
+				REG_BINARY_IMM_OP(*);
+				DISPATCH_BREAK;
+			DISPATCH_CASE(ADD_NUM_NUM): {
+				Value bVal = peek(fiber, 0);
+				Value aVal = peek(fiber, 1);
+				if (ELOX_UNLIKELY(!IS_NUMBER(aVal) || !IS_NUMBER(bVal))) {
+					DEOPTIMIZE(OP_ADD, 1);
+					DISPATCH_BREAK;
+				}
+				popn(fiber, 2);
+				push(fiber, NUMBER_VAL(AS_NUMBER(aVal) + AS_NUMBER(bVal)));
+				DISPATCH_BREAK;
+			}
+			DISPATCH_CASE(ADD_LOCAL_LOCAL): {
+				// GET_LOCAL a, GET_LOCAL b, ADD
+				Value aVal = frame->slots[ip[0] + (ip[1] * frame->varArgs)];
+				Value bVal = frame->slots[ip[3] + (ip[4] * frame->varArgs)];
+				if (ELOX_UNLIKELY(!IS_NUMBER(aVal) || !IS_NUMBER(bVal))) {
+					DEOPTIMIZE(OP_GET_LOCAL, 1);
+					DISPATCH_BREAK;
+				}
+				ip += 6;
+				push(fiber, NUMBER_VAL(AS_NUMBER(aVal) + AS_NUMBER(bVal)));
+				DISPATCH_BREAK;
+			}
+			DISPATCH_CASE(LESS_LOCAL_CONST): {
+				// GET_LOCAL a, CONST8 b, LESS
+				Value aVal = frame->slots[ip[0] + (ip[1] * frame->varArgs)];
+				Value bVal = frame->function->chunk.constants.values[ip[3]];
+				if (ELOX_UNLIKELY(!IS_NUMBER(aVal) || !IS_NUMBER(bVal))) {
+					DEOPTIMIZE(OP_GET_LOCAL, 1);
+					DISPATCH_BREAK;
+				}
+				ip += 5;
+				CONDITION_RESULT(AS_NUMBER(aVal) < AS_NUMBER(bVal));
+				DISPATCH_BREAK;
+			}
+			DISPATCH_CASE(LESS_LOCAL_IMMI): {
+				// GET_LOCAL a, IMMI b, LESS
+				Value aVal = frame->slots[ip[0] + (ip[1] * frame->varArgs)];
+				if (ELOX_UNLIKELY(!IS_NUMBER(aVal))) {
+					DEOPTIMIZE(OP_GET_LOCAL, 1);
+					DISPATCH_BREAK;
+				}
+				int32_t b;
+				memcpy(&b, ip + 3, sizeof(int32_t));
+				ip += 8;
+				CONDITION_RESULT(AS_NUMBER(aVal) < b);
+				DISPATCH_BREAK;
+			}
+			DISPATCH_CASE(GET_MEMBER_PROP_RETURN): {
+				uint16_t propRef = READ_USHORT();
+				ObjInstance *instance = AS_INSTANCE(peek(fiber, 0));
+				ObjFunction *frameFunction = frame->function;
+				ObjClass *parentClass = frameFunction->parentClass;
+				MemberRef *ref = &parentClass->memberRefs[propRef + frameFunction->refOffset];
+				fiber->stackTop[-1] = *resolveRef(ref, instance);
+				goto returnFromFrame;
+			}
 		DISPATCH_END
 	}
 
+#undef REG_SLOT
+#undef REG_RESULT
+#undef REG_BINARY_OP
+#undef REG_BINARY_IMM_OP
+#undef DEOPTIMIZE
+#undef CONDITION_RESULT
 #undef READ_BYTE
 #undef READ_I8
 #undef READ_USHORT
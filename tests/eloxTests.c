@@ -3,36 +3,460 @@
 
 #include "elox/util.h"
 #include "elox/state.h"
+#include "elox/compiler.h"
+#include "elox/image.h"
 #include <elox.h>
 
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void runFunctionalTest(const char *path, bool incrementalGC) {
+	EloxConfig config;
+	eloxInitConfig(&config);
+	if (incrementalGC) {
+		config.gc.incremental = true;
+		// small steps, to interleave marking with the program as much as possible
+		config.gc.markBudget = 16;
+		config.gc.maxPauseUs = 0;
+	}
+	EloxVMCtx *vmCtx = eloxNewVMCtx(&config);
+	EloxRunCtxHandle *runHandle = eloxNewRunCtx(vmCtx);
+
+	EloxInterpretResult res = eloxRunFile(runHandle, path);
+	ck_assert_msg(res == ELOX_INTERPRET_OK, "FAIL (%d): %s", res, path);
+
+	eloxDestroyVMCtx(vmCtx);
+}
+
 #define FUNCTIONAL_TEST(PATH, NAME) \
 	START_TEST(NAME) {\
-		EloxConfig config; \
-		eloxInitConfig(&config); \
-		EloxVMCtx *vmCtx = eloxNewVMCtx(&config); \
-		EloxRunCtxHandle *runHandle = eloxNewRunCtx(vmCtx); \
-\
-		EloxInterpretResult res = eloxRunFile(runHandle, #PATH); \
-		ck_assert_msg(res == ELOX_INTERPRET_OK, "FAIL (%d): %s", res, #PATH); \
+		runFunctionalTest(#PATH, false); \
+	} END_TEST \
 \
-		eloxDestroyVMCtx(vmCtx); \
+	START_TEST(NAME##_incremental) {\
+		runFunctionalTest(#PATH, true); \
 	} END_TEST
 
 #include "elox-functional-tests.h"
 #undef FUNCTIONAL_TEST
 
+static int countOps(Chunk *chunk, uint8_t op) {
+	int count = 0;
+	for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+		if (chunk->code[offset] == op)
+			count++;
+	}
+	return count;
+}
+
+// Compiles a script and returns the first function it defines
+static ObjFunction *compileFunction(RunCtx *runCtx, const char *source) {
+	String fileName = ELOX_STRING("<test>");
+	String moduleName = ELOX_STRING("<main>");
+	ObjFunction *script = compile(runCtx, (uint8_t *)source, &fileName, &moduleName);
+	ck_assert_msg(script != NULL, "compile failed");
+	ValueArray *constants = &script->chunk.constants;
+	for (uint32_t i = 0; i < constants->count; i++) {
+		if (IS_FUNCTION(constants->values[i]))
+			return AS_FUNCTION(constants->values[i]);
+	}
+	ck_abort_msg("no function defined");
+	return NULL;
+}
+
+START_TEST(test_register_fold) {
+	EloxConfig config;
+	eloxInitConfig(&config);
+	EloxVMCtx *vmCtx = eloxNewVMCtx(&config);
+	EloxRunCtxHandle *runHandle = eloxNewRunCtx(vmCtx);
+	RunCtx *runCtx = &runHandle->runCtx;
+
+	// locals declared in the body live after the arguments (POST)
+	ObjFunction *function = compileFunction(runCtx,
+		"function f(n) {\n"
+		"	local s = 0;\n"
+		"	for (local i = 0; i < n; i = i + 1)\n"
+		"		s = s + i;\n"
+		"	return s;\n"
+		"}\n");
+	Chunk *chunk = &function->chunk;
+	ck_assert_int_eq(countOps(chunk, OP_REG_ADD), 1);
+	ck_assert_int_eq(countOps(chunk, OP_REG_ADDI), 1);
+	ck_assert_int_eq(countOps(chunk, OP_ADD), 0);
+	ck_assert_int_eq(countOps(chunk, OP_SET_LOCAL), 0);
+
+	// also when their position depends on the number of varargs
+	function = compileFunction(runCtx,
+		"function g(a, ...) {\n"
+		"	local b = a * 3;\n"
+		"	b -= a;\n"
+		"	return b;\n"
+		"}\n");
+	chunk = &function->chunk;
+	ck_assert_int_eq(countOps(chunk, OP_REG_MULI), 1);
+	ck_assert_int_eq(countOps(chunk, OP_REG_SUB), 1);
+	ck_assert_int_eq(countOps(chunk, OP_MULTIPLY) + countOps(chunk, OP_SUBTRACT), 0);
+
+	eloxDestroyVMCtx(vmCtx);
+} END_TEST
+
+// 40 bytes, so that concatenations of two pieces are long enough to become ropes
+#define ROPE_PIECE "0123456789abcdefghijklmnopqrstuvwxyz!?<>"
+#define ROPE_PIECE_LEN 40
+
+START_TEST(test_mark_budget) {
+	EloxConfig config;
+	eloxInitConfig(&config);
+	config.gc.incremental = true;
+	config.gc.markBudget = 0;
+	config.gc.maxPauseUs = 0;
+	EloxVMCtx *vmCtx = eloxNewVMCtx(&config);
+	EloxRunCtxHandle *runHandle = eloxNewRunCtx(vmCtx);
+
+	// steps that trace nothing would leave marking to allocation pressure
+	ck_assert_uint_eq(vmCtx->env.gc.markBudget, 1);
+
+	EloxString fileName = ELOX_STRING("<test>");
+	EloxString moduleName = ELOX_STRING("<main>");
+	char *script = strdup(
+		"local keep = [];\n"
+		"for (local i = 0; i < 20000; i = i + 1) {\n"
+		"	local s = 'item' + i:toString();\n"
+		"	if (i % 10 == 0)\n"
+		"		keep:add(s);\n"
+		"}\n"
+		"assert(keep:length() == 2000);\n"
+		"assert(keep[1999] == 'item19990');\n");
+	EloxInterpretResult res = eloxInterpret(runHandle, (uint8_t *)script, &fileName, &moduleName);
+	free(script);
+	ck_assert_int_eq(res, ELOX_INTERPRET_OK);
+
+	eloxDestroyVMCtx(vmCtx);
+} END_TEST
+
+START_TEST(test_rope) {
+	EloxConfig config;
+	eloxInitConfig(&config);
+	EloxVMCtx *vmCtx = eloxNewVMCtx(&config);
+	EloxRunCtxHandle *runHandle = eloxNewRunCtx(vmCtx);
+	RunCtx *runCtx = &runHandle->runCtx;
+	FiberCtx *fiber = runCtx->activeFiber;
+	EloxError error = ELOX_ERROR_INITIALIZER;
+
+	enum { PIECES = 200 };
+	char *expected = malloc(PIECES * ROPE_PIECE_LEN);
+	for (int i = 0; i < PIECES; i++)
+		memcpy(expected + i * ROPE_PIECE_LEN, ROPE_PIECE, ROPE_PIECE_LEN);
+
+	ObjString *piece = copyTransientString(runCtx, (const uint8_t *)ROPE_PIECE, ROPE_PIECE_LEN);
+	push(fiber, OBJ_VAL(piece));
+
+	// appending leans left, prepending leans right and needs a deep flattening stack
+	ObjString *appended = piece;
+	push(fiber, OBJ_VAL(appended));
+	ObjString *prepended = piece;
+	push(fiber, OBJ_VAL(prepended));
+	for (int i = 1; i < PIECES; i++) {
+		appended = concatStrings(runCtx, appended, piece);
+		fiber->stackTop[-2] = OBJ_VAL(appended);
+		prepended = concatStrings(runCtx, piece, prepended);
+		fiber->stackTop[-1] = OBJ_VAL(prepended);
+	}
+	ck_assert(appended->flags & STRING_ROPE);
+	ck_assert(prepended->flags & STRING_ROPE);
+	ck_assert(appended->string.chars == NULL);
+	ck_assert_int_eq(appended->string.length, PIECES * ROPE_PIECE_LEN);
+	ck_assert_int_eq(prepended->string.length, PIECES * ROPE_PIECE_LEN);
+
+	collectGarbage(runCtx);
+
+	// a rope hashes like the equal flat string, flattening it in place
+	ObjString *flat = copyString(runCtx, (const uint8_t *)expected, PIECES * ROPE_PIECE_LEN);
+	push(fiber, OBJ_VAL(flat));
+	ck_assert_int_eq(hashValue(runCtx, OBJ_VAL(appended), &error),
+					 hashValue(runCtx, OBJ_VAL(flat), &error));
+	ck_assert(!error.raised);
+	ck_assert(appended->string.chars != NULL);
+	ck_assert(((ObjRope *)appended)->left == NULL);
+	ck_assert(memcmp(appended->string.chars, expected, PIECES * ROPE_PIECE_LEN) == 0);
+	ck_assert_int_eq(appended->string.chars[PIECES * ROPE_PIECE_LEN], '\0');
+
+	// and compares equal to it, in both orders
+	ck_assert(stringsEqual(runCtx, flat, prepended, &error));
+	ck_assert(stringsEqual(runCtx, appended, prepended, &error));
+	ck_assert(!error.raised);
+	ck_assert(memcmp(prepended->string.chars, expected, PIECES * ROPE_PIECE_LEN) == 0);
+
+	// one byte off is a different string
+	expected[PIECES * ROPE_PIECE_LEN - 1] = '-';
+	ObjString *other = copyString(runCtx, (const uint8_t *)expected, PIECES * ROPE_PIECE_LEN);
+	ck_assert(!stringsEqual(runCtx, appended, other, &error));
+
+	free(expected);
+	eloxDestroyVMCtx(vmCtx);
+} END_TEST
+
+START_TEST(test_string_view) {
+	EloxConfig config;
+	eloxInitConfig(&config);
+	EloxVMCtx *vmCtx = eloxNewVMCtx(&config);
+	EloxRunCtxHandle *runHandle = eloxNewRunCtx(vmCtx);
+	RunCtx *runCtx = &runHandle->runCtx;
+	FiberCtx *fiber = runCtx->activeFiber;
+	EloxError error = ELOX_ERROR_INITIALIZER;
+
+	enum { SOURCE_LEN = 1000 };
+	uint8_t bytes[SOURCE_LEN];
+	for (int i = 0; i < SOURCE_LEN; i++)
+		bytes[i] = 'a' + i % 26;
+
+	ObjString *source = copyTransientString(runCtx, bytes, SOURCE_LEN);
+	push(fiber, OBJ_VAL(source));
+	ObjString *view = newStringView(runCtx, source, 100, 500);
+	push(fiber, OBJ_VAL(view));
+	ck_assert(view->flags & STRING_VIEW);
+	ck_assert(view->string.chars == source->string.chars + 100);
+
+	// views of views share the outermost parent
+	ObjString *inner = newStringView(runCtx, view, 50, 100);
+	push(fiber, OBJ_VAL(inner));
+	ck_assert(((ObjStringView *)inner)->parent == source);
+	ck_assert(inner->string.chars == source->string.chars + 150);
+
+	// short ranges are copied
+	ObjString *shortView = newStringView(runCtx, source, 10, 5);
+	ck_assert(!(shortView->flags & STRING_VIEW));
+
+	// only the views are left to keep the source alive
+	fiber->stackTop[-3] = NIL_VAL;
+	source = NULL;
+	collectGarbage(runCtx);
+	collectGarbage(runCtx);
+	ck_assert(memcmp(view->string.chars, bytes + 100, 500) == 0);
+	ck_assert(memcmp(inner->string.chars, bytes + 150, 100) == 0);
+
+	ObjString *copy = copyString(runCtx, bytes + 100, 500);
+	push(fiber, OBJ_VAL(copy));
+	ck_assert(stringsEqual(runCtx, view, copy, &error));
+	ck_assert_int_eq(hashValue(runCtx, OBJ_VAL(view), &error),
+					 hashValue(runCtx, OBJ_VAL(copy), &error));
+	ck_assert(!error.raised);
+
+	// terminating copies the range, after which the view no longer needs its parent
+	terminateString(runCtx, view, &error);
+	ck_assert(!error.raised);
+	ck_assert(((ObjStringView *)view)->parent == NULL);
+	ck_assert_int_eq(view->string.chars[500], '\0');
+	// drop the other view, which was the last reference to the source
+	fiber->stackTop[-2] = NIL_VAL;
+	collectGarbage(runCtx);
+	ck_assert(memcmp(view->string.chars, bytes + 100, 500) == 0);
+
+	eloxDestroyVMCtx(vmCtx);
+} END_TEST
+
+static void writeTextFile(const char *path, const char *text) {
+	FILE *file = fopen(path, "wb");
+	ck_assert_msg(file != NULL, "cannot write %s", path);
+	fputs(text, file);
+	fclose(file);
+}
+
+// Finds the only image in dir, returns the number of images found
+static int findImage(const char *dir, char *path, size_t size) {
+	int count = 0;
+	DIR *d = opendir(dir);
+	ck_assert_msg(d != NULL, "cannot open %s", dir);
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL) {
+		size_t len = strlen(entry->d_name);
+		if ((len > 6) && (strcmp(entry->d_name + len - 6, ".eloxc") == 0)) {
+			snprintf(path, size, "%s/%s", dir, entry->d_name);
+			count++;
+		}
+	}
+	closedir(d);
+	return count;
+}
+
+static ino_t fileId(const char *path) {
+	struct stat st;
+	ck_assert_msg(stat(path, &st) == 0, "missing %s", path);
+	return st.st_ino;
+}
+
+// Layout of the image header, see image.c
+#define IMAGE_CHECKSUM_OFFSET 32
+#define IMAGE_HEADER_SIZE 56
+
+// Sets the byte at offset in the only occurrence of code in the image at path,
+// with a checksum that matches the change
+static void patchImage(const char *path, const uint8_t *code, size_t codeLen,
+					   size_t offset, uint8_t value) {
+	FILE *file = fopen(path, "r+b");
+	ck_assert(file != NULL);
+	fseek(file, 0, SEEK_END);
+	size_t size = ftell(file);
+	uint8_t *image = malloc(size);
+	ck_assert(image != NULL);
+	fseek(file, 0, SEEK_SET);
+	ck_assert_uint_eq(fread(image, 1, size, file), size);
+
+	uint8_t *found = NULL;
+	for (size_t i = IMAGE_HEADER_SIZE; i + codeLen <= size; i++) {
+		if (memcmp(image + i, code, codeLen) == 0) {
+			ck_assert_msg(found == NULL, "code is not unique in %s", path);
+			found = image + i;
+		}
+	}
+	ck_assert_msg(found != NULL, "code not found in %s", path);
+	found[offset] = value;
+	uint64_t checksum = imageHash(ELOX_IMAGE_HASH_SEED, image + IMAGE_HEADER_SIZE,
+								  size - IMAGE_HEADER_SIZE);
+	memcpy(image + IMAGE_CHECKSUM_OFFSET, &checksum, sizeof(uint64_t));
+
+	fseek(file, 0, SEEK_SET);
+	ck_assert_uint_eq(fwrite(image, 1, size, file), size);
+	fclose(file);
+	free(image);
+}
+
+// Runs source in a fresh VM that loads modules through the cache in cacheDir
+static EloxInterpretResult runCached(const char *cacheDir, const char *source) {
+	EloxConfig config;
+	eloxInitConfig(&config);
+	EloxModuleLoader loaders[] = {
+		{ .loader = eloxCachingModuleLoader },
+		{ .loader = eloxBuiltinModuleLoader, .options = ELOX_BML_ENABLE_ALL },
+		{ .loader = NULL }
+	};
+	config.moduleLoaders = loaders;
+	config.moduleCacheDir = cacheDir;
+	EloxVMCtx *vmCtx = eloxNewVMCtx(&config);
+	EloxRunCtxHandle *runHandle = eloxNewRunCtx(vmCtx);
+
+	EloxString fileName = ELOX_STRING("<test>");
+	EloxString moduleName = ELOX_STRING("<main>");
+	char *script = strdup(source);
+	EloxInterpretResult res = eloxInterpret(runHandle, (uint8_t *)script, &fileName, &moduleName);
+	free(script);
+
+	eloxDestroyVMCtx(vmCtx);
+	return res;
+}
+
+START_TEST(test_caching_loader) {
+	char dir[] = "/tmp/eloxCacheTestXXXXXX";
+	ck_assert(mkdtemp(dir) != NULL);
+	char sourcePath[256];
+	snprintf(sourcePath, sizeof(sourcePath), "%s/cached.elox", dir);
+	char libraryPath[256];
+	snprintf(libraryPath, sizeof(libraryPath), "%s/?.elox", dir);
+	char *oldLibraryPath = getenv("ELOX_LIBRARY_PATH");
+	if (oldLibraryPath != NULL)
+		oldLibraryPath = strdup(oldLibraryPath);
+	setenv("ELOX_LIBRARY_PATH", libraryPath, 1);
+
+	char imagePath[512];
+	char newImagePath[512];
+
+	// miss: compiled and written to the cache
+	writeTextFile(sourcePath, "global value = 'first';\n");
+	ck_assert_int_eq(runCached(dir, "import cached; assert(cached::value == 'first');"),
+					 ELOX_INTERPRET_OK);
+	ck_assert_int_eq(findImage(dir, imagePath, sizeof(imagePath)), 1);
+	ino_t imageId = fileId(imagePath);
+
+	// hit: images are replaced through a rename, so a reused one keeps its file
+	ck_assert_int_eq(runCached(dir, "import cached; assert(cached::value == 'first');"),
+					 ELOX_INTERPRET_OK);
+	ck_assert_int_eq(findImage(dir, newImagePath, sizeof(newImagePath)), 1);
+	ck_assert_str_eq(newImagePath, imagePath);
+	ck_assert(fileId(imagePath) == imageId);
+
+	// stale: an edit with the same length is a different source
+	writeTextFile(sourcePath, "global value = 'other';\n");
+	ck_assert_int_eq(runCached(dir, "import cached; assert(cached::value == 'other');"),
+					 ELOX_INTERPRET_OK);
+	remove(imagePath);
+	ck_assert_int_eq(findImage(dir, imagePath, sizeof(imagePath)), 1);
+
+	// corrupt: damaged images are recompiled from source and replaced
+	FILE *image = fopen(imagePath, "r+b");
+	ck_assert(image != NULL);
+	fseek(image, -4, SEEK_END);
+	int byte = fgetc(image);
+	fseek(image, -4, SEEK_END);
+	fputc(byte ^ 0xff, image);
+	fclose(image);
+	imageId = fileId(imagePath);
+	ck_assert_int_eq(runCached(dir, "import cached; assert(cached::value == 'other');"),
+					 ELOX_INTERPRET_OK);
+	ck_assert(fileId(imagePath) != imageId);
+	// and the new one is used again
+	imageId = fileId(imagePath);
+	ck_assert_int_eq(runCached(dir, "import cached; assert(cached::value == 'other');"),
+					 ELOX_INTERPRET_OK);
+	ck_assert(fileId(imagePath) == imageId);
+
+	// corrupt code with a valid checksum: a local slot outside the frame
+	writeTextFile(sourcePath, "global function pick(a, b) { return b; }\n");
+	ck_assert_int_eq(runCached(dir, "import cached; assert(cached::pick(1, 2) == 2);"),
+					 ELOX_INTERPRET_OK);
+	remove(imagePath);
+	ck_assert_int_eq(findImage(dir, imagePath, sizeof(imagePath)), 1);
+	const uint8_t pickCode[] = { OP_GET_LOCAL, 2, 0, OP_RETURN, OP_NIL, OP_RETURN };
+	patchImage(imagePath, pickCode, sizeof(pickCode), 1, 200);
+	imageId = fileId(imagePath);
+	ck_assert_int_eq(runCached(dir, "import cached; assert(cached::pick(1, 2) == 2);"),
+					 ELOX_INTERPRET_OK);
+	ck_assert(fileId(imagePath) != imageId);
+
+	remove(imagePath);
+	remove(sourcePath);
+	rmdir(dir);
+	if (oldLibraryPath != NULL) {
+		setenv("ELOX_LIBRARY_PATH", oldLibraryPath, 1);
+		free(oldLibraryPath);
+	} else
+		unsetenv("ELOX_LIBRARY_PATH");
+} END_TEST
+
 int main(int argc ELOX_UNUSED, char **argv ELOX_UNUSED) {
 	Suite *s = suite_create("elox");
 
 	TCase *tcFunctional = tcase_create("Functional");
+	TCase *tcIncrementalGC = tcase_create("IncrementalGC");
 
 #define FUNCTIONAL_TEST(PATH, NAME) \
-	tcase_add_test(tcFunctional, NAME);
+	tcase_add_test(tcFunctional, NAME); \
+	tcase_add_test(tcIncrementalGC, NAME##_incremental);
 
 #include "elox-functional-tests.h"
 #undef FUNCTIONAL_TEST
 
 	suite_add_tcase(s, tcFunctional);
+	suite_add_tcase(s, tcIncrementalGC);
+
+	TCase *tcCompiler = tcase_create("Compiler");
+	tcase_add_test(tcCompiler, test_register_fold);
+	suite_add_tcase(s, tcCompiler);
+
+	TCase *tcGC = tcase_create("GC");
+	tcase_add_test(tcGC, test_mark_budget);
+	suite_add_tcase(s, tcGC);
+
+	TCase *tcStrings = tcase_create("Strings");
+	tcase_add_test(tcStrings, test_rope);
+	tcase_add_test(tcStrings, test_string_view);
+	suite_add_tcase(s, tcStrings);
+
+	TCase *tcLoader = tcase_create("Loader");
+	tcase_add_test(tcLoader, test_caching_loader);
+	suite_add_tcase(s, tcLoader);
 
 	SRunner *sr = srunner_create(s);
 